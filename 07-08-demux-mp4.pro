@@ -3,23 +3,6 @@ CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
 
-SOURCES += main.c \
-    demux.c \
-    mux.c
+SOURCES += main.c
 
-win32 {
-INCLUDEPATH += $$PWD/ffmpeg-4.2.1-win32-dev/include
-LIBS += $$PWD/ffmpeg-4.2.1-win32-dev/lib/avformat.lib   \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avcodec.lib    \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avdevice.lib   \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avfilter.lib   \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avutil.lib     \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/postproc.lib   \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swresample.lib \
-        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swscale.lib
-}
-
-HEADERS += \
-    demux.h \
-    log.h \
-    mux.h
+include(media.pri)
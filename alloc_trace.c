@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include <stdatomic.h>
+
+#include "alloc_trace.h"
+
+#if defined(ALLOC_TRACE) && defined(__GLIBC__)
+#define ALLOC_TRACE_HOOK 1
+#else
+#define ALLOC_TRACE_HOOK 0
+#endif
+
+typedef struct alloc_counter {
+    atomic_llong allocs;
+    atomic_llong frees;
+    atomic_llong bytes;
+    atomic_llong live;
+    atomic_llong peak;
+} alloc_counter_t;
+
+static alloc_counter_t counters[ALLOC_SCOPE_MAX];
+
+//malloc里不能调用__tls_get_addr(可能再次malloc),必须是initial-exec
+static __thread int current_scope __attribute__((tls_model("initial-exec")));
+
+int alloc_trace_enabled(void)
+{
+    return ALLOC_TRACE_HOOK;
+}
+
+int alloc_trace_enter(int scope)
+{
+    int prev = current_scope;
+
+    if (scope >= 0 && scope < ALLOC_SCOPE_MAX)
+        current_scope = scope;
+
+    return prev;
+}
+
+void alloc_trace_leave(int *prev)
+{
+    if (prev != NULL)
+        current_scope = *prev;
+}
+
+int alloc_trace_get(int scope, alloc_stats_t *stats)
+{
+    alloc_counter_t *c = NULL;
+
+    if (scope < 0 || scope >= ALLOC_SCOPE_MAX || stats == NULL)
+        return -1;
+
+    c = &counters[scope];
+    stats->allocs = atomic_load(&c->allocs);
+    stats->frees = atomic_load(&c->frees);
+    stats->bytes = atomic_load(&c->bytes);
+    stats->live = atomic_load(&c->live);
+    stats->peak = atomic_load(&c->peak);
+
+    return 0;
+}
+
+void alloc_trace_reset_peak(int scope)
+{
+    if (scope < 0 || scope >= ALLOC_SCOPE_MAX)
+        return;
+
+    atomic_store(&counters[scope].peak, atomic_load(&counters[scope].live));
+}
+
+#if ALLOC_TRACE_HOOK
+
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * 每块内存前面16字节记录大小,范围和到真正起始地址的偏移
+ * 对齐分配时偏移是对齐值,保证头部之后的地址满足对齐
+ */
+typedef struct alloc_header {
+    size_t size;
+    uint32_t offset;
+    uint32_t scope;
+} alloc_header_t;
+
+#define ALLOC_HEADER_SIZE   16
+
+enum ALLOC_OP {
+    ALLOC_OP_FREE       = 0,
+    ALLOC_OP_ALLOC      = 1,
+    ALLOC_OP_REALLOC    = 2,
+};
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void __alloc_account(int scope, int64_t delta, int op)
+{
+    alloc_counter_t *c = &counters[scope];
+    long long live = 0, peak = 0;
+
+    if (op == ALLOC_OP_FREE) {
+        atomic_fetch_add_explicit(&c->frees, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&c->allocs, 1, memory_order_relaxed);
+        if (delta > 0)
+            atomic_fetch_add_explicit(&c->bytes, delta, memory_order_relaxed);
+    }
+
+    live = atomic_fetch_add_explicit(&c->live, delta, memory_order_relaxed) + delta;
+    peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak(&c->peak, &peak, live))
+        ;
+}
+
+static inline alloc_header_t *__alloc_header(void *ptr)
+{
+    return (alloc_header_t *)((uint8_t *)ptr - ALLOC_HEADER_SIZE);
+}
+
+static void *__alloc(size_t alignment, size_t size)
+{
+    alloc_header_t *h = NULL;
+    uint8_t *base = NULL;
+    size_t prefix = alignment > ALLOC_HEADER_SIZE ? alignment : ALLOC_HEADER_SIZE;
+
+    if (size > SIZE_MAX - prefix) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (prefix == ALLOC_HEADER_SIZE)
+        base = __libc_malloc(size + prefix);
+    else
+        base = __libc_memalign(alignment, size + prefix);
+    if (base == NULL)
+        return NULL;
+
+    h = (alloc_header_t *)(base + prefix - ALLOC_HEADER_SIZE);
+    h->size = size;
+    h->offset = (uint32_t)prefix;
+    h->scope = current_scope;
+
+    __alloc_account(h->scope, (int64_t)size, ALLOC_OP_ALLOC);
+
+    return base + prefix;
+}
+
+void *malloc(size_t size)
+{
+    return __alloc(0, size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = NULL;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = __alloc(0, nmemb * size);
+    if (ptr != NULL)
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    alloc_header_t *h = NULL;
+
+    if (ptr == NULL)
+        return;
+
+    h = __alloc_header(ptr);
+    __alloc_account(h->scope, -(int64_t)h->size, ALLOC_OP_FREE);
+    __libc_free((uint8_t *)ptr - h->offset);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_header_t *h = NULL;
+    uint8_t *base = NULL;
+    void *out = NULL;
+    size_t old = 0;
+
+    if (ptr == NULL)
+        return malloc(size);
+
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    h = __alloc_header(ptr);
+    old = h->size;
+
+    //对齐分配的块realloc后不能保证对齐,重新分配拷贝
+    if (h->offset != ALLOC_HEADER_SIZE) {
+        out = malloc(size);
+        if (out != NULL) {
+            memcpy(out, ptr, old < size ? old : size);
+            free(ptr);
+        }
+        return out;
+    }
+
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    base = __libc_realloc((uint8_t *)ptr - ALLOC_HEADER_SIZE, size + ALLOC_HEADER_SIZE);
+    if (base == NULL)
+        return NULL;
+
+    h = (alloc_header_t *)base;
+    h->size = size;
+    __alloc_account(h->scope, (int64_t)size - (int64_t)old, ALLOC_OP_REALLOC);
+
+    return base + ALLOC_HEADER_SIZE;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr = NULL;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0)
+        return EINVAL;
+
+    ptr = __alloc(alignment, size);
+    if (ptr == NULL)
+        return ENOMEM;
+
+    *memptr = ptr;
+
+    return 0;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return __alloc(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return __alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return __alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return ptr != NULL ? __alloc_header(ptr)->size : 0;
+}
+
+#endif
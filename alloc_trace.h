@@ -0,0 +1,81 @@
+#ifndef __ALLOC_TRACE_H
+#define __ALLOC_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @brief 内存分配统计,用qmake CONFIG+=alloc_trace编译(定义ALLOC_TRACE)时才生效
+ *   替换malloc/free等函数(只支持glibc),每次分配记录在当前线程所在的范围,
+ *   释放时算回分配时的范围,所以其他线程释放demuxer分配的packet也能统计正确
+ *   demuxer_*和muxer_*接口内部的分配分别算在ALLOC_SCOPE_DEMUXER和ALLOC_SCOPE_MUXER
+ */
+enum ALLOC_SCOPE {
+    ALLOC_SCOPE_OTHER       = 0,
+    ALLOC_SCOPE_DEMUXER     = 1,
+    ALLOC_SCOPE_MUXER       = 2,
+    ALLOC_SCOPE_MAX,
+};
+
+typedef struct alloc_stats {
+    int64_t allocs;         //分配次数,realloc算一次
+    int64_t frees;
+    int64_t bytes;          //累计分配的字节数
+    int64_t live;           //当前未释放的字节数
+    int64_t peak;           //live的最大值
+} alloc_stats_t;
+
+/**
+ * @brief 是否是统计版本
+ *
+ * @return int: 1是 0不是,不是时统计结果都是0
+ */
+int alloc_trace_enabled(void);
+
+/**
+ * @brief 进入一个范围,之后当前线程的分配都算在这个范围,一般用ALLOC_TRACE_SCOPE
+ *
+ * @param scope: ALLOC_SCOPE
+ * @return int: 之前的范围,传给alloc_trace_leave
+ */
+int alloc_trace_enter(int scope);
+
+/**
+ * @brief 恢复alloc_trace_enter之前的范围
+ *
+ * @param prev: alloc_trace_enter的返回值
+ */
+void alloc_trace_leave(int *prev);
+
+/**
+ * @brief 获取一个范围的统计
+ *
+ * @param scope: ALLOC_SCOPE
+ * @param stats: 输出
+ * @return int: 0成功 其他失败
+ */
+int alloc_trace_get(int scope, alloc_stats_t *stats);
+
+/**
+ * @brief 把peak重置为当前的live,用于测量某一段操作的峰值
+ *
+ * @param scope: ALLOC_SCOPE
+ */
+void alloc_trace_reset_peak(int scope);
+
+#ifdef ALLOC_TRACE
+//函数返回时自动恢复之前的范围,必须放在函数的变量声明中
+#define ALLOC_TRACE_SCOPE(scope) \
+    int __alloc_trace_prev __attribute__((cleanup(alloc_trace_leave), unused)) = alloc_trace_enter(scope)
+#else
+#define ALLOC_TRACE_SCOPE(scope)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__ALLOC_TRACE_H
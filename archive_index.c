@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#include "archive_index.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#define ftruncate(fd, size) _chsize_s(fd, size)
+#else
+#include <sys/mman.h>
+#define O_BINARY        0
+#endif
+
+#define ARCHIVE_MAGIC           MKTAG('A', 'R', 'C', 'I')
+#define ARCHIVE_VERSION         1
+#define ARCHIVE_HEADER_SIZE     64
+#define ARCHIVE_RECORD_SIZE     32
+#define ARCHIVE_GROW_RECORDS    4096    //每次扩展128K,5分钟一个分段时约两周
+
+/**
+ * 索引文件的头和记录都按本机字节序直接映射,字节序不同的机器上magic不匹配
+ */
+typedef struct archive_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;             //记录写完之后才增加,只读进程用__atomic_load_n读取
+    uint64_t names_size;        //.names文件中已经使用的字节数
+    uint8_t reserved[40];
+} archive_header_t;
+
+typedef struct archive_record {
+    int64_t start_us;
+    int64_t end_us;
+    int64_t size;
+    uint32_t name_offset;       //在.names文件中的位置
+    uint32_t name_len;          //不包括结尾的0
+} archive_record_t;
+
+struct archive_index {
+    pthread_mutex_t mutex;
+    int fd;
+    int names_fd;
+    int writable;
+    uint8_t *map;
+    int64_t map_size;
+    int capacity;               //映射的记录个数
+};
+
+#define ARCHIVE_HEADER(index)   ((archive_header_t *)(index)->map)
+#define ARCHIVE_RECORDS(index)  ((archive_record_t *)((index)->map + ARCHIVE_HEADER_SIZE))
+
+static void __archive_unmap(archive_index_t *index)
+{
+    if (index->map == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(index->map);
+#else
+    munmap(index->map, index->map_size);
+#endif
+    index->map = NULL;
+    index->map_size = 0;
+    index->capacity = 0;
+}
+
+/**
+ * 按文件当前大小重新映射
+ */
+static int __archive_map(archive_index_t *index)
+{
+    struct stat st;
+    void *map = NULL;
+
+    __archive_unmap(index);
+
+    if (fstat(index->fd, &st) != 0 || st.st_size < ARCHIVE_HEADER_SIZE)
+        return -1;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(index->fd), NULL,
+                                       index->writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+        return -1;
+    map = MapViewOfFile(mapping, index->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)st.st_size);
+    CloseHandle(mapping);
+    if (map == NULL)
+        return -1;
+#else
+    map = mmap(NULL, st.st_size, index->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, index->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+#endif
+
+    index->map = map;
+    index->map_size = st.st_size;
+    index->capacity = (int)FFMIN((st.st_size - ARCHIVE_HEADER_SIZE) / ARCHIVE_RECORD_SIZE, INT_MAX);
+
+    return 0;
+}
+
+static int __archive_grow(archive_index_t *index)
+{
+    int64_t size = ARCHIVE_HEADER_SIZE + (int64_t)(index->capacity + ARCHIVE_GROW_RECORDS) * ARCHIVE_RECORD_SIZE;
+
+    //windows上映射着的文件不能改变大小
+    __archive_unmap(index);
+
+    if (ftruncate(index->fd, size) != 0) {
+        __archive_map(index);
+        return -1;
+    }
+
+    return __archive_map(index);
+}
+
+/**
+ * 可用的记录个数,其他进程追加后超出映射范围时重新映射
+ */
+static int __archive_count(archive_index_t *index)
+{
+    int count = 0;
+
+    if (index->map == NULL && __archive_map(index) != 0)
+        return 0;
+
+    count = (int)__atomic_load_n(&ARCHIVE_HEADER(index)->count, __ATOMIC_ACQUIRE);
+    if (count > index->capacity && !index->writable && __archive_map(index) != 0)
+        return 0;
+
+    return FFMIN(count, index->capacity);
+}
+
+/**
+ * 第一个开始时间大于time_us的记录
+ */
+static int __archive_upper_bound(const archive_record_t *records, int count, int64_t time_us)
+{
+    int lo = 0, hi = count, mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (records[mid].start_us <= time_us)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int __archive_read_name(archive_index_t *index, const archive_record_t *record, char *filename)
+{
+    int done = 0;
+    ssize_t n = 0;
+
+    if (record->name_len >= ARCHIVE_MAX_FILENAME)
+        return -1;
+
+#ifdef _WIN32
+    if (lseek(index->names_fd, record->name_offset, SEEK_SET) < 0)
+        return -1;
+#endif
+
+    while (done < (int)record->name_len) {
+#ifdef _WIN32
+        n = read(index->names_fd, filename + done, record->name_len - done);
+#else
+        n = pread(index->names_fd, filename + done, record->name_len - done, (off_t)record->name_offset + done);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    filename[done] = '\0';
+
+    return 0;
+}
+
+static int __archive_write_name(archive_index_t *index, const char *filename, int size, int64_t offset)
+{
+    int done = 0;
+    ssize_t n = 0;
+
+#ifdef _WIN32
+    if (lseek(index->names_fd, offset, SEEK_SET) < 0)
+        return -1;
+#endif
+
+    while (done < size) {
+#ifdef _WIN32
+        n = write(index->names_fd, filename + done, size - done);
+#else
+        n = pwrite(index->names_fd, filename + done, size - done, offset + done);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+
+    return 0;
+}
+
+static int __archive_entry(archive_index_t *index, int i, int64_t offset_us, archive_entry_t *entry)
+{
+    const archive_record_t *record = &ARCHIVE_RECORDS(index)[i];
+
+    entry->start_us = record->start_us;
+    entry->end_us = record->end_us;
+    entry->size = record->size;
+    entry->offset_us = offset_us;
+
+    return __archive_read_name(index, record, entry->filename);
+}
+
+archive_index_t *archive_index_open(const char *path, int writable)
+{
+    archive_index_t *index = NULL;
+    archive_header_t *header = NULL;
+    char *names = NULL;
+    int flags = writable ? O_RDWR | O_CREAT | O_BINARY : O_RDONLY | O_BINARY;
+    struct stat st;
+
+    if (path == NULL)
+        return NULL;
+
+    index = av_mallocz(sizeof(archive_index_t));
+    if (index == NULL)
+        return NULL;
+
+    pthread_mutex_init(&index->mutex, NULL);
+    index->writable = !!writable;
+    index->names_fd = -1;
+
+    index->fd = open(path, flags, 0644);
+    if (index->fd < 0) {
+        fprintf(stderr, "archive_index: open '%s' failed: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    names = av_asprintf("%s%s", path, ARCHIVE_NAMES_SUFFIX);
+    if (names == NULL)
+        goto fail;
+    index->names_fd = open(names, flags, 0644);
+    if (index->names_fd < 0) {
+        fprintf(stderr, "archive_index: open '%s' failed: %s\n", names, strerror(errno));
+        goto fail;
+    }
+
+    if (fstat(index->fd, &st) != 0)
+        goto fail;
+
+    if (st.st_size < ARCHIVE_HEADER_SIZE) {
+        //新建索引
+        if (!index->writable || __archive_grow(index) != 0)
+            goto fail;
+        header = ARCHIVE_HEADER(index);
+        header->magic = ARCHIVE_MAGIC;
+        header->version = ARCHIVE_VERSION;
+        header->record_size = ARCHIVE_RECORD_SIZE;
+        header->names_size = 0;
+        __atomic_store_n(&header->count, 0, __ATOMIC_RELEASE);
+    } else if (__archive_map(index) != 0) {
+        goto fail;
+    }
+
+    header = ARCHIVE_HEADER(index);
+    if (header->magic != ARCHIVE_MAGIC || header->version != ARCHIVE_VERSION
+        || header->record_size != ARCHIVE_RECORD_SIZE) {
+        fprintf(stderr, "archive_index: '%s' is not an archive index\n", path);
+        goto fail;
+    }
+
+    //记录数超出文件大小说明文件被截断过
+    if (index->writable && header->count > (uint32_t)index->capacity)
+        __atomic_store_n(&header->count, index->capacity, __ATOMIC_RELEASE);
+
+    av_free(names);
+
+    return index;
+
+fail:
+    av_free(names);
+    archive_index_close(&index);
+
+    return NULL;
+}
+
+void archive_index_close(archive_index_t **index)
+{
+    archive_index_t *idx = NULL;
+
+    if (index == NULL || *index == NULL)
+        return;
+
+    idx = *index;
+
+    __archive_unmap(idx);
+    if (idx->fd >= 0)
+        close(idx->fd);
+    if (idx->names_fd >= 0)
+        close(idx->names_fd);
+    pthread_mutex_destroy(&idx->mutex);
+
+    av_freep(index);
+}
+
+int archive_index_add(archive_index_t *index, const char *filename, int64_t start_us, int64_t end_us, int64_t size)
+{
+    archive_header_t *header = NULL;
+    archive_record_t *records = NULL;
+    archive_record_t record;
+    int ret = 0, count = 0, pos = 0, len = 0;
+
+    if (index == NULL || filename == NULL || end_us < start_us)
+        return -1;
+
+    len = strlen(filename);
+    if (len == 0 || len >= ARCHIVE_MAX_FILENAME)
+        return -1;
+
+    if (!index->writable)
+        return -2;
+
+    pthread_mutex_lock(&index->mutex);
+
+    header = ARCHIVE_HEADER(index);
+    count = header->count;
+
+    if (header->names_size + len + 1 > UINT32_MAX) {
+        ret = -3;
+        goto fail;
+    }
+
+    if (count >= index->capacity && __archive_grow(index) != 0) {
+        fprintf(stderr, "archive_index: grow failed: %s\n", strerror(errno));
+        ret = -3;
+        goto fail;
+    }
+    //重新映射后地址可能改变
+    header = ARCHIVE_HEADER(index);
+    records = ARCHIVE_RECORDS(index);
+
+    //先写文件名,崩溃时最多在.names中留下没有记录引用的名字
+    if (__archive_write_name(index, filename, len + 1, header->names_size) != 0) {
+        fprintf(stderr, "archive_index: write name failed: %s\n", strerror(errno));
+        ret = -3;
+        goto fail;
+    }
+
+    record.start_us = start_us;
+    record.end_us = end_us;
+    record.size = size;
+    record.name_offset = (uint32_t)header->names_size;
+    record.name_len = len;
+
+    //正常情况下分段按时间顺序关闭,直接追加
+    pos = count;
+    if (count > 0 && records[count - 1].start_us > start_us) {
+        pos = __archive_upper_bound(records, count, start_us);
+        memmove(&records[pos + 1], &records[pos], (count - pos) * sizeof(archive_record_t));
+    }
+    records[pos] = record;
+
+    header->names_size += len + 1;
+    __atomic_store_n(&header->count, count + 1, __ATOMIC_RELEASE);
+
+fail:
+    pthread_mutex_unlock(&index->mutex);
+
+    return ret;
+}
+
+void archive_index_on_close(void *opaque, const muxer_segment_t *segment)
+{
+    int ret = archive_index_add(opaque, segment->filename, segment->start_us, segment->end_us, segment->size);
+
+    if (ret != 0)
+        fprintf(stderr, "archive_index: add '%s' failed %d\n", segment->filename, ret);
+}
+
+int archive_index_count(archive_index_t *index)
+{
+    int count = 0;
+
+    if (index == NULL)
+        return -1;
+
+    pthread_mutex_lock(&index->mutex);
+    count = __archive_count(index);
+    pthread_mutex_unlock(&index->mutex);
+
+    return count;
+}
+
+int archive_index_get(archive_index_t *index, int i, archive_entry_t *entry)
+{
+    int ret = -1;
+
+    if (index == NULL || entry == NULL || i < 0)
+        return -1;
+
+    pthread_mutex_lock(&index->mutex);
+
+    if (i < __archive_count(index))
+        ret = __archive_entry(index, i, 0, entry) == 0 ? 0 : -3;
+
+    pthread_mutex_unlock(&index->mutex);
+
+    return ret;
+}
+
+int archive_index_find(archive_index_t *index, int64_t time_us, archive_entry_t *entry)
+{
+    const archive_record_t *records = NULL;
+    int ret = -2, count = 0, pos = 0;
+
+    if (index == NULL || entry == NULL)
+        return -1;
+
+    pthread_mutex_lock(&index->mutex);
+
+    count = __archive_count(index);
+    records = ARCHIVE_RECORDS(index);
+    pos = __archive_upper_bound(records, count, time_us);
+
+    if (pos > 0 && time_us < records[pos - 1].end_us) {
+        ret = __archive_entry(index, pos - 1, time_us - records[pos - 1].start_us, entry) == 0 ? 0 : -3;
+    } else if (pos < count) {
+        //落在空隙中,从之后的第一个分段开始
+        ret = __archive_entry(index, pos, 0, entry) == 0 ? 1 : -3;
+    }
+
+    pthread_mutex_unlock(&index->mutex);
+
+    return ret;
+}
+
+demuxer_t *archive_index_open_demuxer(archive_index_t *index, int64_t time_us, archive_entry_t *entry)
+{
+    archive_entry_t local;
+    demuxer_t *demuxer = NULL;
+    int64_t first_us = 0;
+
+    if (entry == NULL)
+        entry = &local;
+
+    if (archive_index_find(index, time_us, entry) < 0)
+        return NULL;
+
+    demuxer = demuxer_create();
+    if (demuxer == NULL)
+        return NULL;
+
+    if (demuxer_open(demuxer, entry->filename) != 0) {
+        fprintf(stderr, "archive_index: open '%s' failed\n", entry->filename);
+        demuxer_destroy(&demuxer);
+        return NULL;
+    }
+
+    if (entry->offset_us > 0) {
+        //demuxer_seek的时间包含文件的起始时间
+        if (demuxer->fmt_ctx->start_time != AV_NOPTS_VALUE)
+            first_us = demuxer->fmt_ctx->start_time;
+        if (demuxer_seek(demuxer, (entry->offset_us + first_us) / 1000) != 0) {
+            fprintf(stderr, "archive_index: seek '%s' to %lld ms failed\n",
+                    entry->filename, (long long)(entry->offset_us / 1000));
+            demuxer_destroy(&demuxer);
+            return NULL;
+        }
+    }
+
+    return demuxer;
+}
+
+playlist_t *archive_index_playlist(archive_index_t *index, int64_t from_us, int64_t to_us)
+{
+    const archive_record_t *records = NULL;
+    playlist_t *playlist = NULL;
+    char filename[ARCHIVE_MAX_FILENAME];
+    int count = 0, i = 0, added = 0;
+
+    if (index == NULL || to_us <= from_us)
+        return NULL;
+
+    playlist = playlist_create();
+    if (playlist == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&index->mutex);
+
+    count = __archive_count(index);
+    records = ARCHIVE_RECORDS(index);
+
+    //包含from_us的分段也要加入
+    i = __archive_upper_bound(records, count, from_us);
+    if (i > 0 && from_us < records[i - 1].end_us)
+        i--;
+
+    for (; i < count && records[i].start_us < to_us; i++) {
+        if (__archive_read_name(index, &records[i], filename) != 0
+            || playlist_add(playlist, filename, (records[i].end_us - records[i].start_us) / 1000) != 0)
+            break;
+        added++;
+    }
+
+    pthread_mutex_unlock(&index->mutex);
+
+    if (added == 0)
+        playlist_destroy(&playlist);
+
+    return playlist;
+}
@@ -0,0 +1,134 @@
+#ifndef __ARCHIVE_INDEX_H
+#define __ARCHIVE_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "demux.h"
+#include "mux.h"
+#include "playlist.h"
+
+/**
+ * @brief 录像归档的时间索引,每个摄像头一个索引文件(比如"archive/cam17.idx")
+ *   索引文件: 64字节的头 + 每个分段32字节的记录(开始时间,结束时间,文件大小,文件名位置),按开始时间排序
+ *   文件名另外存放在索引文件名+".names"中,记录保持定长
+ *   索引文件整个mmap到内存,按时间查找是对记录的二分查找,不需要读文件,几千个文件也只要几微秒
+ *   muxer每关闭一个分段追加一条记录(muxer_set_close_hook + archive_index_on_close),
+ *   先写文件名和记录,最后更新头中的记录数,程序崩溃不会留下半条记录
+ *   同一个索引只能有一个进程写,其他进程可以只读打开同时查询
+ *   时间都是系统时间(微秒,1970年起,和av_gettime相同)
+ */
+typedef struct archive_index archive_index_t;
+
+#define ARCHIVE_NAMES_SUFFIX    ".names"
+#define ARCHIVE_MAX_FILENAME    1024
+
+/**
+ * @brief 查询结果
+ */
+typedef struct archive_entry {
+    int64_t start_us;       //分段开始时间
+    int64_t end_us;         //分段结束时间
+    int64_t size;           //文件大小(字节),未知时为0
+    int64_t offset_us;      //查询时间在分段中的位置,查询时间落在空隙中时为0
+    char filename[ARCHIVE_MAX_FILENAME];
+} archive_entry_t;
+
+/**
+ * @brief 打开索引,writable为1时不存在则创建
+ *
+ * @param path: 索引文件名
+ * @param writable: 1可写(录像进程) 0只读(查询进程)
+ * @return archive_index_t*: NULL失败
+ */
+archive_index_t *archive_index_open(const char *path, int writable);
+
+/**
+ * @brief 关闭索引
+ *
+ * @param index: archive_index_open返回值
+ */
+void archive_index_close(archive_index_t **index);
+
+/**
+ * @brief 添加一个分段,开始时间比最后一个分段早时插入到对应位置(只读打开的其他进程可能短暂看到不一致的记录)
+ *
+ * @param index: archive_index_open返回值
+ * @param filename: 分段文件名,原样保存,查询时原样返回
+ * @param start_us: 开始时间
+ * @param end_us: 结束时间
+ * @param size: 文件大小(字节),未知时为0
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -2:只读打开
+ *              -3:写文件失败
+ */
+int archive_index_add(archive_index_t *index, const char *filename, int64_t start_us, int64_t end_us, int64_t size);
+
+/**
+ * @brief muxer_close_hook_t,opaque为archive_index_t*,用于muxer_set_close_hook
+ */
+void archive_index_on_close(void *opaque, const muxer_segment_t *segment);
+
+/**
+ * @brief 获取分段个数
+ *
+ * @param index: archive_index_open返回值
+ * @return int: 分段个数, <0失败
+ */
+int archive_index_count(archive_index_t *index);
+
+/**
+ * @brief 按序号获取分段
+ *
+ * @param index: archive_index_open返回值
+ * @param i: 序号,按开始时间排序
+ * @param entry: 输出,offset_us为0
+ * @return int: 0成功 其他失败
+ */
+int archive_index_get(archive_index_t *index, int i, archive_entry_t *entry);
+
+/**
+ * @brief 查找包含time_us的分段
+ *
+ * @param index: archive_index_open返回值
+ * @param time_us: 查询时间
+ * @param entry: 输出
+ * @return int: 0找到 1没有录像覆盖time_us,输出之后的第一个分段 其他失败
+ *              -1:参数错误
+ *              -2:time_us及之后没有录像
+ *              -3:读文件名失败
+ */
+int archive_index_find(archive_index_t *index, int64_t time_us, archive_entry_t *entry);
+
+/**
+ * @brief 查找包含time_us的分段,打开并seek到time_us的位置
+ *   落在空隙中时打开之后的第一个分段,从头开始读
+ *
+ * @param index: archive_index_open返回值
+ * @param time_us: 查询时间
+ * @param entry: 输出打开的分段,可以为NULL
+ * @return demuxer_t*: NULL失败,使用完调用demuxer_destroy
+ */
+demuxer_t *archive_index_open_demuxer(archive_index_t *index, int64_t time_us, archive_entry_t *entry);
+
+/**
+ * @brief 把[from_us, to_us)之间的分段按顺序加入playlist,时长取自索引不需要打开探测
+ *   分段之间的空隙被跳过,playlist从第一个分段的开头开始,
+ *   需要从from_us开始读时playlist_open之后playlist_seek(playlist, (from_us - 第一个分段的start_us) / 1000)
+ *
+ * @param index: archive_index_open返回值
+ * @param from_us: 开始时间
+ * @param to_us: 结束时间
+ * @return playlist_t*: NULL失败或者没有分段,还没有playlist_open
+ */
+playlist_t *archive_index_playlist(archive_index_t *index, int64_t from_us, int64_t to_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__ARCHIVE_INDEX_H
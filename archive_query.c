@@ -0,0 +1,123 @@
+/*
+ * 查询录像归档索引,见archive_index.h
+ *
+ * archive_query [-o] 索引文件 [时间]
+ *
+ * 没有时间时列出所有分段,时间格式"2026-10-01 14:03:12"(本地时间,结尾加Z为UTC)
+ * -o 打开分段并seek到查询时间,统计打开的耗时
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "libavutil/parseutils.h"
+#include "libavutil/time.h"
+
+#include "archive_index.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-o] index [\"YYYY-MM-DD hh:mm:ss\"]\n", name);
+}
+
+static const char *__format_time(int64_t us, char *buf, int size)
+{
+    time_t secs = us / 1000000;
+    struct tm *tm = localtime(&secs);
+
+    if (tm == NULL || strftime(buf, size, "%Y-%m-%d %H:%M:%S", tm) == 0)
+        snprintf(buf, size, "%lld", (long long)us);
+
+    return buf;
+}
+
+static int __list(archive_index_t *index)
+{
+    archive_entry_t entry;
+    char start[32], end[32];
+    int count = archive_index_count(index), i = 0;
+
+    for (i = 0; i < count; i++) {
+        if (archive_index_get(index, i, &entry) != 0)
+            return -1;
+        printf("%s - %s %10lld %s\n", __format_time(entry.start_us, start, sizeof(start)),
+               __format_time(entry.end_us, end, sizeof(end)), (long long)entry.size, entry.filename);
+    }
+
+    fprintf(stderr, "%d segments\n", count);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    archive_index_t *index = NULL;
+    archive_entry_t entry;
+    demuxer_t *demuxer = NULL;
+    char start[32];
+    int64_t time_us = 0, begin = 0, elapsed = 0;
+    int open_demuxer = 0, opt = 0, ret = -1;
+
+    while ((opt = getopt(argc, argv, "oh")) != -1) {
+        switch (opt) {
+        case 'o':
+            open_demuxer = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    index = archive_index_open(argv[optind++], 0);
+    if (index == NULL)
+        return -1;
+
+    if (optind >= argc) {
+        ret = __list(index);
+        goto fail;
+    }
+
+    if (av_parse_time(&time_us, argv[optind], 0) < 0) {
+        fprintf(stderr, "invalid time '%s'\n", argv[optind]);
+        goto fail;
+    }
+
+    begin = av_gettime_relative();
+    ret = archive_index_find(index, time_us, &entry);
+    elapsed = av_gettime_relative() - begin;
+    if (ret < 0) {
+        fprintf(stderr, "no recording at or after %s: %d\n", argv[optind], ret);
+        goto fail;
+    }
+
+    printf("%s%s +%.3f s (segment starts %s)\n", ret == 1 ? "gap, next: " : "", entry.filename,
+           entry.offset_us / 1000000.0, __format_time(entry.start_us, start, sizeof(start)));
+    fprintf(stderr, "find: %lld us\n", (long long)elapsed);
+
+    if (open_demuxer) {
+        begin = av_gettime_relative();
+        demuxer = archive_index_open_demuxer(index, time_us, NULL);
+        elapsed = av_gettime_relative() - begin;
+        if (demuxer == NULL) {
+            ret = -1;
+            goto fail;
+        }
+        fprintf(stderr, "open and seek: %lld us\n", (long long)elapsed);
+        demuxer_destroy(&demuxer);
+    }
+
+    ret = 0;
+
+fail:
+    archive_index_close(&index);
+
+    return ret;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = archive_query
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += archive_query.c
+
+include(media.pri)
@@ -0,0 +1,616 @@
+/*
+ * 批量转封装: 把一个目录树下的所有音视频文件转封装到另一个目录
+ *
+ * batch_remux [-j 线程数] [-f mp4|ts] [-s 状态文件] [-T trace.json] 输入目录 输出目录
+ *
+ * 大文件先做,每个线程有自己的任务队列,空闲时从其他线程的队列末尾偷小任务,
+ * 完成的文件记录在状态文件中,中断后重新运行会跳过已经完成的文件
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "libavutil/time.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#define mkdir(path, mode)   _mkdir(path)
+#define fsync(fd)           _commit(fd)
+#define lstat(path, st)     stat(path, st)     //没有符号链接
+#endif
+
+#include "demux.h"
+#include "mux.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#define BATCH_MAX_WORKERS   64
+#define BATCH_STATE_NAME    ".batch_remux.state"
+
+typedef struct job {
+    char *path;             //输入文件
+    char *rel;              //相对输入目录的路径
+    int64_t size;
+    int64_t mtime;
+} job_t;
+
+typedef struct worker {
+    pthread_t thread;
+    int id;
+    pthread_mutex_t mutex;
+    job_t **jobs;           //自己的队列,从head取,被偷时从tail取
+    int head;
+    int tail;
+    job_t *current;
+    pipeline_t *pipeline;
+} worker_t;
+
+typedef struct batch {
+    const char *input;
+    const char *output;
+    dev_t output_dev;       //扫描时跳过输出目录(可能在输入目录里面)
+    ino_t output_ino;
+    int format;
+
+    job_t *jobs;
+    int nb_jobs;
+    int capacity;
+
+    char **finished;        //状态文件中已经完成的相对路径,排序后二分查找
+    int nb_finished;
+    FILE *state;
+    pthread_mutex_t state_mutex;
+
+    worker_t workers[BATCH_MAX_WORKERS];
+    int nb_workers;
+
+    atomic_int running;
+    atomic_int ok_files;
+    atomic_int failed_files;
+    atomic_llong done_bytes;
+    atomic_int quit;
+} batch_t;
+
+static batch_t s_batch;
+
+static const char *s_extensions[] = {
+    ".mp4", ".m4v", ".mov", ".mkv", ".flv", ".ts", ".avi", ".h264", ".h265", NULL
+};
+
+static void sighandler(int sig)
+{
+    (void)sig;
+    atomic_store(&s_batch.quit, 1);
+}
+
+static int __batch_is_media(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    int i = 0;
+
+    if (ext == NULL)
+        return 0;
+
+    for (i = 0; s_extensions[i] != NULL; i++) {
+        if (strcasecmp(ext, s_extensions[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int __batch_add_job(batch_t *batch, const char *path, const char *rel, const struct stat *st)
+{
+    job_t *jobs = NULL;
+
+    if (batch->nb_jobs == batch->capacity) {
+        jobs = realloc(batch->jobs, (batch->capacity * 2 + 64) * sizeof(job_t));
+        if (jobs == NULL)
+            return -1;
+        batch->jobs = jobs;
+        batch->capacity = batch->capacity * 2 + 64;
+    }
+
+    batch->jobs[batch->nb_jobs].path = strdup(path);
+    batch->jobs[batch->nb_jobs].rel = strdup(rel);
+    batch->jobs[batch->nb_jobs].size = st->st_size;
+    batch->jobs[batch->nb_jobs].mtime = st->st_mtime;
+    if (batch->jobs[batch->nb_jobs].path == NULL || batch->jobs[batch->nb_jobs].rel == NULL)
+        return -1;
+
+    batch->nb_jobs++;
+
+    return 0;
+}
+
+/**
+ * windows上st_ino总是0,只能比较路径
+ */
+static int __batch_is_output(const batch_t *batch, const char *path, const struct stat *st)
+{
+    if (batch->output_ino != 0)
+        return st->st_dev == batch->output_dev && st->st_ino == batch->output_ino;
+
+    return strcmp(path, batch->output) == 0;
+}
+
+static int __batch_scan(batch_t *batch, const char *dir, const char *rel)
+{
+    DIR *d = NULL;
+    struct dirent *ent = NULL;
+    struct stat st;
+    char path[4096], sub[4096];
+
+    d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "open dir '%s' failed: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        snprintf(sub, sizeof(sub), "%s%s%s", rel, *rel ? "/" : "", ent->d_name);
+
+        //不跟随符号链接,目录链接成环时会无限递归
+        if (lstat(path, &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!__batch_is_output(batch, path, &st))
+                __batch_scan(batch, path, sub);
+        } else if (S_ISREG(st.st_mode) && st.st_size > 0 && __batch_is_media(ent->d_name)) {
+            __batch_add_job(batch, path, sub, &st);
+        }
+    }
+
+    closedir(d);
+
+    return 0;
+}
+
+static int __batch_cmp_size(const void *a, const void *b)
+{
+    const job_t *ja = (const job_t *)a, *jb = (const job_t *)b;
+
+    return ja->size < jb->size ? 1 : (ja->size > jb->size ? -1 : 0);
+}
+
+static int __batch_cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * 状态文件每行: 大小 修改时间 相对路径
+ * 大小或修改时间变化的文件重新做
+ */
+static char *__batch_state_key(const job_t *job)
+{
+    char *key = NULL;
+    size_t len = strlen(job->rel) + 48;
+
+    key = malloc(len);
+    if (key != NULL)
+        snprintf(key, len, "%lld %lld %s", (long long)job->size, (long long)job->mtime, job->rel);
+
+    return key;
+}
+
+static int __batch_load_state(batch_t *batch, const char *filename)
+{
+    FILE *fp = NULL;
+    char line[4200];
+    char **finished = NULL;
+    int capacity = 0;
+    size_t len = 0;
+
+    fp = fopen(filename, "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            len = strlen(line);
+            //没有换行的最后一行可能是崩溃时写了一半
+            if (len == 0 || line[len - 1] != '\n')
+                break;
+            line[len - 1] = '\0';
+
+            if (batch->nb_finished == capacity) {
+                finished = realloc(batch->finished, (capacity * 2 + 64) * sizeof(char *));
+                if (finished == NULL)
+                    break;
+                batch->finished = finished;
+                capacity = capacity * 2 + 64;
+            }
+            batch->finished[batch->nb_finished] = strdup(line);
+            if (batch->finished[batch->nb_finished] != NULL)
+                batch->nb_finished++;
+        }
+        fclose(fp);
+
+        qsort(batch->finished, batch->nb_finished, sizeof(char *), __batch_cmp_str);
+    }
+
+    batch->state = fopen(filename, "a");
+    if (batch->state == NULL) {
+        fprintf(stderr, "open state '%s' failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int __batch_is_finished(batch_t *batch, const job_t *job)
+{
+    char *key = __batch_state_key(job);
+    int found = 0;
+
+    if (key != NULL && batch->nb_finished > 0)
+        found = bsearch(&key, batch->finished, batch->nb_finished, sizeof(char *), __batch_cmp_str) != NULL;
+
+    free(key);
+
+    return found;
+}
+
+static void __batch_mark_finished(batch_t *batch, const job_t *job)
+{
+    char *key = __batch_state_key(job);
+
+    if (key == NULL)
+        return;
+
+    pthread_mutex_lock(&batch->state_mutex);
+    fprintf(batch->state, "%s\n", key);
+    fflush(batch->state);
+    fsync(fileno(batch->state));
+    pthread_mutex_unlock(&batch->state_mutex);
+
+    free(key);
+}
+
+static int __batch_mkdirs(const char *path)
+{
+    char tmp[4096];
+    char *p = NULL;
+
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (p = tmp + 1; *p != '\0'; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+
+    return 0;
+}
+
+static int __batch_remux(batch_t *batch, worker_t *worker, job_t *job)
+{
+    demuxer_t *demuxer = NULL;
+    muxer_t *muxer = NULL;
+    pipeline_t *pipeline = NULL;
+    pipeline_stats_t stats;
+    char output[4096], part[4200];
+    char *ext = NULL;
+    int ret = -1, err = 0;
+
+    snprintf(output, sizeof(output), "%s/%s", batch->output, job->rel);
+    ext = strrchr(output, '.');
+    if (ext != NULL && strchr(ext, '/') == NULL)
+        *ext = '\0';
+    strncat(output, batch->format == MUXER_FORMAT_MPEGTS ? ".ts" : ".mp4", sizeof(output) - strlen(output) - 1);
+
+    //先写临时文件,完成后改名,中断时不会留下看起来完整的文件
+    snprintf(part, sizeof(part), "%s.part", output);
+
+    if (__batch_mkdirs(output) != 0) {
+        fprintf(stderr, "create dir for '%s' failed\n", output);
+        return -1;
+    }
+
+    demuxer = demuxer_create();
+    muxer = muxer_create();
+    if (demuxer == NULL || muxer == NULL)
+        goto fail;
+
+    if (demuxer_open(demuxer, job->path) != 0)
+        goto fail;
+
+    muxer_set_format(muxer, batch->format);
+    if (muxer_open(muxer, part) != 0)
+        goto close_demuxer;
+
+    pipeline = pipeline_create(demuxer, muxer, 0);
+    if (pipeline == NULL)
+        goto close_muxer;
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->pipeline = pipeline;
+    pthread_mutex_unlock(&worker->mutex);
+
+    if (atomic_load(&batch->quit))
+        pipeline_stop(pipeline);
+
+    ret = pipeline_run(pipeline, &stats);
+    if (ret == 0 && stats.errors != 0)
+        ret = -5;
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->pipeline = NULL;
+    pthread_mutex_unlock(&worker->mutex);
+
+    pipeline_destroy(&pipeline);
+
+    //被中断的文件不算完成
+    if (ret == 0 && atomic_load(&batch->quit))
+        ret = -6;
+
+close_muxer:
+    //文件尾,最后的写包,异步写入和刷盘的错误只有muxer_close才返回,成功了才能改名和记录完成
+    err = muxer_close(muxer);
+    if (err != 0) {
+        fprintf(stderr, "close '%s' failed: %d\n", part, err);
+        if (ret == 0)
+            ret = -7;
+    }
+close_demuxer:
+    demuxer_close(demuxer);
+fail:
+    muxer_destroy(&muxer);
+    demuxer_destroy(&demuxer);
+
+    if (ret == 0 && rename(part, output) != 0)
+        ret = -8;
+    if (ret != 0)
+        unlink(part);
+
+    return ret;
+}
+
+static job_t *__batch_next_job(batch_t *batch, worker_t *worker)
+{
+    worker_t *victim = NULL;
+    job_t *job = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->head < worker->tail)
+        job = worker->jobs[worker->head++];
+    pthread_mutex_unlock(&worker->mutex);
+
+    //自己的队列空了,从其他线程的队列末尾(最小的任务)偷
+    for (i = 1; job == NULL && i < batch->nb_workers; i++) {
+        victim = &batch->workers[(worker->id + i) % batch->nb_workers];
+        pthread_mutex_lock(&victim->mutex);
+        if (victim->head < victim->tail)
+            job = victim->jobs[--victim->tail];
+        pthread_mutex_unlock(&victim->mutex);
+    }
+
+    return job;
+}
+
+static void *__batch_worker(void *arg)
+{
+    worker_t *worker = (worker_t *)arg;
+    batch_t *batch = &s_batch;
+    job_t *job = NULL;
+    int64_t start = 0;
+    char name[32];
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "worker %d", worker->id);
+    trace_set_thread_name(name);
+
+    while (!atomic_load(&batch->quit) && (job = __batch_next_job(batch, worker)) != NULL) {
+        pthread_mutex_lock(&worker->mutex);
+        worker->current = job;
+        pthread_mutex_unlock(&worker->mutex);
+
+        start = av_gettime_relative();
+        ret = __batch_remux(batch, worker, job);
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->current = NULL;
+        pthread_mutex_unlock(&worker->mutex);
+
+        if (ret == 0) {
+            __batch_mark_finished(batch, job);
+            atomic_fetch_add(&batch->ok_files, 1);
+            atomic_fetch_add(&batch->done_bytes, job->size);
+            fprintf(stderr, "[%d] done %s (%.1f MB, %.1f MB/s)\n", worker->id, job->rel,
+                    job->size / 1048576.0, job->size / 1.048576 / (av_gettime_relative() - start + 1));
+        } else if (ret != -6) {
+            atomic_fetch_add(&batch->failed_files, 1);
+            fprintf(stderr, "[%d] failed %s: %d\n", worker->id, job->rel, ret);
+        }
+
+    }
+
+    atomic_fetch_sub(&batch->running, 1);
+
+    return NULL;
+}
+
+static void __batch_progress(batch_t *batch)
+{
+    worker_t *worker = NULL;
+    int64_t bytes = 0;
+    int i = 0;
+
+    for (i = 0; i < batch->nb_workers; i++) {
+        worker = &batch->workers[i];
+        pthread_mutex_lock(&worker->mutex);
+        //信号处理函数里不能加锁,在这里停止正在做的任务
+        if (atomic_load(&batch->quit))
+            pipeline_stop(worker->pipeline);
+        else if (worker->current != NULL && worker->pipeline != NULL) {
+            bytes = pipeline_get_read_bytes(worker->pipeline);
+            fprintf(stderr, "[%d] %5.1f%% %s\n", worker->id,
+                    worker->current->size > 0 ? bytes * 100.0 / worker->current->size : 0.0,
+                    worker->current->rel);
+        }
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-j threads] [-f mp4|ts] [-s state_file] [-T trace.json] input_dir output_dir\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    batch_t *batch = &s_batch;
+    const char *state_name = NULL, *trace_file = NULL;
+    char state_path[4096];
+    struct stat st;
+    int64_t start = 0, elapsed = 0;
+    int nb_workers = 0, opt = 0, i = 0, n = 0, per_worker = 0;
+
+    memset(batch, 0, sizeof(*batch));
+    pthread_mutex_init(&batch->state_mutex, NULL);
+    batch->format = MUXER_FORMAT_MP4;
+
+    nb_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "j:f:s:T:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            nb_workers = atoi(optarg);
+            break;
+        case 'f':
+            batch->format = strcmp(optarg, "ts") == 0 ? MUXER_FORMAT_MPEGTS : MUXER_FORMAT_MP4;
+            break;
+        case 's':
+            state_name = optarg;
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    batch->input = argv[optind];
+    batch->output = argv[optind + 1];
+
+    if (nb_workers <= 0)
+        nb_workers = 1;
+    if (nb_workers > BATCH_MAX_WORKERS)
+        nb_workers = BATCH_MAX_WORKERS;
+
+    if (state_name == NULL) {
+        snprintf(state_path, sizeof(state_path), "%s/%s", batch->output, BATCH_STATE_NAME);
+        state_name = state_path;
+    }
+
+    mkdir(batch->output, 0755);
+    if (stat(batch->output, &st) == 0) {
+        batch->output_dev = st.st_dev;
+        batch->output_ino = st.st_ino;
+    }
+    if (__batch_load_state(batch, state_name) != 0)
+        return -1;
+
+    __batch_scan(batch, batch->input, "");
+
+    //大文件先做,最后剩下的都是小文件,线程之间更均衡
+    qsort(batch->jobs, batch->nb_jobs, sizeof(job_t), __batch_cmp_size);
+
+    batch->nb_workers = nb_workers;
+    per_worker = batch->nb_jobs / nb_workers + 1;
+
+    for (i = 0; i < nb_workers; i++) {
+        batch->workers[i].id = i;
+        pthread_mutex_init(&batch->workers[i].mutex, NULL);
+        batch->workers[i].jobs = calloc(per_worker, sizeof(job_t *));
+        if (batch->workers[i].jobs == NULL)
+            return -1;
+    }
+
+    //按大小轮流分给每个线程,每个队列也是从大到小
+    for (i = 0; i < batch->nb_jobs; i++) {
+        if (__batch_is_finished(batch, &batch->jobs[i]))
+            continue;
+        batch->workers[n % nb_workers].jobs[batch->workers[n % nb_workers].tail++] = &batch->jobs[i];
+        n++;
+    }
+
+    fprintf(stderr, "%d files, %d already done, %d threads\n", batch->nb_jobs, batch->nb_jobs - n, nb_workers);
+
+    atomic_store(&batch->running, nb_workers);
+
+    signal(SIGINT, sighandler);
+
+    if (trace_file != NULL)
+        trace_start(0);
+
+    start = av_gettime_relative();
+
+    for (i = 0; i < nb_workers; i++)
+        pthread_create(&batch->workers[i].thread, NULL, __batch_worker, &batch->workers[i]);
+
+    while (atomic_load(&batch->running) > 0) {
+        sleep(1);
+        __batch_progress(batch);
+    }
+
+    for (i = 0; i < nb_workers; i++)
+        pthread_join(batch->workers[i].thread, NULL);
+
+    elapsed = av_gettime_relative() - start;
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    if (trace_file != NULL) {
+        trace_stop();
+        if (trace_dump(trace_file) < 0)
+            fprintf(stderr, "write %s failed\n", trace_file);
+    }
+
+    fprintf(stderr, "%d ok, %d failed, %.1f MB in %.1f s: %.2f MB/s, %.2f files/s\n",
+            atomic_load(&batch->ok_files), atomic_load(&batch->failed_files),
+            atomic_load(&batch->done_bytes) / 1048576.0, elapsed / 1000000.0,
+            atomic_load(&batch->done_bytes) / 1.048576 / elapsed,
+            atomic_load(&batch->ok_files) * 1000000.0 / elapsed);
+
+    fclose(batch->state);
+
+    for (i = 0; i < nb_workers; i++)
+        free(batch->workers[i].jobs);
+    for (i = 0; i < batch->nb_jobs; i++) {
+        free(batch->jobs[i].path);
+        free(batch->jobs[i].rel);
+    }
+    free(batch->jobs);
+    for (i = 0; i < batch->nb_finished; i++)
+        free(batch->finished[i]);
+    free(batch->finished);
+
+    return atomic_load(&batch->failed_files) > 0 ? 1 : 0;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = batch_remux
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += batch_remux.c
+
+include(media.pri)
@@ -0,0 +1,567 @@
+/*
+ * 性能测试: demuxer_open延迟, demuxer_read吞吐, demuxer_seek延迟分布,
+ * muxer_write_video/audio吞吐, 端到端转封装速度, nal关键帧判断
+ *
+ * bench [-n 次数] [-s seek次数] [-o 结果.json] [-t 临时目录] 输入文件
+ *
+ * 结果以JSON输出到标准输出或者-o指定的文件,过程信息输出到stderr
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "libavutil/time.h"
+#include "libavutil/mem.h"
+
+#include "demux.h"
+#include "mux.h"
+#include "nal.h"
+#include "pipeline.h"
+#include "alloc_trace.h"
+
+#define BENCH_VERSION           1
+#define BENCH_MAX_PACKETS       (64 * 1024)
+#define BENCH_NAL_FRAME_SIZE    (512 * 1024)    //4K关键帧的大小
+#define BENCH_NAL_ITERATIONS    200000
+
+typedef struct bench_packet {
+    uint8_t *data;
+    int size;
+    int is_video;
+    int keyframe;
+    int64_t pts_ms;
+    int64_t dts_ms;
+} bench_packet_t;
+
+typedef struct bench_media {
+    int video_codec;
+    int width;
+    int height;
+    uint8_t *extradata;
+    int extradata_size;
+    bench_packet_t *packets;
+    int nb_packets;
+    int64_t video_bytes;
+    int64_t audio_bytes;
+    int nb_video;
+    int nb_audio;
+} bench_media_t;
+
+/**
+ * 每个测试期间demuxer/muxer的内存分配,只有CONFIG+=alloc_trace编译时才有
+ */
+typedef struct bench_alloc {
+    const char *name;
+    int scope;
+    int64_t ops;
+    alloc_stats_t before;
+    alloc_stats_t after;
+} bench_alloc_t;
+
+enum BENCH_ALLOC {
+    BENCH_ALLOC_OPEN    = 0,
+    BENCH_ALLOC_READ,
+    BENCH_ALLOC_SEEK,
+    BENCH_ALLOC_MUX,
+    BENCH_ALLOC_MAX,
+};
+
+static void __bench_alloc_begin(bench_alloc_t *a, const char *name, int scope)
+{
+    a->name = name;
+    a->scope = scope;
+    alloc_trace_reset_peak(scope);
+    alloc_trace_get(scope, &a->before);
+}
+
+static void __bench_alloc_end(bench_alloc_t *a, int64_t ops)
+{
+    alloc_trace_get(a->scope, &a->after);
+    a->ops = ops;
+}
+
+static int __bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double __bench_percentile(const double *sorted, int n, double p)
+{
+    int i = (int)(p * (n - 1) + 0.5);
+
+    return n > 0 ? sorted[i] : 0.0;
+}
+
+static void __bench_json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/**
+ * 延迟分布: 毫秒
+ */
+static void __bench_json_latency(FILE *fp, const char *name, double *samples, int n, int last)
+{
+    double sum = 0.0;
+    int i = 0;
+
+    qsort(samples, n, sizeof(double), __bench_cmp_double);
+    for (i = 0; i < n; i++)
+        sum += samples[i];
+
+    fprintf(fp, "    \"%s\": {\"iterations\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, "
+                "\"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+            name, n, n > 0 ? sum / n : 0.0, n > 0 ? samples[0] : 0.0,
+            __bench_percentile(samples, n, 0.5), __bench_percentile(samples, n, 0.9),
+            __bench_percentile(samples, n, 0.99), n > 0 ? samples[n - 1] : 0.0,
+            last ? "" : ",");
+}
+
+static void __bench_json_throughput(FILE *fp, const char *name, int64_t items, int64_t bytes, int64_t us, int last)
+{
+    if (us <= 0)
+        us = 1;
+
+    fprintf(fp, "    \"%s\": {\"items\": %lld, \"bytes\": %lld, \"seconds\": %.6f, "
+                "\"items_per_s\": %.1f, \"mb_per_s\": %.2f}%s\n",
+            name, (long long)items, (long long)bytes, us / 1000000.0,
+            items * 1000000.0 / us, bytes / 1.048576 / us, last ? "" : ",");
+}
+
+static void __bench_json_alloc(FILE *fp, const bench_alloc_t *a, int first)
+{
+    int64_t ops = a->ops > 0 ? a->ops : 1;
+
+    fprintf(fp, "%s    \"%s\": {\"ops\": %lld, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, "
+                "\"peak_bytes\": %lld}",
+            first ? "" : ",\n", a->name, (long long)a->ops, (double)(a->after.allocs - a->before.allocs) / ops,
+            (double)(a->after.bytes - a->before.bytes) / ops, (long long)(a->after.peak - a->before.live));
+}
+
+static int __bench_open(const char *input, double *samples, int n)
+{
+    demuxer_t *demuxer = NULL;
+    int64_t start = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++) {
+        demuxer = demuxer_create();
+        if (demuxer == NULL)
+            return -1;
+
+        start = av_gettime_relative();
+        if (demuxer_open(demuxer, input) != 0) {
+            demuxer_destroy(&demuxer);
+            return -1;
+        }
+        samples[i] = (av_gettime_relative() - start) / 1000.0;
+
+        demuxer_close(demuxer);
+        demuxer_destroy(&demuxer);
+    }
+
+    return 0;
+}
+
+/**
+ * 读完整个文件,同时把音视频数据保存下来给muxer测试用
+ */
+static int __bench_read(const char *input, bench_media_t *media, int64_t *packets, int64_t *bytes, int64_t *us)
+{
+    demuxer_t *demuxer = NULL;
+    const AVCodecParameters *par = NULL;
+    bench_packet_t *p = NULL;
+    AVRational tb[2] = {{1, 1000}, {1, 1000}};
+    AVPacket pkt;
+    int64_t start = 0;
+    int video = -1, audio = -1, i = 0, n = 0;
+
+    demuxer = demuxer_create();
+    if (demuxer == NULL || demuxer_open(demuxer, input) != 0) {
+        demuxer_destroy(&demuxer);
+        return -1;
+    }
+
+    n = demuxer_get_nb_streams(demuxer);
+    for (i = 0; i < n; i++) {
+        par = demuxer_get_codecpar(demuxer, i, NULL);
+        if (par == NULL)
+            continue;
+        if (video < 0 && par->codec_type == AVMEDIA_TYPE_VIDEO &&
+            (par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC)) {
+            video = i;
+            par = demuxer_get_codecpar(demuxer, i, &tb[0]);
+            media->video_codec = par->codec_id == AV_CODEC_ID_HEVC ? MUXER_CODEC_H265 : MUXER_CODEC_H264;
+            media->width = par->width;
+            media->height = par->height;
+            media->extradata = av_memdup(par->extradata, par->extradata_size);
+            media->extradata_size = media->extradata != NULL ? par->extradata_size : 0;
+        } else if (audio < 0 && par->codec_type == AVMEDIA_TYPE_AUDIO && par->codec_id == AV_CODEC_ID_AAC) {
+            audio = i;
+            demuxer_get_codecpar(demuxer, i, &tb[1]);
+        }
+    }
+
+    media->packets = av_mallocz_array(BENCH_MAX_PACKETS, sizeof(bench_packet_t));
+    if (media->packets == NULL) {
+        demuxer_close(demuxer);
+        demuxer_destroy(&demuxer);
+        return -1;
+    }
+
+    av_init_packet(&pkt);
+
+    start = av_gettime_relative();
+    while (demuxer_read_packet(demuxer, &pkt) == 0) {
+        (*packets)++;
+        *bytes += pkt.size;
+
+        //保存的数据不计入读取时间
+        if (media->nb_packets < BENCH_MAX_PACKETS && (pkt.stream_index == video || pkt.stream_index == audio)) {
+            int64_t t = av_gettime_relative();
+            i = pkt.stream_index == video ? 0 : 1;
+            p = &media->packets[media->nb_packets];
+            p->data = av_memdup(pkt.data, pkt.size);
+            if (p->data != NULL) {
+                p->size = pkt.size;
+                p->is_video = i == 0;
+                p->keyframe = !!(pkt.flags & AV_PKT_FLAG_KEY);
+                p->pts_ms = pkt.pts != AV_NOPTS_VALUE ? av_rescale_q(pkt.pts, tb[i], (AVRational){1, 1000}) : -1;
+                p->dts_ms = pkt.dts != AV_NOPTS_VALUE ? av_rescale_q(pkt.dts, tb[i], (AVRational){1, 1000}) : -1;
+                if (p->is_video) {
+                    media->nb_video++;
+                    media->video_bytes += p->size;
+                } else {
+                    media->nb_audio++;
+                    media->audio_bytes += p->size;
+                }
+                media->nb_packets++;
+            }
+            start += av_gettime_relative() - t;
+        }
+
+        av_packet_unref(&pkt);
+    }
+    *us = av_gettime_relative() - start;
+
+    demuxer_close(demuxer);
+    demuxer_destroy(&demuxer);
+
+    return 0;
+}
+
+static int __bench_seek(const char *input, double *samples, int n)
+{
+    demuxer_t *demuxer = NULL;
+    AVPacket pkt;
+    int64_t duration = 0, start = 0;
+    uint32_t seed = 12345;
+    int i = 0;
+
+    duration = demuxer_get_duration(input);
+    if (duration <= 0)
+        return -1;
+
+    demuxer = demuxer_create();
+    if (demuxer == NULL || demuxer_open(demuxer, input) != 0) {
+        demuxer_destroy(&demuxer);
+        return -1;
+    }
+
+    av_init_packet(&pkt);
+
+    //固定种子,每次运行seek的位置相同
+    for (i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+
+        start = av_gettime_relative();
+        demuxer_seek(demuxer, (int64_t)(seed >> 8) % duration);
+        //seek之后读到第一个关键帧才算完成
+        if (demuxer_read_packet(demuxer, &pkt) == 0)
+            av_packet_unref(&pkt);
+        samples[i] = (av_gettime_relative() - start) / 1000.0;
+    }
+
+    demuxer_close(demuxer);
+    demuxer_destroy(&demuxer);
+
+    return 0;
+}
+
+static int __bench_mux(const char *output, const bench_media_t *media, int64_t *video_us, int64_t *audio_us, int64_t *total_us)
+{
+    muxer_t *muxer = NULL;
+    const bench_packet_t *p = NULL;
+    int64_t start = 0, t = 0;
+    int i = 0, ret = 0;
+
+    muxer = muxer_create();
+    if (muxer == NULL)
+        return -1;
+
+    if (muxer_open(muxer, output) != 0 ||
+        muxer_add_video_and_audio(muxer, media->video_codec, media->width, media->height,
+                                  media->extradata, media->extradata_size) != 0) {
+        muxer_destroy(&muxer);
+        return -1;
+    }
+
+    start = av_gettime_relative();
+    for (i = 0; i < media->nb_packets && ret >= 0; i++) {
+        p = &media->packets[i];
+        t = av_gettime_relative();
+        if (p->is_video) {
+            ret = muxer_write_video_ts(muxer, (const char *)p->data, p->size, p->keyframe, p->pts_ms, p->dts_ms);
+            *video_us += av_gettime_relative() - t;
+        } else {
+            ret = muxer_write_audio(muxer, (const char *)p->data, p->size, p->pts_ms);
+            *audio_us += av_gettime_relative() - t;
+        }
+    }
+    muxer_close(muxer);
+    *total_us = av_gettime_relative() - start;
+
+    muxer_destroy(&muxer);
+    unlink(output);
+
+    return ret < 0 ? -1 : 0;
+}
+
+static int __bench_remux(const char *input, const char *output, pipeline_stats_t *stats)
+{
+    demuxer_t *demuxer = NULL;
+    muxer_t *muxer = NULL;
+    pipeline_t *pipeline = NULL;
+    int ret = -1;
+
+    demuxer = demuxer_create();
+    muxer = muxer_create();
+
+    if (demuxer != NULL && muxer != NULL &&
+        demuxer_open(demuxer, input) == 0) {
+        if (muxer_open(muxer, output) == 0) {
+            pipeline = pipeline_create(demuxer, muxer, 0);
+            if (pipeline != NULL)
+                ret = pipeline_run(pipeline, stats);
+            pipeline_destroy(&pipeline);
+            muxer_close(muxer);
+        }
+        demuxer_close(demuxer);
+    }
+
+    muxer_destroy(&muxer);
+    demuxer_destroy(&demuxer);
+    unlink(output);
+
+    return ret;
+}
+
+/**
+ * 4K关键帧: AUD + SEI + IDR, 关键帧判断只看前面几个nal头
+ * 同时测试整帧扫描起始码的速度
+ */
+static void __bench_nal(int64_t *classify_us, int64_t *scan_us, int64_t *scan_bytes)
+{
+    static const uint8_t head[] = {
+        0, 0, 0, 1, 0x09, 0xf0,
+        0, 0, 0, 1, 0x06, 0x05, 0x10,
+        0, 0, 0, 1, 0x65, 0x88, 0x84,
+    };
+    uint8_t *frame = NULL;
+    const uint8_t *p = NULL, *end = NULL;
+    uint32_t seed = 1;
+    int64_t start = 0;
+    int i = 0, keys = 0, nals = 0;
+
+    frame = av_malloc(BENCH_NAL_FRAME_SIZE);
+    if (frame == NULL)
+        return;
+
+    //随机数据里去掉起始码,和真实的slice数据一样
+    for (i = 0; i < BENCH_NAL_FRAME_SIZE; i++) {
+        seed = seed * 1103515245u + 12345u;
+        frame[i] = (seed >> 16) & 0xff;
+        if (i >= 2 && frame[i - 2] == 0 && frame[i - 1] == 0 && frame[i] <= 3)
+            frame[i] = 0x55;
+    }
+    memcpy(frame, head, sizeof(head));
+
+    start = av_gettime_relative();
+    for (i = 0; i < BENCH_NAL_ITERATIONS; i++)
+        keys += nal_is_keyframe(AV_CODEC_ID_H264, frame, BENCH_NAL_FRAME_SIZE) == 1;
+    *classify_us = av_gettime_relative() - start;
+
+    start = av_gettime_relative();
+    for (i = 0; i < 200; i++) {
+        end = frame + BENCH_NAL_FRAME_SIZE;
+        for (p = frame; (p = nal_find_startcode(p, end)) < end; p += 3)
+            nals++;
+    }
+    *scan_us = av_gettime_relative() - start;
+    *scan_bytes = 200LL * BENCH_NAL_FRAME_SIZE;
+
+    if (keys != BENCH_NAL_ITERATIONS || nals != 200 * 3)
+        fprintf(stderr, "nal benchmark sanity check failed: %d keys %d nals\n", keys, nals);
+
+    av_free(frame);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n open_iterations] [-s seeks] [-o result.json] [-t tmp_dir] input\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    bench_media_t media;
+    pipeline_stats_t remux;
+    bench_alloc_t allocs[BENCH_ALLOC_MAX];
+    struct stat st;
+    const char *input = NULL, *json = NULL, *tmp_dir = ".";
+    char output[4096];
+    double *open_samples = NULL, *seek_samples = NULL;
+    int64_t read_packets = 0, read_bytes = 0, read_us = 0;
+    int64_t video_us = 0, audio_us = 0, mux_us = 0;
+    int64_t classify_us = 0, scan_us = 0, scan_bytes = 0;
+    int nb_open = 20, nb_seek = 200, opt = 0, i = 0;
+    int ok_open = 0, ok_seek = 0, ok_mux = 0, ok_remux = 0, first = 1;
+    FILE *fp = stdout;
+
+    while ((opt = getopt(argc, argv, "n:s:o:t:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nb_open = atoi(optarg);
+            break;
+        case 's':
+            nb_seek = atoi(optarg);
+            break;
+        case 'o':
+            json = optarg;
+            break;
+        case 't':
+            tmp_dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc - optind != 1 || nb_open <= 0 || nb_seek <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    input = argv[optind];
+    if (stat(input, &st) != 0) {
+        fprintf(stderr, "'%s' not found\n", input);
+        return -1;
+    }
+
+    memset(&media, 0, sizeof(media));
+    memset(&remux, 0, sizeof(remux));
+    memset(allocs, 0, sizeof(allocs));
+    snprintf(output, sizeof(output), "%s/bench_%d.mp4", tmp_dir, (int)getpid());
+
+    open_samples = calloc(nb_open, sizeof(double));
+    seek_samples = calloc(nb_seek, sizeof(double));
+    if (open_samples == NULL || seek_samples == NULL)
+        return -1;
+
+    fprintf(stderr, "demuxer_open x%d\n", nb_open);
+    __bench_alloc_begin(&allocs[BENCH_ALLOC_OPEN], "demuxer_open", ALLOC_SCOPE_DEMUXER);
+    ok_open = __bench_open(input, open_samples, nb_open) == 0;
+    __bench_alloc_end(&allocs[BENCH_ALLOC_OPEN], nb_open);
+
+    fprintf(stderr, "demuxer_read\n");
+    __bench_alloc_begin(&allocs[BENCH_ALLOC_READ], "demuxer_read", ALLOC_SCOPE_DEMUXER);
+    __bench_read(input, &media, &read_packets, &read_bytes, &read_us);
+    __bench_alloc_end(&allocs[BENCH_ALLOC_READ], read_packets);
+
+    fprintf(stderr, "demuxer_seek x%d\n", nb_seek);
+    __bench_alloc_begin(&allocs[BENCH_ALLOC_SEEK], "demuxer_seek", ALLOC_SCOPE_DEMUXER);
+    ok_seek = __bench_seek(input, seek_samples, nb_seek) == 0;
+    __bench_alloc_end(&allocs[BENCH_ALLOC_SEEK], nb_seek);
+
+    if (media.nb_video > 0) {
+        fprintf(stderr, "muxer_write_video/audio\n");
+        __bench_alloc_begin(&allocs[BENCH_ALLOC_MUX], "muxer_write", ALLOC_SCOPE_MUXER);
+        ok_mux = __bench_mux(output, &media, &video_us, &audio_us, &mux_us) == 0;
+        __bench_alloc_end(&allocs[BENCH_ALLOC_MUX], media.nb_packets);
+    }
+
+    fprintf(stderr, "remux\n");
+    ok_remux = __bench_remux(input, output, &remux) == 0;
+
+    fprintf(stderr, "nal\n");
+    __bench_nal(&classify_us, &scan_us, &scan_bytes);
+
+    if (json != NULL) {
+        fp = fopen(json, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "open '%s' failed\n", json);
+            return -1;
+        }
+    }
+
+    fprintf(fp, "{\n  \"version\": %d,\n  \"input\": ", BENCH_VERSION);
+    __bench_json_string(fp, input);
+    fprintf(fp, ",\n  \"file_size\": %lld,\n  \"results\": {\n", (long long)st.st_size);
+
+    if (ok_open)
+        __bench_json_latency(fp, "demuxer_open", open_samples, nb_open, 0);
+    __bench_json_throughput(fp, "demuxer_read", read_packets, read_bytes, read_us, 0);
+    if (ok_seek)
+        __bench_json_latency(fp, "demuxer_seek", seek_samples, nb_seek, 0);
+    if (ok_mux) {
+        __bench_json_throughput(fp, "muxer_write_video", media.nb_video, media.video_bytes, video_us, 0);
+        __bench_json_throughput(fp, "muxer_write_audio", media.nb_audio, media.audio_bytes, audio_us, 0);
+        __bench_json_throughput(fp, "muxer_total", media.nb_packets, media.video_bytes + media.audio_bytes, mux_us, 0);
+    }
+    if (ok_remux)
+        __bench_json_throughput(fp, "remux", remux.write.packets, remux.write.bytes, remux.elapsed_us, 0);
+    __bench_json_throughput(fp, "nal_is_keyframe_4k", BENCH_NAL_ITERATIONS, 0, classify_us, 0);
+    __bench_json_throughput(fp, "nal_find_startcode", scan_bytes / BENCH_NAL_FRAME_SIZE, scan_bytes, scan_us, 1);
+
+    fprintf(fp, "  }");
+
+    //每次操作的分配次数,包含打开和关闭,操作次数多时可以忽略
+    if (alloc_trace_enabled()) {
+        fprintf(fp, ",\n  \"allocations\": {\n");
+        for (i = 0; i < BENCH_ALLOC_MAX; i++) {
+            if (allocs[i].name != NULL) {
+                __bench_json_alloc(fp, &allocs[i], first);
+                first = 0;
+            }
+        }
+        fprintf(fp, "\n  }");
+    }
+
+    fprintf(fp, "\n}\n");
+
+    if (fp != stdout)
+        fclose(fp);
+
+    for (i = 0; i < media.nb_packets; i++)
+        av_free(media.packets[i].data);
+    av_free(media.packets);
+    av_free(media.extradata);
+    free(open_samples);
+    free(seek_samples);
+
+    return 0;
+}
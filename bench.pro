@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = bench
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += bench.c
+
+include(media.pri)
@@ -0,0 +1,656 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/mem.h"
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "concat.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define fdatasync(fd)   _commit(fd)
+#else
+#define O_BINARY        0
+#endif
+
+#define CONCAT_IO_SIZE          (32 * 1024)
+#define CONCAT_COPY_SIZE        (1024 * 1024)
+#define CONCAT_MAX_STREAMS      32
+
+/**
+ * 输入: 解析moov时真的读文件,之后zero为1,读样本数据时直接填0
+ */
+typedef struct concat_input {
+    int fd;
+    int64_t pos;
+    int64_t size;
+    int zero;
+} concat_input_t;
+
+/**
+ * 输出: passthrough为0时只记录位置(样本数据由拷贝写入),写文件头和moov时为1
+ */
+typedef struct concat_output {
+    int fd;
+    int64_t pos;
+    int64_t size;
+    int passthrough;
+} concat_output_t;
+
+//输入中连续的一段样本,对应输出中连续的一段
+typedef struct concat_run {
+    int64_t in_offset;
+    int64_t out_offset;
+    int64_t size;
+} concat_run_t;
+
+typedef struct concat {
+    AVFormatContext *oc;
+    concat_output_t out;
+    concat_stats_t stats;
+    uint8_t *buffer;            //read/write拷贝用
+    int copy_file_range_ok;
+    int64_t last_dts[CONCAT_MAX_STREAMS];
+    int64_t end_us;             //已经写入部分的结束时间
+} concat_t;
+
+static int __concat_read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    concat_input_t *in = (concat_input_t *)opaque;
+    ssize_t n = 0;
+
+    if (in->pos >= in->size)
+        return AVERROR_EOF;
+
+    if (buf_size > in->size - in->pos)
+        buf_size = (int)(in->size - in->pos);
+
+    if (in->zero) {
+        memset(buf, 0, buf_size);
+        n = buf_size;
+    } else {
+        if (lseek(in->fd, in->pos, SEEK_SET) < 0)
+            return AVERROR(errno);
+        n = read(in->fd, buf, buf_size);
+        if (n < 0)
+            return AVERROR(errno);
+        if (n == 0)
+            return AVERROR_EOF;
+    }
+
+    in->pos += n;
+
+    return (int)n;
+}
+
+static int64_t __concat_input_seek(void *opaque, int64_t offset, int whence)
+{
+    concat_input_t *in = (concat_input_t *)opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return in->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += in->pos;
+        break;
+    case SEEK_END:
+        offset += in->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    in->pos = offset;
+
+    return offset;
+}
+
+static int __concat_write(int fd, const uint8_t *buf, int size, int64_t offset)
+{
+    int done = 0;
+    ssize_t n = 0;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+
+    while (done < size) {
+        n = write(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+static int __concat_write_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    concat_output_t *out = (concat_output_t *)opaque;
+
+    if (out->passthrough && __concat_write(out->fd, buf, buf_size, out->pos) != buf_size)
+        return AVERROR(errno);
+
+    out->pos += buf_size;
+    if (out->pos > out->size)
+        out->size = out->pos;
+
+    return buf_size;
+}
+
+static int64_t __concat_output_seek(void *opaque, int64_t offset, int whence)
+{
+    concat_output_t *out = (concat_output_t *)opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return out->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += out->pos;
+        break;
+    case SEEK_END:
+        offset += out->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    out->pos = offset;
+
+    return offset;
+}
+
+static void __concat_free_io(AVIOContext **pb)
+{
+    if (*pb != NULL) {
+        av_freep(&(*pb)->buffer);
+        avio_context_free(pb);
+    }
+}
+
+/**
+ * 拷贝一段数据,优先copy_file_range(内核内拷贝,支持的文件系统上是reflink),
+ * 不支持时(跨文件系统,老内核)改用sendfile,最后用read/write
+ */
+static int __concat_copy(concat_t *c, int in_fd, const concat_run_t *run)
+{
+    int64_t in_offset = run->in_offset, out_offset = run->out_offset, left = run->size;
+    ssize_t n = 0;
+    int size = 0;
+
+#ifdef __linux__
+    loff_t in_off = in_offset, out_off = out_offset;
+    off_t send_off = 0;
+
+    while (c->copy_file_range_ok && left > 0) {
+        n = copy_file_range(in_fd, &in_off, c->out.fd, &out_off, (size_t)left, 0);
+        if (n > 0) {
+            left -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP))
+            return -1;
+        c->copy_file_range_ok = 0;
+    }
+
+    if (left == 0)
+        return 0;
+
+    c->stats.fallback_copies++;
+    in_offset = in_off;
+    out_offset = out_off;
+
+    //sendfile写在输出文件的当前位置
+    if (lseek(c->out.fd, out_offset, SEEK_SET) < 0)
+        return -1;
+
+    send_off = in_offset;
+    while (left > 0) {
+        n = sendfile(c->out.fd, in_fd, &send_off, (size_t)FFMIN(left, 1 << 30));
+        if (n > 0) {
+            left -= n;
+            out_offset += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EINVAL && errno != ENOSYS))
+            return -1;
+        break;
+    }
+    in_offset = send_off;
+#else
+    c->stats.fallback_copies++;
+#endif
+
+    if (left > 0 && c->buffer == NULL) {
+        c->buffer = av_malloc(CONCAT_COPY_SIZE);
+        if (c->buffer == NULL)
+            return -1;
+    }
+
+    while (left > 0) {
+        size = (int)FFMIN(left, CONCAT_COPY_SIZE);
+        if (lseek(in_fd, in_offset, SEEK_SET) < 0)
+            return -1;
+        n = read(in_fd, c->buffer, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        if (__concat_write(c->out.fd, c->buffer, (int)n, out_offset) != n)
+            return -1;
+        in_offset += n;
+        out_offset += n;
+        left -= n;
+    }
+
+    return 0;
+}
+
+static int __concat_create_output(concat_t *c, const char *output, AVFormatContext *ic)
+{
+    AVStream *st = NULL;
+    uint8_t *buffer = NULL;
+    unsigned int i = 0;
+
+    if (avformat_alloc_output_context2(&c->oc, NULL, "mp4", output) < 0 || c->oc == NULL)
+        return -1;
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        st = avformat_new_stream(c->oc, NULL);
+        if (st == NULL || avcodec_parameters_copy(st->codecpar, ic->streams[i]->codecpar) < 0)
+            return -1;
+        st->codecpar->codec_tag = 0;
+        st->time_base = ic->streams[i]->time_base;
+    }
+
+    buffer = av_malloc(CONCAT_IO_SIZE);
+    if (buffer == NULL)
+        return -1;
+
+    c->oc->pb = avio_alloc_context(buffer, CONCAT_IO_SIZE, 1, &c->out, NULL, __concat_write_packet, __concat_output_seek);
+    if (c->oc->pb == NULL) {
+        av_free(buffer);
+        return -1;
+    }
+
+    //文件头真的写入,之后的样本数据由拷贝写入
+    c->out.passthrough = 1;
+    if (avformat_write_header(c->oc, NULL) < 0)
+        return -1;
+    avio_flush(c->oc->pb);
+    c->out.passthrough = 0;
+
+    return c->oc->pb->error < 0 ? -1 : 0;
+}
+
+static int __concat_check(const AVFormatContext *oc, const AVFormatContext *ic, const char *filename)
+{
+    const AVCodecParameters *a = NULL, *b = NULL;
+    unsigned int i = 0;
+
+    if (ic->nb_streams != oc->nb_streams) {
+        fprintf(stderr, "concat: '%s' has %u streams, expected %u\n", filename, ic->nb_streams, oc->nb_streams);
+        return -1;
+    }
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        a = oc->streams[i]->codecpar;
+        b = ic->streams[i]->codecpar;
+        if (a->codec_type != b->codec_type || a->codec_id != b->codec_id || a->format != b->format ||
+            a->width != b->width || a->height != b->height ||
+            a->sample_rate != b->sample_rate || a->channels != b->channels ||
+            a->extradata_size != b->extradata_size ||
+            (a->extradata_size > 0 && memcmp(a->extradata, b->extradata, a->extradata_size) != 0)) {
+            fprintf(stderr, "concat: stream %u of '%s' does not match the first input\n", i, filename);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * 追加一个输入: 时间戳接在已经写入部分的后面,
+ * 样本交给muxer记录样本表,数据按连续区间拷贝
+ */
+static int __concat_append(concat_t *c, AVFormatContext *ic, concat_input_t *in, int first)
+{
+    AVPacket pkt;
+    AVRational in_tb, out_tb;
+    concat_run_t run = {0};
+    int64_t base = 0, out_pos = 0, end = 0;
+    int ret = 0, err = 0, size = 0, i = 0;
+
+    //第一个文件保持原来的时间戳,后面的文件减去自己的起始时间
+    if (!first && ic->start_time != AV_NOPTS_VALUE)
+        base = c->end_us - ic->start_time;
+    else if (!first)
+        base = c->end_us;
+
+    in->zero = 1;
+    av_init_packet(&pkt);
+
+    while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+        i = pkt.stream_index;
+        //pos<0的数据不在文件中,无法拷贝
+        if (i >= (int)c->oc->nb_streams || pkt.pos < 0 || pkt.size <= 0) {
+            av_packet_unref(&pkt);
+            continue;
+        }
+
+        in_tb = ic->streams[i]->time_base;
+        out_tb = c->oc->streams[i]->time_base;
+
+        if (pkt.pts != AV_NOPTS_VALUE)
+            pkt.pts += av_rescale_q(base, AV_TIME_BASE_Q, in_tb);
+        if (pkt.dts != AV_NOPTS_VALUE)
+            pkt.dts += av_rescale_q(base, AV_TIME_BASE_Q, in_tb);
+        av_packet_rescale_ts(&pkt, in_tb, out_tb);
+
+        //分段之间时长记录有误差时,保证dts严格递增
+        if (pkt.dts != AV_NOPTS_VALUE) {
+            if (c->last_dts[i] != AV_NOPTS_VALUE && pkt.dts <= c->last_dts[i]) {
+                pkt.dts = c->last_dts[i] + 1;
+                if (pkt.pts != AV_NOPTS_VALUE && pkt.pts < pkt.dts)
+                    pkt.pts = pkt.dts;
+            }
+            c->last_dts[i] = pkt.dts;
+            end = av_rescale_q(pkt.dts + pkt.duration, out_tb, AV_TIME_BASE_Q);
+            if (end > c->end_us)
+                c->end_us = end;
+        }
+
+        //和上一段在输入和输出中都相邻时合并
+        out_pos = avio_tell(c->oc->pb);
+        if (run.size > 0 && (run.in_offset + run.size != pkt.pos || run.out_offset + run.size != out_pos)) {
+            if (__concat_copy(c, in->fd, &run) != 0) {
+                err = -5;
+                break;
+            }
+            c->stats.copies++;
+            run.size = 0;
+        }
+        if (run.size == 0) {
+            run.in_offset = pkt.pos;
+            run.out_offset = out_pos;
+        }
+        run.size += pkt.size;
+
+        size = pkt.size;
+        pkt.pos = -1;
+        //mov原样写入mp4格式的样本,大小不变才能拷贝
+        if (av_write_frame(c->oc, &pkt) < 0 || avio_tell(c->oc->pb) - out_pos != size) {
+            err = -4;
+            break;
+        }
+
+        c->stats.samples++;
+        c->stats.bytes += size;
+        av_packet_unref(&pkt);
+    }
+
+    av_packet_unref(&pkt);
+
+    if (err != 0)
+        return err;
+
+    if (ret != AVERROR_EOF)
+        return -2;
+
+    if (run.size > 0) {
+        if (__concat_copy(c, in->fd, &run) != 0)
+            return -5;
+        c->stats.copies++;
+    }
+
+    return 0;
+}
+
+static AVFormatContext *__concat_open_input(const char *filename, concat_input_t *in)
+{
+    AVFormatContext *ic = NULL;
+    AVIOContext *pb = NULL;
+    uint8_t *buffer = NULL;
+    struct stat st;
+
+    in->fd = open(filename, O_RDONLY | O_BINARY);
+    if (in->fd < 0 || fstat(in->fd, &st) != 0) {
+        fprintf(stderr, "concat: open '%s' failed: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    in->size = st.st_size;
+    in->pos = 0;
+    in->zero = 0;
+
+    ic = avformat_alloc_context();
+    buffer = av_malloc(CONCAT_IO_SIZE);
+    if (ic == NULL || buffer == NULL)
+        goto fail;
+
+    ic->pb = avio_alloc_context(buffer, CONCAT_IO_SIZE, 0, in, __concat_read_packet, NULL, __concat_input_seek);
+    if (ic->pb == NULL)
+        goto fail;
+    buffer = NULL;
+
+    //失败时avformat_open_input会释放ic,自定义的pb要自己释放
+    pb = ic->pb;
+    if (avformat_open_input(&ic, filename, av_find_input_format("mp4"), NULL) < 0) {
+        fprintf(stderr, "concat: '%s' is not a mp4 file\n", filename);
+        __concat_free_io(&pb);
+        return NULL;
+    }
+
+    if (avformat_find_stream_info(ic, NULL) < 0) {
+        fprintf(stderr, "concat: find stream info of '%s' failed\n", filename);
+        goto fail;
+    }
+
+    return ic;
+
+fail:
+    av_free(buffer);
+    if (ic != NULL) {
+        pb = ic->pb;
+        avformat_close_input(&ic);
+        __concat_free_io(&pb);
+    }
+
+    return NULL;
+}
+
+static void __concat_close_input(AVFormatContext **ic, concat_input_t *in)
+{
+    AVIOContext *pb = NULL;
+
+    if (*ic != NULL) {
+        pb = (*ic)->pb;
+        avformat_close_input(ic);
+        __concat_free_io(&pb);
+    }
+
+    if (in->fd >= 0) {
+        close(in->fd);
+        in->fd = -1;
+    }
+}
+
+static int __concat_same_file(const struct stat *a, const char *filename)
+{
+    struct stat st;
+
+    return stat(filename, &st) == 0 && st.st_dev == a->st_dev && st.st_ino == a->st_ino;
+}
+
+/**
+ * 创建输出之前检查所有输入: 能打开,流参数和第一个一致,不是输出文件本身,
+ * 输出是其中一个输入时截断输出会毁掉这个输入
+ */
+static int __concat_validate(const char *output, const char *part, const char **inputs, int nb_inputs)
+{
+    concat_input_t first_in = {.fd = -1}, in = {.fd = -1};
+    AVFormatContext *first = NULL, *ic = NULL;
+    struct stat st;
+    int i = 0, ret = 0;
+
+    for (i = 0; i < nb_inputs; i++) {
+        if (stat(inputs[i], &st) != 0) {
+            fprintf(stderr, "concat: open '%s' failed: %s\n", inputs[i], strerror(errno));
+            return -2;
+        }
+        if (__concat_same_file(&st, output) || __concat_same_file(&st, part)) {
+            fprintf(stderr, "concat: output '%s' is the input '%s'\n", output, inputs[i]);
+            return -1;
+        }
+    }
+
+    first = __concat_open_input(inputs[0], &first_in);
+    if (first == NULL) {
+        ret = -2;
+    } else if (first->nb_streams > CONCAT_MAX_STREAMS) {
+        fprintf(stderr, "concat: '%s' has too many streams\n", inputs[0]);
+        ret = -3;
+    }
+
+    for (i = 1; i < nb_inputs && ret == 0; i++) {
+        ic = __concat_open_input(inputs[i], &in);
+        if (ic == NULL)
+            ret = -2;
+        else if (__concat_check(first, ic, inputs[i]) != 0)
+            ret = -3;
+        __concat_close_input(&ic, &in);
+    }
+
+    __concat_close_input(&first, &first_in);
+
+    return ret;
+}
+
+int concat_mp4(const char *output, const char **inputs, int nb_inputs, concat_stats_t *stats)
+{
+    concat_t c;
+    concat_input_t in = {.fd = -1};
+    AVFormatContext *ic = NULL;
+    char *part = NULL;
+    int i = 0, ret = -1, err = 0;
+
+    if (output == NULL || inputs == NULL || nb_inputs <= 0)
+        return -1;
+
+    //先写临时文件,成功后改名,失败时不会留下不完整的输出,也不会覆盖原来的输出
+    part = av_asprintf("%s.part", output);
+    if (part == NULL)
+        return -1;
+
+    ret = __concat_validate(output, part, inputs, nb_inputs);
+    if (ret != 0) {
+        av_free(part);
+        return ret;
+    }
+    ret = -1;
+
+    memset(&c, 0, sizeof(c));
+    c.out.fd = -1;
+    c.copy_file_range_ok = 1;
+    for (i = 0; i < CONCAT_MAX_STREAMS; i++)
+        c.last_dts[i] = AV_NOPTS_VALUE;
+
+    c.out.fd = open(part, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (c.out.fd < 0) {
+        fprintf(stderr, "concat: create '%s' failed: %s\n", part, strerror(errno));
+        av_free(part);
+        return -4;
+    }
+
+    for (i = 0; i < nb_inputs; i++) {
+        ic = __concat_open_input(inputs[i], &in);
+        if (ic == NULL) {
+            ret = -2;
+            goto fail;
+        }
+
+        //输入在__concat_validate中已经检查过
+        if (i == 0 && __concat_create_output(&c, output, ic) != 0) {
+            ret = -4;
+            goto fail;
+        }
+
+        ret = __concat_append(&c, ic, &in, i == 0);
+        if (ret != 0) {
+            fprintf(stderr, "concat: append '%s' failed: %d\n", inputs[i], ret);
+            goto fail;
+        }
+
+        __concat_close_input(&ic, &in);
+    }
+
+    //moov写在文件末尾,并修正mdat大小
+    avio_flush(c.oc->pb);
+    c.out.passthrough = 1;
+
+    if (av_write_trailer(c.oc) < 0) {
+        ret = -4;
+        goto fail;
+    }
+
+    avio_flush(c.oc->pb);
+    if (c.oc->pb->error < 0 || fdatasync(c.out.fd) != 0) {
+        ret = -4;
+        goto fail;
+    }
+
+    err = close(c.out.fd);
+    c.out.fd = -1;
+    if (err != 0 || rename(part, output) != 0) {
+        fprintf(stderr, "concat: rename '%s' to '%s' failed: %s\n", part, output, strerror(errno));
+        ret = -4;
+        goto fail;
+    }
+
+    c.stats.duration_ms = c.end_us / 1000;
+    ret = 0;
+
+fail:
+    __concat_close_input(&ic, &in);
+    if (c.oc != NULL) {
+        __concat_free_io(&c.oc->pb);
+        avformat_free_context(c.oc);
+    }
+    if (c.out.fd >= 0)
+        close(c.out.fd);
+    if (ret != 0)
+        unlink(part);
+    av_free(part);
+    av_free(c.buffer);
+
+    if (stats != NULL)
+        *stats = c.stats;
+
+    return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef __CONCAT_H
+#define __CONCAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @brief 无损合并多个mp4分段,用于把一天的录像归档成一个文件
+ *   不经过用户态的packet读写循环:
+ *   1.读取输入时只解析moov,样本数据用0代替(不读文件),得到每个样本的位置,大小和时间戳
+ *   2.样本按顺序交给mov muxer,muxer的输出只记录位置不写文件,最后只写一次moov(样本表)
+ *   3.样本数据按连续的区间从输入文件拷贝到输出的对应位置,
+ *     linux上用copy_file_range(同一文件系统上可能是reflink,不占用新的空间)或者sendfile,
+ *     其他系统用read/write
+ *   所有输入的流个数,编码,像素或采样格式和extradata必须相同,时间戳按文件顺序接续
+ */
+typedef struct concat_stats {
+    int64_t samples;            //合并的样本数
+    int64_t bytes;              //拷贝的样本数据字节数
+    int64_t copies;             //拷贝的连续区间数
+    int64_t fallback_copies;    //copy_file_range不可用时用sendfile或read/write拷贝的区间数
+    int64_t duration_ms;        //输出总时长
+} concat_stats_t;
+
+/**
+ * @brief 合并
+ *
+ * @param output: 输出mp4文件,先写到output+".part",成功后改名覆盖已存在的文件,失败时删除临时文件
+ * @param inputs: 输入mp4文件,按时间顺序
+ * @param nb_inputs: 输入个数
+ * @param stats: 输出统计,可以为NULL
+ * @return int: 0成功 其他失败
+ *              -1:参数错误,或者输出是其中一个输入
+ *              -2:打开输入失败
+ *              -3:输入的流参数不一致
+ *              -4:创建或者写入输出失败
+ *              -5:拷贝样本数据失败
+ */
+int concat_mp4(const char *output, const char **inputs, int nb_inputs, concat_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__CONCAT_H
@@ -1,6 +1,9 @@
 
 
 #include "demux.h"
+#include "alloc_trace.h"
+#include "trace.h"
+#include "metrics.h"
 
 #define ADTS_HEADER_LEN  7;
 
@@ -14,7 +17,7 @@
 						.is_open = 0,\
 						.is_seek = 0,\
 						.fmt_ctx = NULL,\
-                        .time_base = AV_TIME_BASE,\
+                        .time_base = {1, AV_TIME_BASE},\
 						.video_stream_idx = -1,\
 						.audio_stream_idx = -1,\
 						.pkt = {0},\
@@ -26,6 +29,7 @@
 						.secs = 0,\
 						.duration = 0,\
 						.fps = 1.,\
+						.metrics = NULL,\
 					}
 
 const int sampling_frequencies[] = {
@@ -64,7 +68,7 @@ int adts_header(char * const p_adts_header, const int data_length,
     }
     if(i >= frequencies_size)
     {
-        printf("unsupport samplerate:%d\n", samplerate);
+        fprintf(stderr, "unsupport samplerate:%d\n", samplerate);
         return -1;
     }
 
@@ -99,9 +103,11 @@ int adts_header(char * const p_adts_header, const int data_length,
 
 demuxer_t *demuxer_create(void)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
     demuxer_t *demuxer = calloc(1, sizeof(demuxer_t));
     if(demuxer != NULL) {
         *demuxer = DEMUXER_INIT();
+        demuxer->metrics = metrics_register(METRICS_KIND_DEMUXER);
     }
 
     return demuxer;
@@ -109,8 +115,10 @@ demuxer_t *demuxer_create(void)
 
 void demuxer_destroy(demuxer_t **demuxer)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
     if(demuxer != NULL && *demuxer != NULL) {
         demuxer_close(*demuxer);
+        metrics_unregister(&(*demuxer)->metrics);
         free(*demuxer);
         *demuxer = NULL;
     }
@@ -141,6 +149,8 @@ static void __demuxer_reinit(demuxer_t *demuxer)
 
 int demuxer_open(demuxer_t *demuxer, const char *filename)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
+    TRACE_SCOPE("demuxer_open", "demux");
     int ret = -1;
     const AVBitStreamFilter *filter = NULL;
 
@@ -151,7 +161,7 @@ int demuxer_open(demuxer_t *demuxer, const char *filename)
     }
 
     // 2. 加锁
-    if (pthread_mutex_lock(&demuxer->mutex) != 0) {
+    if (TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex") != 0) {
         fprintf(stderr, "Failed to acquire mutex.\n");
         return ret;
     }
@@ -200,7 +210,6 @@ int demuxer_open(demuxer_t *demuxer, const char *filename)
             demuxer->audio_stream_idx = ret;
         } else {
             fprintf(stderr, "Failed to find best audio stream. Continuing without audio.\n");
-            goto fail;
         }
 
         // 10. 应用过滤器
@@ -236,13 +245,14 @@ int demuxer_open(demuxer_t *demuxer, const char *filename)
             fprintf(stderr, "Warning: Duration value is invalid.\n");
             demuxer->duration = 0.0;
         }
-        printf("'%s' total duration secs: %"PRId64"\n", filename, demuxer->secs);
+        av_log(NULL, AV_LOG_DEBUG, "'%s' total duration secs: %"PRId64"\n", filename, demuxer->secs);
 
         // 12. 设置开始时间
         demuxer->start_time = (demuxer->fmt_ctx->start_time != AV_NOPTS_VALUE) ? demuxer->fmt_ctx->start_time / AV_TIME_BASE : 0.0;
 
         // 13. 更新打开状态
         demuxer->is_open = 1;
+        metrics_set_file(demuxer->metrics, filename);
     }
 
     demuxer->time_base = demuxer->fmt_ctx->streams[demuxer->video_stream_idx]->time_base;
@@ -261,6 +271,8 @@ fail:
 
 int demuxer_close(demuxer_t *demuxer)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
+    TRACE_SCOPE("demuxer_close", "demux");
     int ret = 0;
 
     // 1. 检查参数有效性
@@ -270,7 +282,7 @@ int demuxer_close(demuxer_t *demuxer)
     }
 
     // 2. 加锁
-    if (pthread_mutex_lock(&demuxer->mutex) != 0) {
+    if (TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex") != 0) {
         fprintf(stderr, "Failed to acquire mutex.\n");
         return -1;
     }
@@ -292,6 +304,8 @@ int demuxer_close(demuxer_t *demuxer)
         av_packet_unref(&demuxer->pkt);
 		av_packet_unref(&demuxer->last_pkt);
 
+        metrics_set_file(demuxer->metrics, NULL);
+
         // 6. 重置开启标志
         demuxer->is_open = 0;
         demuxer->is_end = 0;
@@ -305,6 +319,8 @@ int demuxer_close(demuxer_t *demuxer)
 
 int demuxer_seek(demuxer_t *demuxer, int64_t m)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
+    TRACE_SCOPE("demuxer_seek", "demux");
     int ret = -2; // 1. 初始化返回值`ret`为-2,表示默认的错误状态。
     int64_t seek_pos = milliseconds_to_fftime(m,demuxer->time_base); // 2. 将`m`(毫秒)转换为对应的FFmpeg时间单位,存储在`seek_pos`中。
     int64_t duration = -1;
@@ -317,18 +333,18 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m)
     }
 
     // 4. 锁定`demuxer`的互斥锁,保证线程安全。
-    pthread_mutex_lock(&demuxer->mutex);
+    TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex");
 
     // 5. 获取媒体持续时间,并将其从毫秒转换为FFmpeg的时间单位,存储在`duration`变量中。
     duration = milliseconds_to_fftime(demuxer->secs,demuxer->time_base);
-    printf("Media duration: %"PRId64" (FFmpeg time unit)\n", duration);
+    av_log(NULL, AV_LOG_DEBUG, "Media duration: %"PRId64" (FFmpeg time unit)\n", duration);
 
     // 6. 判断是否通过字节进行跳转,这依赖于demuxer的格式上下文的`iformat`标志。
     seek_by_bytes = !!(demuxer->fmt_ctx->iformat->flags & AVFMT_TS_DISCONT);
-    printf("Seeking by bytes: %s\n", seek_by_bytes ? "Yes" : "No");
+    av_log(NULL, AV_LOG_DEBUG, "Seeking by bytes: %s\n", seek_by_bytes ? "Yes" : "No");
 
     AVStream *st = demuxer->fmt_ctx->streams[demuxer->video_stream_idx];
-    av_log(NULL, AV_LOG_INFO, "Time base: %d/%d\n", st->time_base.num, st->time_base.den);
+    av_log(NULL, AV_LOG_DEBUG, "Time base: %d/%d\n", st->time_base.num, st->time_base.den);
 
 
     // 7. 如果解复用器是打开的状态(`is_open` > 0),根据是否通过字节跳转执行不同的逻辑：
@@ -337,7 +353,7 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m)
         // 如果不通过字节跳转(`seek_by_bytes`为0)
         if (!seek_by_bytes) {
             if (seek_pos < duration) {
-                printf("Time-based seek to position: %"PRId64"\n", seek_pos);
+                av_log(NULL, AV_LOG_DEBUG, "Time-based seek to position: %"PRId64"\n", seek_pos);
                 ret = avformat_seek_file(demuxer->fmt_ctx, demuxer->video_stream_idx, INT64_MIN, seek_pos, INT64_MAX, 0);
                 if (ret < 0) {
                     fprintf(stderr, "avformat_seek_file (time-based seek) failed: %s\n", av_err2str(ret));
@@ -360,7 +376,7 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m)
             }
             pos += m;
             int64_t file_size = avio_size(demuxer->fmt_ctx->pb);
-            printf("Byte-based seek to position: %"PRId64" (bytes)\n", (int64_t)pos);
+            av_log(NULL, AV_LOG_DEBUG, "Byte-based seek to position: %"PRId64" (bytes)\n", (int64_t)pos);
             if (pos < file_size) {
                 ret = avformat_seek_file(demuxer->fmt_ctx, demuxer->video_stream_idx, INT64_MIN, pos, INT64_MAX, AVSEEK_FLAG_BYTE);
                 if (ret < 0) {
@@ -376,6 +392,11 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m)
         }
     }
 
+    if (ret == 0)
+        metrics_add_seek(demuxer->metrics);
+    else if (ret < -2)
+        metrics_add_error(demuxer->metrics);
+
     // 8. 设置`is_seek`标志为1,表示已执行跳转操作。
     demuxer->is_seek = 1;
 
@@ -388,6 +409,8 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m)
 
 int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *is_key, int *total, int *cur)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
+    TRACE_SCOPE("demuxer_read", "demux");
     // 参数校验
     if (demuxer == NULL) {
         fprintf(stderr, "Invalid arguments\n");
@@ -396,7 +419,7 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
 
     int ret = -2;
 
-    pthread_mutex_lock(&demuxer->mutex);
+    TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex");
 
     if (demuxer->is_open <= 0) {
         fprintf(stderr, "Demuxer is not open\n");
@@ -419,6 +442,8 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
 
             if (ret < 0) {
                 fprintf(stderr, "Seeking error or end of file reached\n");
+                if (ret != AVERROR_EOF)
+                    metrics_add_error(demuxer->metrics);
                 ret = (demuxer->last_pkt.data == NULL) ? -3 : ret;
                 goto unlock_and_fail;
             }
@@ -426,6 +451,8 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
             ret = av_read_frame(demuxer->fmt_ctx, &demuxer->pkt);
             if (ret < 0) {
                 fprintf(stderr, "Read frame error or end of file reached\n");
+                if (ret != AVERROR_EOF)
+                    metrics_add_error(demuxer->metrics);
                 goto handle_eof;
             }
         }
@@ -437,7 +464,7 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
             *len = demuxer->pkt.size;
             *total = demuxer->secs;
             *cur = av_rescale_q(demuxer->pkt.pts, demuxer->st->time_base, AV_TIME_BASE_Q) / 1000;
-            printf("cur pts: %ld\n", demuxer->pkt.pts);
+            av_log(NULL, AV_LOG_DEBUG, "cur pts: %"PRId64"\n", demuxer->pkt.pts);
 
             if (demuxer->pkt.stream_index == demuxer->video_stream_idx) {
                 // 视频帧处理逻辑
@@ -454,9 +481,11 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
                     }
                 }
                 *is_video = 1;
+                metrics_add_packet(demuxer->metrics, METRICS_MEDIA_VIDEO, *len);
                 break;
             } else if (demuxer->pkt.stream_index == demuxer->audio_stream_idx) {
                 *is_video = 0;
+                metrics_add_packet(demuxer->metrics, METRICS_MEDIA_AUDIO, *len);
                 break;
             }
         }
@@ -486,11 +515,95 @@ unlock_and_fail:
     return ret;
 }
 
-int64_t demuxer_get_duration(const char *filename)
+int demuxer_get_nb_streams(demuxer_t *demuxer)
+{
+    int nb = 0;
+
+    if (demuxer == NULL) {
+        return -1;
+    }
+
+    TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex");
+    if (demuxer->is_open > 0) {
+        nb = demuxer->fmt_ctx->nb_streams;
+    }
+    pthread_mutex_unlock(&demuxer->mutex);
+
+    return nb;
+}
+
+const AVCodecParameters *demuxer_get_codecpar(demuxer_t *demuxer, int stream_index, AVRational *time_base)
+{
+    const AVCodecParameters *par = NULL;
+
+    if (demuxer == NULL) {
+        return NULL;
+    }
+
+    TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex");
+    if (demuxer->is_open > 0 && stream_index >= 0 && stream_index < (int)demuxer->fmt_ctx->nb_streams) {
+        par = demuxer->fmt_ctx->streams[stream_index]->codecpar;
+        if (time_base != NULL) {
+            *time_base = demuxer->fmt_ctx->streams[stream_index]->time_base;
+        }
+    }
+    pthread_mutex_unlock(&demuxer->mutex);
+
+    return par;
+}
+
+int demuxer_read_packet(demuxer_t *demuxer, AVPacket *pkt)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
+    TRACE_SCOPE("demuxer_read_packet", "demux");
+    int ret = -2;
+
+    if (demuxer == NULL || pkt == NULL) {
+        fprintf(stderr, "Invalid arguments\n");
+        return -1;
+    }
+
+    TRACE_MUTEX_LOCK(&demuxer->mutex, "demuxer->mutex");
+
+    if (demuxer->is_open <= 0) {
+        fprintf(stderr, "Demuxer is not open\n");
+        ret = -4;
+        goto unlock;
+    }
+
+    while ((ret = av_read_frame(demuxer->fmt_ctx, pkt)) >= 0) {
+        // seek之后丢弃第一个视频关键帧之前的数据
+        if (demuxer->is_seek > 0) {
+            if (pkt->stream_index != demuxer->video_stream_idx || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+                av_packet_unref(pkt);
+                continue;
+            }
+            demuxer->is_seek = 0;
+        }
+        break;
+    }
+
+    if (ret < 0) {
+        ret = (ret == AVERROR_EOF) ? -5 : -3;
+        if (ret == -3)
+            metrics_add_error(demuxer->metrics);
+    } else {
+        metrics_add_packet(demuxer->metrics,
+                           metrics_media_type(demuxer->fmt_ctx->streams[pkt->stream_index]->codecpar->codec_type),
+                           pkt->size);
+        ret = 0;
+    }
+
+unlock:
+    pthread_mutex_unlock(&demuxer->mutex);
+    return ret;
+}
+
+int64_t demuxer_get_duration_us(const char *filename)
 {
-    int secs = 0;
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_DEMUXER);
     AVFormatContext *context = NULL;
-    int duration = 0;
+    int64_t duration = 0;
 
     if (filename == NULL || *filename == '\0'){
         return 0;
@@ -507,15 +620,24 @@ int64_t demuxer_get_duration(const char *filename)
         return -1;
     }
 
-    if(context->duration != AV_NOPTS_VALUE){
-        duration = context->duration + (context->duration <= INT64_MAX - 5000?5000:0);
-
-        secs = fftime_to_milliseconds(duration);
-    }
+    if(context->duration != AV_NOPTS_VALUE && context->duration > 0)
+        duration = context->duration;
 
     avformat_close_input(&context);
 
-    return secs;
+    return duration;
+}
+
+int64_t demuxer_get_duration(const char *filename)
+{
+    int64_t duration = demuxer_get_duration_us(filename);
+
+    if (duration <= 0)
+        return duration;
+
+    duration += (duration <= INT64_MAX - 5000 ? 5000 : 0);
+
+    return fftime_to_milliseconds(duration);
 }
 
 
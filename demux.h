@@ -26,6 +26,7 @@ typedef struct demuxer{
     int64_t secs;
     int64_t duration;
     double fps;
+    struct metrics_source *metrics;
 }demuxer_t;
 
 int adts_header(char * const p_adts_header, const int data_length,
@@ -86,6 +87,37 @@ int demuxer_seek(demuxer_t *demuxer, int64_t m);
  */
 int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *is_key, int *total, int *cur);
 
+/**
+ * @brief 获取流的个数
+ *
+ * @param demuxer: demuxer_create返回值
+ * @return int: 流个数, 没有打开返回0
+ */
+int demuxer_get_nb_streams(demuxer_t *demuxer);
+
+/**
+ * @brief 获取流的编码参数,可以直接传给muxer_add_stream做stream copy
+ *
+ * @param demuxer: demuxer_create返回值
+ * @param stream_index: 流序号
+ * @param time_base: 输出该流的时间基,可以为NULL
+ * @return const AVCodecParameters*: NULL失败, demuxer关闭前有效
+ */
+const AVCodecParameters *demuxer_get_codecpar(demuxer_t *demuxer, int stream_index, AVRational *time_base);
+
+/**
+ * @brief 读取原始packet(所有流,不做annexb转换),用于stream copy
+ *
+ * @param demuxer: demuxer_create返回值
+ * @param pkt: 输出packet,使用完调用av_packet_unref
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -3:读取错误
+ *              -4:没有打开
+ *              -5:文件结束
+ */
+int demuxer_read_packet(demuxer_t *demuxer, AVPacket *pkt);
+
 /**
  * @brief 获取总时长()
  *
@@ -94,6 +126,14 @@ int demuxer_read(demuxer_t *demuxer, void **data, int *len, int *is_video, int *
  */
 int64_t demuxer_get_duration(const char *filename);
 
+/**
+ * @brief 获取总时长(微秒),容器记录的原始值,不做取整
+ *
+ * @param filename
+ * @return int64_t: >=0 当前文件总时长 0:时长未知 <0:打开失败
+ */
+int64_t demuxer_get_duration_us(const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,6 @@
+# 库: 默认动态库, qmake CONFIG+=staticlib 生成静态库
+TEMPLATE = lib
+TARGET = demux_mp4
+CONFIG -= qt
+
+include(media.pri)
@@ -0,0 +1,233 @@
+/*
+ * 生成合成的测试文件: H.264/HEVC + AAC, 时长,gop,码率,分辨率,轨道数可控
+ *
+ * gen_media [-c h264|hevc] [-s 宽x高] [-r 帧率] [-g gop] [-b 视频kbps] [-a 音频kbps]
+ *           [-d 秒] [-v 视频轨道数] [-n 音频轨道数] [-f mp4|ts] [-S seed] 输出文件
+ *
+ * 不依赖编码器,相同参数每次生成的文件完全相同,视频不能解码出画面,见synth.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "libavutil/mathematics.h"
+#include "libavutil/time.h"
+
+#include "mux.h"
+#include "synth.h"
+
+#define GEN_MAX_TRACKS      8
+
+typedef struct track {
+    synth_t *synth;
+    AVRational time_base;
+    synth_frame_t frame;        //下一帧
+    int index;                  //输出流序号
+    int64_t frames;
+    int64_t bytes;
+} track_t;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c h264|hevc] [-s WxH] [-r fps] [-g gop] [-b video_kbps] [-a audio_kbps]\n"
+                    "       [-d seconds] [-v video_tracks] [-n audio_tracks] [-f mp4|ts] [-S seed] output\n", name);
+}
+
+static int __gen_add_track(muxer_t *muxer, track_t *track)
+{
+    AVCodecParameters *par = NULL;
+    int ret = -1;
+
+    par = avcodec_parameters_alloc();
+    if (par == NULL)
+        return -1;
+
+    track->time_base = synth_get_time_base(track->synth);
+    if (synth_get_codecpar(track->synth, par) == 0)
+        ret = muxer_add_stream(muxer, par, track->time_base);
+
+    avcodec_parameters_free(&par);
+
+    if (ret < 0)
+        return -1;
+
+    track->index = ret;
+
+    return synth_next(track->synth, &track->frame);
+}
+
+int main(int argc, char **argv)
+{
+    synth_video_config_t video;
+    synth_audio_config_t audio;
+    track_t tracks[GEN_MAX_TRACKS];
+    muxer_t *muxer = NULL;
+    const char *output = NULL;
+    AVPacket pkt;
+    track_t *next = NULL;
+    int64_t duration = 60, start = 0, total = 0;
+    int nb_video = 1, nb_audio = 1, nb_tracks = 0, format = MUXER_FORMAT_MP4;
+    int opt = 0, i = 0, ret = -1;
+
+    memset(&video, 0, sizeof(video));
+    memset(&audio, 0, sizeof(audio));
+    memset(tracks, 0, sizeof(tracks));
+
+    video.codec_id = AV_CODEC_ID_H264;
+    video.width = 1920;
+    video.height = 1080;
+    video.frame_rate = (AVRational){25, 1};
+    video.gop = 50;
+    video.bit_rate = 4000000;
+    video.seed = 1;
+    audio.sample_rate = 48000;
+    audio.channels = 2;
+    audio.bit_rate = 64000;
+
+    while ((opt = getopt(argc, argv, "c:s:r:g:b:a:d:v:n:f:S:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            video.codec_id = strcmp(optarg, "hevc") == 0 || strcmp(optarg, "h265") == 0 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &video.width, &video.height) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r':
+            video.frame_rate = av_d2q(atof(optarg), 1001000);
+            break;
+        case 'g':
+            video.gop = atoi(optarg);
+            break;
+        case 'b':
+            video.bit_rate = atoll(optarg) * 1000;
+            break;
+        case 'a':
+            audio.bit_rate = atoll(optarg) * 1000;
+            break;
+        case 'd':
+            duration = atoll(optarg);
+            break;
+        case 'v':
+            nb_video = atoi(optarg);
+            break;
+        case 'n':
+            nb_audio = atoi(optarg);
+            break;
+        case 'f':
+            format = strcmp(optarg, "ts") == 0 ? MUXER_FORMAT_MPEGTS : MUXER_FORMAT_MP4;
+            break;
+        case 'S':
+            video.seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc - optind != 1 || duration <= 0 || nb_video < 0 || nb_audio < 0 ||
+        nb_video + nb_audio <= 0 || nb_video + nb_audio > GEN_MAX_TRACKS) {
+        usage(argv[0]);
+        return -1;
+    }
+    output = argv[optind];
+
+    for (i = 0; i < nb_video; i++) {
+        //每路视频数据不同,便于检查轨道有没有错位
+        video.seed += i;
+        tracks[nb_tracks].synth = synth_video_create(&video);
+        if (tracks[nb_tracks++].synth == NULL) {
+            fprintf(stderr, "invalid video parameters\n");
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < nb_audio; i++) {
+        tracks[nb_tracks].synth = synth_audio_create(&audio);
+        if (tracks[nb_tracks++].synth == NULL) {
+            fprintf(stderr, "invalid audio parameters\n");
+            goto fail;
+        }
+    }
+
+    muxer = muxer_create();
+    if (muxer == NULL)
+        goto fail;
+
+    if (muxer_set_format(muxer, format) != 0 || muxer_open(muxer, output) != 0) {
+        fprintf(stderr, "open '%s' failed\n", output);
+        goto fail;
+    }
+
+    for (i = 0; i < nb_tracks; i++) {
+        if (__gen_add_track(muxer, &tracks[i]) != 0) {
+            fprintf(stderr, "add track %d failed\n", i);
+            goto fail;
+        }
+    }
+
+    if (muxer_start(muxer) != 0) {
+        fprintf(stderr, "muxer_start failed\n");
+        goto fail;
+    }
+
+    av_init_packet(&pkt);
+    start = av_gettime_relative();
+
+    //按时间戳从小到大交织写入
+    for (;;) {
+        next = NULL;
+        for (i = 0; i < nb_tracks; i++) {
+            if (av_compare_ts(tracks[i].frame.pts, tracks[i].time_base, duration, (AVRational){1, 1}) >= 0)
+                continue;
+            if (next == NULL ||
+                av_compare_ts(tracks[i].frame.pts, tracks[i].time_base, next->frame.pts, next->time_base) < 0)
+                next = &tracks[i];
+        }
+        if (next == NULL)
+            break;
+
+        pkt.data = (uint8_t *)next->frame.data;
+        pkt.size = next->frame.size;
+        pkt.pts = next->frame.pts;
+        pkt.dts = next->frame.pts;
+        pkt.duration = next->frame.duration;
+        pkt.flags = next->frame.keyframe ? AV_PKT_FLAG_KEY : 0;
+
+        if (muxer_write_packet(muxer, next->index, &pkt, next->time_base) != 0) {
+            fprintf(stderr, "write packet failed\n");
+            goto fail;
+        }
+
+        next->frames++;
+        next->bytes += next->frame.size;
+        total += next->frame.size;
+
+        if (synth_next(next->synth, &next->frame) != 0)
+            goto fail;
+    }
+
+    if (muxer_close(muxer) != 0) {
+        fprintf(stderr, "close '%s' failed\n", output);
+        goto fail;
+    }
+
+    for (i = 0; i < nb_tracks; i++) {
+        fprintf(stderr, "track %d: %lld frames, %lld bytes, %.1f kbps\n", tracks[i].index,
+                (long long)tracks[i].frames, (long long)tracks[i].bytes, tracks[i].bytes * 8.0 / duration / 1000);
+    }
+    fprintf(stderr, "%s: %lld bytes in %.2fs\n", output, (long long)total, (av_gettime_relative() - start) / 1000000.0);
+
+    ret = 0;
+
+fail:
+    muxer_destroy(&muxer);
+    for (i = 0; i < nb_tracks; i++)
+        synth_destroy(&tracks[i].synth);
+
+    return ret;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = gen_media
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += gen_media.c
+
+include(media.pri)
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avutil.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/mem.h"
+
+#include "interleave.h"
+
+int interleave_init(interleave_t *q, int nb_streams, const AVRational *time_bases, int64_t max_delta_us, int64_t max_bytes)
+{
+    int i = 0;
+
+    if (q == NULL || nb_streams <= 0 || time_bases == NULL)
+        return -1;
+
+    memset(q, 0, sizeof(*q));
+
+    q->streams = av_mallocz_array(nb_streams, sizeof(interleave_stream_t));
+    if (q->streams == NULL)
+        return -2;
+
+    for (i = 0; i < nb_streams; i++)
+        q->streams[i].time_base = time_bases[i];
+
+    q->nb_streams = nb_streams;
+    q->max_delta_us = max_delta_us;
+    q->max_bytes = max_bytes;
+    q->max_dts_us = AV_NOPTS_VALUE;
+
+    return 0;
+}
+
+void interleave_uninit(interleave_t *q)
+{
+    interleave_node_t *node = NULL;
+    int i = 0;
+
+    if (q == NULL)
+        return;
+
+    for (i = 0; i < q->nb_streams; i++) {
+        while ((node = q->streams[i].head) != NULL) {
+            q->streams[i].head = node->next;
+            av_packet_unref(&node->pkt);
+            av_free(node);
+        }
+    }
+
+    while ((node = q->free_nodes) != NULL) {
+        q->free_nodes = node->next;
+        av_free(node);
+    }
+
+    av_freep(&q->streams);
+    q->nb_streams = 0;
+    q->bytes = 0;
+}
+
+int interleave_push(interleave_t *q, AVPacket *pkt)
+{
+    interleave_stream_t *st = NULL;
+    interleave_node_t *node = NULL;
+    int64_t ts = 0;
+
+    if (q == NULL || pkt == NULL || pkt->stream_index < 0 || pkt->stream_index >= q->nb_streams)
+        return -1;
+
+    if (av_packet_make_refcounted(pkt) < 0)
+        return -2;
+
+    //节点复用,避免每个packet都malloc
+    node = q->free_nodes;
+    if (node != NULL) {
+        q->free_nodes = node->next;
+    } else {
+        node = av_malloc(sizeof(interleave_node_t));
+        if (node == NULL)
+            return -2;
+    }
+
+    st = &q->streams[pkt->stream_index];
+
+    av_packet_move_ref(&node->pkt, pkt);
+    ts = (node->pkt.dts != AV_NOPTS_VALUE) ? node->pkt.dts : node->pkt.pts;
+    node->dts_us = av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q);
+    node->next = NULL;
+
+    if (st->tail != NULL)
+        st->tail->next = node;
+    else
+        st->head = node;
+    st->tail = node;
+    st->count++;
+
+    q->bytes += node->pkt.size;
+    if (q->max_dts_us == AV_NOPTS_VALUE || node->dts_us > q->max_dts_us)
+        q->max_dts_us = node->dts_us;
+
+    return 0;
+}
+
+int interleave_pop(interleave_t *q, AVPacket *pkt, int flush)
+{
+    interleave_stream_t *st = NULL;
+    interleave_node_t *node = NULL;
+    int i = 0, oldest = -1, waiting = 0;
+
+    if (q == NULL || pkt == NULL)
+        return 0;
+
+    for (i = 0; i < q->nb_streams; i++) {
+        if (q->streams[i].head == NULL) {
+            waiting = 1;
+            continue;
+        }
+        if (oldest < 0 || q->streams[i].head->dts_us < q->streams[oldest].head->dts_us)
+            oldest = i;
+    }
+
+    if (oldest < 0)
+        return 0;
+
+    st = &q->streams[oldest];
+    node = st->head;
+
+    //有流没有数据时要等,除非落后太多或者内存超出预算
+    if (waiting && !flush &&
+        q->bytes <= q->max_bytes &&
+        q->max_dts_us - node->dts_us <= q->max_delta_us)
+        return 0;
+
+    st->head = node->next;
+    if (st->head == NULL)
+        st->tail = NULL;
+    st->count--;
+
+    q->bytes -= node->pkt.size;
+
+    av_packet_move_ref(pkt, &node->pkt);
+
+    node->next = q->free_nodes;
+    q->free_nodes = node;
+
+    return 1;
+}
@@ -0,0 +1,77 @@
+#ifndef __INTERLEAVE_H
+#define __INTERLEAVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+typedef struct interleave_node {
+    AVPacket pkt;
+    int64_t dts_us;
+    struct interleave_node *next;
+} interleave_node_t;
+
+typedef struct interleave_stream {
+    interleave_node_t *head;
+    interleave_node_t *tail;
+    AVRational time_base;
+    int count;
+} interleave_stream_t;
+
+/**
+ * @brief muxer自己的交织队列,代替av_interleaved_write_frame内部无限增长的缓存
+ *   按dts从小到大输出,某一路流断了(比如摄像头音频掉线)时:
+ *   队列中最新的dts比最旧的超出max_delta_us,或者缓存超过max_bytes,
+ *   就不再等待这路流,直接输出最旧的packet
+ */
+typedef struct interleave {
+    int nb_streams;
+    interleave_stream_t *streams;
+    int64_t max_delta_us;
+    int64_t max_bytes;
+    int64_t bytes;
+    int64_t max_dts_us;
+    interleave_node_t *free_nodes;
+} interleave_t;
+
+/**
+ * @brief 初始化
+ *
+ * @param q: 队列
+ * @param nb_streams: 流个数
+ * @param time_bases: 每路流的时间基
+ * @param max_delta_us: 最多等待落后的流多久(微秒)
+ * @param max_bytes: 最多缓存多少字节
+ * @return int: 0成功 其他失败
+ */
+int interleave_init(interleave_t *q, int nb_streams, const AVRational *time_bases, int64_t max_delta_us, int64_t max_bytes);
+
+/**
+ * @brief 释放所有缓存的packet
+ */
+void interleave_uninit(interleave_t *q);
+
+/**
+ * @brief 放入一个packet,packet的数据会被move到队列中
+ *
+ * @return int: 0成功 其他失败
+ */
+int interleave_push(interleave_t *q, AVPacket *pkt);
+
+/**
+ * @brief 取出下一个可以写的packet
+ *
+ * @param pkt: 输出,使用完调用av_packet_unref
+ * @param flush: 1不等待其他流,用于关闭文件前清空队列
+ * @return int: 1取到 0需要等待更多数据
+ */
+int interleave_pop(interleave_t *q, AVPacket *pkt, int flush);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__INTERLEAVE_H
@@ -0,0 +1,673 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/crc.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+
+#include <log.h>
+
+#include "journal.h"
+#include "nal.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define fdatasync(fd)   _commit(fd)
+#define ftruncate(fd, size) _chsize_s(fd, size)
+#else
+#define O_BINARY        0
+#endif
+
+#define JOURNAL_MAGIC           MKTAG('M', 'U', 'X', 'J')
+#define JOURNAL_VERSION         2           //2:增加了extradata记录
+#define JOURNAL_RECORD_CONFIG   0x80        //记录里flags的这一位表示extradata记录
+#define JOURNAL_MAX_CONFIG      24
+#define JOURNAL_RECORD_SIZE     32
+#define JOURNAL_RECORD_BATCH    1024
+#define JOURNAL_MAX_STREAMS     32
+
+//日志之后的数据最多扫描多少
+#define JOURNAL_SCAN_MAX        (256 * 1024 * 1024LL)
+#define JOURNAL_SCAN_MAX_NAL    (16 * 1024 * 1024)
+
+struct journal {
+    int fd;
+    char *filename;
+    uint8_t *records;
+    int count;
+    int capacity;
+};
+
+typedef struct recover_io {
+    int fd;
+    int64_t pos;
+    int64_t size;
+    int passthrough;            //0只记录位置不写文件,写trailer时为1
+} recover_io_t;
+
+static int __journal_write(int fd, const uint8_t *buf, int size, int64_t offset)
+{
+    int done = 0;
+    ssize_t n = 0;
+
+    if (offset >= 0 && lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+
+    while (done < size) {
+        n = write(fd, buf + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+static int __journal_pread(int fd, uint8_t *buf, int size, int64_t offset)
+{
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+
+    return read(fd, buf, size) == size ? 0 : -1;
+}
+
+static uint16_t __journal_crc(const uint8_t *rec)
+{
+    return av_crc(av_crc_get_table(AV_CRC_16_ANSI), 0, rec, JOURNAL_RECORD_SIZE - 2);
+}
+
+journal_t *journal_create(const char *filename, AVFormatContext *oc, const char *options)
+{
+    journal_t *journal = NULL;
+    AVIOContext *pb = NULL;
+    AVCodecParameters *par = NULL;
+    uint8_t *header = NULL;
+    int size = 0, len = 0;
+    unsigned int i = 0;
+
+    if (filename == NULL || oc == NULL || oc->pb == NULL || oc->nb_streams > JOURNAL_MAX_STREAMS)
+        return NULL;
+
+    journal = (journal_t *)calloc(1, sizeof(journal_t));
+    if (journal == NULL)
+        return NULL;
+
+    journal->fd = -1;
+
+    journal->filename = strdup(filename);
+    if (journal->filename == NULL)
+        goto fail;
+
+    if (avio_open_dyn_buf(&pb) < 0)
+        goto fail;
+
+    len = options != NULL ? (int)strlen(options) : 0;
+
+    avio_wl32(pb, JOURNAL_MAGIC);
+    avio_wl32(pb, JOURNAL_VERSION);
+    avio_wl64(pb, avio_tell(oc->pb));
+    avio_wl32(pb, len);
+    avio_write(pb, (const unsigned char *)options, len);
+    avio_wl32(pb, oc->nb_streams);
+
+    for (i = 0; i < oc->nb_streams; i++) {
+        par = oc->streams[i]->codecpar;
+        avio_wl32(pb, par->codec_type);
+        avio_wl32(pb, par->codec_id);
+        avio_wl32(pb, par->codec_tag);
+        avio_wl32(pb, oc->streams[i]->time_base.num);
+        avio_wl32(pb, oc->streams[i]->time_base.den);
+        avio_wl32(pb, par->format);
+        avio_wl64(pb, par->bit_rate);
+        avio_wl32(pb, par->profile);
+        avio_wl32(pb, par->level);
+        avio_wl32(pb, par->width);
+        avio_wl32(pb, par->height);
+        avio_wl32(pb, par->sample_rate);
+        avio_wl32(pb, par->channels);
+        avio_wl64(pb, par->channel_layout);
+        avio_wl32(pb, par->frame_size);
+        avio_wl32(pb, par->extradata_size);
+        avio_write(pb, par->extradata, par->extradata_size);
+    }
+
+    size = avio_close_dyn_buf(pb, &header);
+    if (header == NULL)
+        goto fail;
+
+    journal->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (journal->fd < 0) {
+        LOG("open journal '%s' failed: %s\n", filename, strerror(errno));
+        goto fail;
+    }
+
+    if (__journal_write(journal->fd, header, size, -1) != size)
+        goto fail;
+
+    av_free(header);
+
+    return journal;
+
+fail:
+    av_free(header);
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        unlink(filename);
+    }
+    free(journal->filename);
+    free(journal);
+
+    return NULL;
+}
+
+void journal_close(journal_t **journal, int remove)
+{
+    if (journal == NULL || *journal == NULL)
+        return;
+
+    if ((*journal)->fd >= 0)
+        close((*journal)->fd);
+
+    if (remove)
+        unlink((*journal)->filename);
+
+    av_free((*journal)->records);
+    free((*journal)->filename);
+    free(*journal);
+    *journal = NULL;
+}
+
+static uint8_t *__journal_next_record(journal_t *journal)
+{
+    void *records = NULL;
+
+    if (journal->count == journal->capacity) {
+        records = av_realloc_array(journal->records, journal->capacity + JOURNAL_RECORD_BATCH, JOURNAL_RECORD_SIZE);
+        if (records == NULL)
+            return NULL;
+        journal->records = records;
+        journal->capacity += JOURNAL_RECORD_BATCH;
+    }
+
+    return journal->records + journal->count * JOURNAL_RECORD_SIZE;
+}
+
+int journal_add(journal_t *journal, int stream_index, int64_t offset, int size,
+                int64_t dts, int64_t pts, int64_t duration, int flags)
+{
+    uint8_t *rec = NULL;
+
+    if (journal == NULL || stream_index < 0 || stream_index >= JOURNAL_MAX_STREAMS)
+        return -1;
+
+    rec = __journal_next_record(journal);
+    if (rec == NULL)
+        return -2;
+
+    AV_WL64(rec, offset);
+    AV_WL64(rec + 8, dts);
+    AV_WL32(rec + 16, size);
+    AV_WL32(rec + 20, (int32_t)(pts - dts));
+    AV_WL32(rec + 24, (uint32_t)duration);
+    rec[28] = stream_index;
+    rec[29] = flags & AV_PKT_FLAG_KEY;
+    AV_WL16(rec + 30, __journal_crc(rec));
+
+    journal->count++;
+
+    return 0;
+}
+
+int journal_set_extradata(journal_t *journal, int stream_index, const uint8_t *extradata, int size)
+{
+    uint8_t *rec = NULL;
+
+    if (journal == NULL || stream_index < 0 || stream_index >= JOURNAL_MAX_STREAMS ||
+        extradata == NULL || size <= 0 || size > JOURNAL_MAX_CONFIG)
+        return -1;
+
+    rec = __journal_next_record(journal);
+    if (rec == NULL)
+        return -2;
+
+    //数据放在样本记录的位置,记录保持定长
+    memset(rec, 0, JOURNAL_RECORD_SIZE);
+    memcpy(rec, extradata, size);
+    AV_WL32(rec + 24, size);
+    rec[28] = stream_index;
+    rec[29] = JOURNAL_RECORD_CONFIG;
+    AV_WL16(rec + 30, __journal_crc(rec));
+
+    journal->count++;
+
+    return 0;
+}
+
+int journal_flush(journal_t *journal, int sync)
+{
+    int size = 0;
+
+    if (journal == NULL || journal->fd < 0)
+        return -1;
+
+    size = journal->count * JOURNAL_RECORD_SIZE;
+
+    if (size > 0 && __journal_write(journal->fd, journal->records, size, -1) != size) {
+        LOG("write journal '%s' failed: %s\n", journal->filename, strerror(errno));
+        return -2;
+    }
+
+    journal->count = 0;
+
+    if (sync && fdatasync(journal->fd) != 0)
+        return -3;
+
+    return 0;
+}
+
+static int __recover_write_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    recover_io_t *io = (recover_io_t *)opaque;
+
+    if (io->passthrough && __journal_write(io->fd, buf, buf_size, io->pos) != buf_size)
+        return AVERROR(errno);
+
+    io->pos += buf_size;
+    if (io->pos > io->size)
+        io->size = io->pos;
+
+    return buf_size;
+}
+
+static int64_t __recover_seek(void *opaque, int64_t offset, int whence)
+{
+    recover_io_t *io = (recover_io_t *)opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return io->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += io->pos;
+        break;
+    case SEEK_END:
+        offset += io->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    io->pos = offset;
+
+    return offset;
+}
+
+static int __recover_read_header(AVIOContext *pb, AVFormatContext *oc, int64_t *data_offset, AVDictionary **options)
+{
+    AVStream *st = NULL;
+    AVCodecParameters *par = NULL;
+    char *str = NULL;
+    int len = 0, nb_streams = 0, i = 0;
+
+    if (avio_rl32(pb) != JOURNAL_MAGIC)
+        return -1;
+
+    len = avio_rl32(pb);
+    if (len < 1 || len > JOURNAL_VERSION)
+        return -1;
+
+    *data_offset = avio_rl64(pb);
+
+    len = avio_rl32(pb);
+    if (len < 0 || len > 4096)
+        return -1;
+
+    if (len > 0) {
+        str = av_mallocz(len + 1);
+        if (str == NULL || avio_read(pb, (unsigned char *)str, len) != len) {
+            av_free(str);
+            return -1;
+        }
+        av_dict_parse_string(options, str, "=", ":", 0);
+        av_free(str);
+    }
+
+    nb_streams = avio_rl32(pb);
+    if (nb_streams <= 0 || nb_streams > JOURNAL_MAX_STREAMS)
+        return -1;
+
+    for (i = 0; i < nb_streams; i++) {
+        st = avformat_new_stream(oc, NULL);
+        if (st == NULL)
+            return -1;
+
+        par = st->codecpar;
+        par->codec_type = avio_rl32(pb);
+        par->codec_id = avio_rl32(pb);
+        par->codec_tag = avio_rl32(pb);
+        st->time_base.num = avio_rl32(pb);
+        st->time_base.den = avio_rl32(pb);
+        par->format = avio_rl32(pb);
+        par->bit_rate = avio_rl64(pb);
+        par->profile = avio_rl32(pb);
+        par->level = avio_rl32(pb);
+        par->width = avio_rl32(pb);
+        par->height = avio_rl32(pb);
+        par->sample_rate = avio_rl32(pb);
+        par->channels = avio_rl32(pb);
+        par->channel_layout = avio_rl64(pb);
+        par->frame_size = avio_rl32(pb);
+
+        len = avio_rl32(pb);
+        if (len < 0 || len > 1024 * 1024)
+            return -1;
+
+        if (len > 0) {
+            par->extradata = av_mallocz(len + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (par->extradata == NULL)
+                return -1;
+            par->extradata_size = len;
+            if (avio_read(pb, par->extradata, len) != len)
+                return -1;
+        }
+    }
+
+    return avio_feof(pb) ? -1 : 0;
+}
+
+/**
+ * 在写头之前找出所有extradata记录,mov只在写头时拷贝extradata,
+ * 比如ADTS的AAC,AudioSpecificConfig在第一个音频包之后才有
+ */
+static int __recover_read_config(AVIOContext *pb, AVFormatContext *oc)
+{
+    AVCodecParameters *par = NULL;
+    uint8_t rec[JOURNAL_RECORD_SIZE];
+    int64_t pos = avio_tell(pb);
+    int size = 0;
+
+    while (avio_read(pb, rec, sizeof(rec)) == sizeof(rec)) {
+        if (AV_RL16(rec + 30) != __journal_crc(rec))
+            break;
+        if (!(rec[29] & JOURNAL_RECORD_CONFIG) || rec[28] >= oc->nb_streams)
+            continue;
+
+        size = AV_RL32(rec + 24);
+        par = oc->streams[rec[28]]->codecpar;
+        if (size <= 0 || size > JOURNAL_MAX_CONFIG || par->extradata_size > 0)
+            continue;
+
+        par->extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (par->extradata == NULL)
+            return -1;
+        memcpy(par->extradata, rec, size);
+        par->extradata_size = size;
+    }
+
+    return avio_seek(pb, pos, SEEK_SET) == pos ? 0 : -1;
+}
+
+static int __recover_write_sample(AVFormatContext *oc, uint8_t **zero, unsigned int *zero_size,
+                                  int stream_index, int size, int64_t dts, int64_t pts, int64_t duration, int flags)
+{
+    AVPacket pkt;
+
+    //mov只记录样本的位置和大小,数据用0代替,不需要读原文件
+    av_fast_padded_mallocz(zero, zero_size, size);
+    if (*zero == NULL)
+        return AVERROR(ENOMEM);
+
+    av_init_packet(&pkt);
+    pkt.data = *zero;
+    pkt.size = size;
+    pkt.stream_index = stream_index;
+    pkt.dts = dts;
+    pkt.pts = pts;
+    pkt.duration = duration;
+    pkt.flags = flags;
+
+    return av_write_frame(oc, &pkt);
+}
+
+/**
+ * 日志之后的视频数据: 按4字节长度前缀扫描NAL,组成完整的帧
+ * 最后一帧可能不完整,不恢复
+ */
+static int64_t __recover_scan_tail(AVFormatContext *oc, recover_io_t *io, int64_t file_size,
+                                   uint8_t **zero, unsigned int *zero_size,
+                                   int video, int64_t dts, int64_t duration)
+{
+    enum AVCodecID codec_id = oc->streams[video]->codecpar->codec_id;
+    int hevc = codec_id == AV_CODEC_ID_HEVC;
+    int64_t pos = io->pos, au_start = io->pos, end = 0, count = 0;
+    uint8_t hdr[7];
+    uint32_t len = 0;
+    int type = 0, vcl = 0, first = 0, au_vcl = 0, au_key = 0;
+
+    if (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC)
+        return 0;
+
+    if (duration <= 0)
+        duration = 1;
+
+    end = file_size;
+    if (end - pos > JOURNAL_SCAN_MAX)
+        end = pos + JOURNAL_SCAN_MAX;
+
+    while (pos + (int64_t)sizeof(hdr) <= end) {
+        if (__journal_pread(io->fd, hdr, sizeof(hdr), pos) != 0)
+            break;
+
+        len = AV_RB32(hdr);
+        if (len < (unsigned)(hevc ? 3 : 2) || len > JOURNAL_SCAN_MAX_NAL || pos + 4 + len > end)
+            break;
+
+        //forbidden_zero_bit, hevc的nuh_layer_id和temporal_id
+        if (hdr[4] & 0x80)
+            break;
+
+        type = nal_type(codec_id, hdr + 4);
+        if (hevc) {
+            if (type > 40 || (hdr[4] & 0x01) || (hdr[5] >> 3) != 0 || (hdr[5] & 0x07) == 0)
+                break;
+            vcl = type < 32;
+            first = vcl && (hdr[6] & 0x80);
+        } else {
+            if (type == 0 || type > 20)
+                break;
+            vcl = type >= NAL_H264_SLICE && type <= NAL_H264_IDR;
+            first = vcl && (hdr[5] & 0x80);
+        }
+
+        //新的一帧开始,前一帧完整
+        if (au_vcl && (!vcl || first)) {
+            if (__recover_write_sample(oc, zero, zero_size, video, (int)(pos - au_start),
+                                       dts, dts, duration, au_key ? AV_PKT_FLAG_KEY : 0) < 0)
+                break;
+            dts += duration;
+            count++;
+            au_start = pos;
+            au_vcl = 0;
+            au_key = 0;
+        }
+
+        au_vcl |= vcl;
+        if (hevc)
+            au_key |= type >= NAL_HEVC_BLA_W_LP && type <= NAL_HEVC_CRA;
+        else
+            au_key |= type == NAL_H264_IDR;
+
+        pos += 4 + len;
+    }
+
+    return count;
+}
+
+int64_t journal_recover(const char *filename, const char *journal_name)
+{
+    AVFormatContext *oc = NULL;
+    AVIOContext *jpb = NULL;
+    AVDictionary *options = NULL;
+    recover_io_t io = {.fd = -1};
+    uint8_t *zero = NULL, *buffer = NULL;
+    unsigned int zero_size = 0;
+    uint8_t rec[JOURNAL_RECORD_SIZE];
+    char *name = NULL;
+    int64_t data_offset = 0, count = 0, ret = -1, offset = 0, dts = 0;
+    int64_t last_dts = AV_NOPTS_VALUE, last_duration = 0;
+    int video = -1, stream_index = 0, size = 0;
+    unsigned int i = 0;
+    struct stat st;
+
+    if (filename == NULL)
+        return -1;
+
+    if (journal_name == NULL) {
+        name = av_asprintf("%s%s", filename, JOURNAL_SUFFIX);
+        if (name == NULL)
+            return -1;
+        journal_name = name;
+    }
+
+    if (avio_open(&jpb, journal_name, AVIO_FLAG_READ) < 0) {
+        LOG("open journal '%s' failed\n", journal_name);
+        ret = -2;
+        goto fail;
+    }
+
+    io.fd = open(filename, O_RDWR | O_BINARY);
+    if (io.fd < 0 || fstat(io.fd, &st) != 0) {
+        LOG("open '%s' failed: %s\n", filename, strerror(errno));
+        ret = -2;
+        goto fail;
+    }
+
+    if (avformat_alloc_output_context2(&oc, NULL, "mp4", filename) < 0 || oc == NULL) {
+        ret = -2;
+        goto fail;
+    }
+
+    if (__recover_read_header(jpb, oc, &data_offset, &options) != 0 ||
+        __recover_read_config(jpb, oc) != 0) {
+        LOG("journal '%s' header corrupted\n", journal_name);
+        ret = -3;
+        goto fail;
+    }
+
+    buffer = av_malloc(32 * 1024);
+    if (buffer == NULL)
+        goto fail;
+
+    oc->pb = avio_alloc_context(buffer, 32 * 1024, 1, &io, NULL, __recover_write_packet, __recover_seek);
+    if (oc->pb == NULL) {
+        av_free(buffer);
+        goto fail;
+    }
+
+    //头和原来的一样,只计算位置
+    if (avformat_write_header(oc, &options) < 0 || avio_tell(oc->pb) != data_offset) {
+        LOG("journal '%s' does not match the muxer\n", journal_name);
+        ret = -3;
+        goto fail;
+    }
+
+    //恢复出来的moov可能超出预留空间,写在文件末尾,预留的区域muxer已经写成了free box
+    av_opt_set_int(oc->priv_data, "moov_size", 0, 0);
+
+    for (i = 0; i < oc->nb_streams; i++) {
+        if (oc->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video = i;
+            break;
+        }
+    }
+
+    //最后一条记录可能只写了一半,或者数据还没有落盘
+    while (avio_read(jpb, rec, sizeof(rec)) == sizeof(rec)) {
+        if (AV_RL16(rec + 30) != __journal_crc(rec))
+            break;
+
+        //extradata在写头之前已经处理
+        if (rec[29] & JOURNAL_RECORD_CONFIG)
+            continue;
+
+        offset = AV_RL64(rec);
+        dts = AV_RL64(rec + 8);
+        size = AV_RL32(rec + 16);
+        stream_index = rec[28];
+
+        if (stream_index >= (int)oc->nb_streams || size <= 0 ||
+            offset != avio_tell(oc->pb) || offset + size > st.st_size)
+            break;
+
+        if (__recover_write_sample(oc, &zero, &zero_size, stream_index, size,
+                                   dts, dts + (int32_t)AV_RL32(rec + 20), AV_RL32(rec + 24), rec[29]) < 0)
+            break;
+
+        if (stream_index == video) {
+            if (AV_RL32(rec + 24) > 0)
+                last_duration = AV_RL32(rec + 24);
+            else if (last_dts != AV_NOPTS_VALUE && dts > last_dts)
+                last_duration = dts - last_dts;
+            last_dts = dts;
+        }
+
+        count++;
+    }
+
+    if (video >= 0 && last_dts != AV_NOPTS_VALUE) {
+        avio_flush(oc->pb);
+        count += __recover_scan_tail(oc, &io, st.st_size, &zero, &zero_size,
+                                     video, last_dts + last_duration, last_duration);
+    }
+
+    //写moov,修正mdat大小
+    avio_flush(oc->pb);
+    io.passthrough = 1;
+
+    if (av_write_trailer(oc) < 0) {
+        ret = -4;
+        goto fail;
+    }
+
+    avio_flush(oc->pb);
+    if (oc->pb->error < 0 || ftruncate(io.fd, io.size) != 0 || fdatasync(io.fd) != 0) {
+        ret = -4;
+        goto fail;
+    }
+
+    unlink(journal_name);
+
+    ret = count;
+
+fail:
+    if (oc != NULL) {
+        if (oc->pb != NULL) {
+            av_freep(&oc->pb->buffer);
+            avio_context_free(&oc->pb);
+        }
+        avformat_free_context(oc);
+    }
+    if (io.fd >= 0)
+        close(io.fd);
+    avio_closep(&jpb);
+    av_dict_free(&options);
+    av_free(zero);
+    av_free(name);
+
+    return ret;
+}
@@ -0,0 +1,96 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct AVFormatContext;
+
+/**
+ * @brief mp4写入过程中的样本表日志,程序崩溃没有写trailer时用来重建moov
+ *   日志文件: 头(流参数,write_header的选项,mdat数据开始位置) + 每个样本32字节的记录
+ *   写头时还没有的extradata(ADTS的AAC)之后用32字节的extradata记录补上
+ *   记录在内存中攒着,journal_flush时一次追加到文件
+ */
+typedef struct journal journal_t;
+
+#define JOURNAL_SUFFIX ".journal"
+
+/**
+ * @brief 创建日志文件并写入头,在avformat_write_header之后调用
+ *
+ * @param filename: 日志文件名字,一般是mp4文件名+JOURNAL_SUFFIX
+ * @param oc: 已经写完头的输出
+ * @param options: 传给avformat_write_header的选项(av_dict_get_string格式),可以为NULL
+ * @return journal_t*: NULL失败
+ */
+journal_t *journal_create(const char *filename, struct AVFormatContext *oc, const char *options);
+
+/**
+ * @brief 关闭日志
+ *
+ * @param journal: journal_create返回值
+ * @param remove: 1删除日志文件(mp4已经正常关闭)
+ */
+void journal_close(journal_t **journal, int remove);
+
+/**
+ * @brief 记录一个样本
+ *
+ * @param journal: journal_create返回值
+ * @param stream_index: 流序号
+ * @param offset: 样本在文件中的位置
+ * @param size: 样本大小
+ * @param dts: 解码时间戳,流的time_base
+ * @param pts: 显示时间戳,流的time_base
+ * @param duration: 时长,流的time_base
+ * @param flags: AV_PKT_FLAG_*
+ * @return int: 0成功 其他失败
+ */
+int journal_add(journal_t *journal, int stream_index, int64_t offset, int size,
+                int64_t dts, int64_t pts, int64_t duration, int flags);
+
+/**
+ * @brief 记录写头之后才确定的extradata,恢复时用于写头之前没有extradata的流
+ *
+ * @param journal: journal_create返回值
+ * @param stream_index: 流序号
+ * @param extradata: 比如AAC的AudioSpecificConfig
+ * @param size: 不超过24字节
+ * @return int: 0成功 其他失败
+ */
+int journal_set_extradata(journal_t *journal, int stream_index, const uint8_t *extradata, int size);
+
+/**
+ * @brief 把内存中的记录追加到日志文件
+ *
+ * @param journal: journal_create返回值
+ * @param sync: 1写完后fdatasync
+ * @return int: 0成功 其他失败
+ */
+int journal_flush(journal_t *journal, int sync);
+
+/**
+ * @brief 用日志重建崩溃的mp4文件的moov
+ *   不读取样本数据,只用日志记录重放mov muxer生成moov,
+ *   日志之后没有记录的视频数据按NAL长度扫描恢复,遇到无法识别的数据停止,
+ *   成功后截掉文件末尾不完整的数据并删除日志
+ *
+ * @param filename: mp4文件名字
+ * @param journal_name: 日志文件名字,NULL使用filename+JOURNAL_SUFFIX
+ * @return int64_t: >=0恢复的样本个数 其他失败
+ *              -1:参数错误
+ *              -2:打开文件失败
+ *              -3:日志格式错误
+ *              -4:写入失败
+ */
+int64_t journal_recover(const char *filename, const char *journal_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__JOURNAL_H
@@ -6,7 +6,8 @@
 #include <time.h>
 
 //#define LOG(format, args...) KHJUtilLog(__FILE__, __FUNCTION__, __LINE__, format, ## args)
-#define LOG(format, args...)
+//关闭时参数不求值,但仍然检查格式,if/else的分支里可以直接用
+#define LOG(format, args...) do { if (0) printf(format, ## args); } while (0)
 
 static inline const char *getFileName(const char *file)
 {
@@ -16,6 +17,7 @@ static inline const char *getFileName(const char *file)
 
 static inline void KHJUtilLog(const char *file, const char *tag, int line, const char *fmt, ...)
 {
+    (void)file; (void)tag; (void)line; (void)fmt;
 //    char buffer_fmt[1024] = {0};
 //    struct timespec spec;
 //    struct tm ptm;
@@ -13,24 +13,23 @@
 
 #include "demux.h"
 #include "mux.h"
+#include "pipeline.h"
 
-
-static int quit = 0;
+static pipeline_t *pipeline = NULL;
 
 static void sighandler(int sig)
 {
-    quit = 1;
+    (void)sig;
+    pipeline_stop(pipeline);
     printf("quit\n");
 }
 
 int main(void)
 {
 	demuxer_t *demuxer = NULL;
-	void *data = NULL;
-	int len = 0, is_video = 0, is_key = 0, total = 0, cur = 0;
+	pipeline_stats_t stats;
 	int ret = -1;
 	muxer_t *muxer = NULL;
-	int add_video = 0;
 
     signal(SIGINT, sighandler);
 
@@ -61,36 +60,28 @@ int main(void)
 		return -1;
 	}
 
-	printf("total duration: %lld\n", demuxer_get_duration("ok.mp4"));
+	printf("total duration: %lld\n", (long long)demuxer_get_duration("ok.mp4"));
 
 	printf("open ok\n");
 
 	printf("seek result:%d\n",demuxer_seek(demuxer,60000));
 
-    for ( ;!quit ; ) {
-		ret = demuxer_read(demuxer, &data, &len, &is_video, &is_key, &total, &cur);
-		if (ret >= 0) {
-			if (add_video == 0) {
-				if(is_video && is_key) {
-					muxer_add_video_and_audio(muxer, MUXER_CODEC_H265, 640, 720, data, len);
-					add_video = 1;
-				} else
-					continue;
-			}
-			//printf("%s : size=%d,%d,%d\n", is_video ? "video" : "audio", len, total, cur);
-			if (is_video)
-				muxer_write_video(muxer, data, len, is_key, cur);
-            else{
-                muxer_write_audio(muxer, data, len, cur);
-            }
-				
-		} else {
-			printf("demxuer read faild: %d\n", ret);
-			break;
-		}
-
+	pipeline = pipeline_create(demuxer, muxer, 0);
+	if (pipeline == NULL) {
+		printf("pipeline create failed\n");
+		muxer_destroy(&muxer);
+		demuxer_destroy(&demuxer);
+		return -1;
 	}
 
+	ret = pipeline_run(pipeline, &stats);
+	if (ret != 0)
+		printf("pipeline run failed: %d\n", ret);
+	else
+		pipeline_print_stats(&stats, stdout);
+
+	pipeline_destroy(&pipeline);
+
 	demuxer_close(demuxer);
 	muxer_close(muxer);
 	muxer_destroy(&muxer);
@@ -0,0 +1,101 @@
+# 库的源文件,ffmpeg依赖和编译选项,所有.pro都include这个文件
+#
+# 编译选项(qmake CONFIG+=...):
+#   release         -O2 -DNDEBUG
+#   ltcg            链接时优化(gcc -flto / msvc /GL)
+#   native          针对本机cpu优化(-march=native),生成的程序不能拷贝到其他机器
+#   pgo_generate    插桩编译,运行后在目标文件目录生成.gcda
+#   pgo_use         用.gcda优化编译,见pgo_build.sh
+#   alloc_trace     统计demuxer/muxer的内存分配(替换malloc,只支持glibc),见alloc_trace.h
+#   trace           记录接口调用,流水线各阶段和锁等待的耗时,输出chrome trace,见trace.h
+
+SOURCES += \
+    alloc_trace.c \
+    archive_index.c \
+    concat.c \
+    demux.c \
+    interleave.c \
+    journal.c \
+    metrics.c \
+    mux.c \
+    mux_io.c \
+    mux_manager.c \
+    mux_ts.c \
+    nal.c \
+    pipeline.c \
+    playlist.c \
+    spsc_queue.c \
+    sync_group.c \
+    synth.c \
+    tee.c \
+    trace.c
+
+HEADERS += \
+    alloc_trace.h \
+    archive_index.h \
+    concat.h \
+    demux.h \
+    interleave.h \
+    journal.h \
+    log.h \
+    metrics.h \
+    mux.h \
+    mux_io.h \
+    mux_manager.h \
+    mux_ts.h \
+    nal.h \
+    pipeline.h \
+    playlist.h \
+    spsc_queue.h \
+    sync_group.h \
+    synth.h \
+    tee.h \
+    trace.h
+
+INCLUDEPATH += $$PWD
+
+win32 {
+INCLUDEPATH += $$PWD/ffmpeg-4.2.1-win32-dev/include
+LIBS += $$PWD/ffmpeg-4.2.1-win32-dev/lib/avformat.lib   \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avcodec.lib    \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avdevice.lib   \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avfilter.lib   \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/avutil.lib     \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/postproc.lib   \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swresample.lib \
+        $$PWD/ffmpeg-4.2.1-win32-dev/lib/swscale.lib
+}
+
+# 使用系统的ffmpeg(libavformat-dev等),版本>=4.2
+unix {
+CONFIG += link_pkgconfig
+PKGCONFIG += libavformat libavcodec libavutil
+QMAKE_CFLAGS += -std=gnu11 -D_GNU_SOURCE
+LIBS += -lpthread
+}
+
+CONFIG(release, debug|release) {
+DEFINES += NDEBUG
+}
+
+alloc_trace {
+DEFINES += ALLOC_TRACE
+}
+
+trace {
+DEFINES += TRACE_EVENTS
+}
+
+native:!win32 {
+QMAKE_CFLAGS += -march=native
+}
+
+pgo_generate:!win32 {
+QMAKE_CFLAGS += -fprofile-generate -fprofile-update=atomic
+QMAKE_LFLAGS += -fprofile-generate
+}
+
+pgo_use:!win32 {
+QMAKE_CFLAGS += -fprofile-use -fprofile-correction -Wno-missing-profile -Wno-error=coverage-mismatch
+QMAKE_LFLAGS += -fprofile-use
+}
@@ -0,0 +1,552 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "libavutil/avutil.h"
+#include "libavutil/bprint.h"
+#include "libavutil/mem.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "metrics.h"
+
+#define METRICS_FILE_SIZE       256
+#define METRICS_BUCKETS         14
+
+//写入耗时直方图的上界(微秒),最后还有一个+Inf
+static const int64_t write_bounds[METRICS_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+};
+
+static const char *media_names[METRICS_MEDIA_MAX] = { "video", "audio", "other" };
+static const char *kind_names[METRICS_KIND_MAX] = { "demuxer", "muxer" };
+
+struct metrics_source {
+    struct metrics_source *prev;
+    struct metrics_source *next;
+    int kind;
+    int64_t id;
+    char file[METRICS_FILE_SIZE];       //由registry.mutex保护
+
+    atomic_llong packets[METRICS_MEDIA_MAX];
+    atomic_llong bytes[METRICS_MEDIA_MAX];
+    atomic_llong errors;
+    atomic_llong drops;
+    atomic_llong seeks;
+    atomic_llong queue_packets;
+    atomic_llong queue_bytes;
+
+    atomic_llong write_buckets[METRICS_BUCKETS + 1];
+    atomic_llong write_sum_us;
+    atomic_llong write_count;
+};
+
+/**
+ * 一个计数器类的指标,offset是metrics_source中原子变量的位置,
+ * per_media时是METRICS_MEDIA_MAX个元素的数组
+ */
+typedef struct metrics_desc {
+    int kind;
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t offset;
+    int per_media;
+} metrics_desc_t;
+
+static const metrics_desc_t descs[] = {
+    { METRICS_KIND_DEMUXER, "media_demuxer_packets_total", "counter", "Packets returned by the demuxer.",
+      offsetof(metrics_source_t, packets), 1 },
+    { METRICS_KIND_DEMUXER, "media_demuxer_bytes_total", "counter", "Payload bytes returned by the demuxer.",
+      offsetof(metrics_source_t, bytes), 1 },
+    { METRICS_KIND_DEMUXER, "media_demuxer_seeks_total", "counter", "Successful seeks.",
+      offsetof(metrics_source_t, seeks), 0 },
+    { METRICS_KIND_DEMUXER, "media_demuxer_errors_total", "counter", "Failed reads and seeks, end of file excluded.",
+      offsetof(metrics_source_t, errors), 0 },
+    { METRICS_KIND_MUXER, "media_muxer_packets_total", "counter", "Packets written to the output.",
+      offsetof(metrics_source_t, packets), 1 },
+    { METRICS_KIND_MUXER, "media_muxer_bytes_total", "counter", "Payload bytes written to the output.",
+      offsetof(metrics_source_t, bytes), 1 },
+    { METRICS_KIND_MUXER, "media_muxer_dropped_packets_total", "counter", "Packets rejected before reaching the interleave queue.",
+      offsetof(metrics_source_t, drops), 0 },
+    { METRICS_KIND_MUXER, "media_muxer_errors_total", "counter", "Failed packet writes.",
+      offsetof(metrics_source_t, errors), 0 },
+    { METRICS_KIND_MUXER, "media_muxer_queue_packets", "gauge", "Packets waiting in the interleave queue.",
+      offsetof(metrics_source_t, queue_packets), 0 },
+    { METRICS_KIND_MUXER, "media_muxer_queue_bytes", "gauge", "Bytes waiting in the interleave queue.",
+      offsetof(metrics_source_t, queue_bytes), 0 },
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    metrics_source_t *head;
+    int64_t next_id;
+    int count[METRICS_KIND_MAX];
+} registry = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+metrics_source_t *metrics_register(int kind)
+{
+    metrics_source_t *src = NULL;
+
+    if (kind < 0 || kind >= METRICS_KIND_MAX)
+        return NULL;
+
+    src = calloc(1, sizeof(metrics_source_t));
+    if (src == NULL)
+        return NULL;
+
+    src->kind = kind;
+
+    pthread_mutex_lock(&registry.mutex);
+    src->id = ++registry.next_id;
+    src->next = registry.head;
+    if (registry.head != NULL)
+        registry.head->prev = src;
+    registry.head = src;
+    registry.count[kind]++;
+    pthread_mutex_unlock(&registry.mutex);
+
+    return src;
+}
+
+void metrics_unregister(metrics_source_t **src)
+{
+    metrics_source_t *s = NULL;
+
+    if (src == NULL || *src == NULL)
+        return;
+
+    s = *src;
+
+    pthread_mutex_lock(&registry.mutex);
+    if (s->prev != NULL)
+        s->prev->next = s->next;
+    else
+        registry.head = s->next;
+    if (s->next != NULL)
+        s->next->prev = s->prev;
+    registry.count[s->kind]--;
+    pthread_mutex_unlock(&registry.mutex);
+
+    free(s);
+    *src = NULL;
+}
+
+void metrics_set_file(metrics_source_t *src, const char *filename)
+{
+    if (src == NULL)
+        return;
+
+    pthread_mutex_lock(&registry.mutex);
+    snprintf(src->file, sizeof(src->file), "%s", filename != NULL ? filename : "");
+    pthread_mutex_unlock(&registry.mutex);
+}
+
+int metrics_media_type(int codec_type)
+{
+    if (codec_type == AVMEDIA_TYPE_VIDEO)
+        return METRICS_MEDIA_VIDEO;
+    if (codec_type == AVMEDIA_TYPE_AUDIO)
+        return METRICS_MEDIA_AUDIO;
+
+    return METRICS_MEDIA_OTHER;
+}
+
+void metrics_add_packet(metrics_source_t *src, int media, int64_t bytes)
+{
+    if (src == NULL)
+        return;
+
+    if (media < 0 || media >= METRICS_MEDIA_MAX)
+        media = METRICS_MEDIA_OTHER;
+
+    atomic_fetch_add_explicit(&src->packets[media], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&src->bytes[media], bytes, memory_order_relaxed);
+}
+
+void metrics_add_error(metrics_source_t *src)
+{
+    if (src != NULL)
+        atomic_fetch_add_explicit(&src->errors, 1, memory_order_relaxed);
+}
+
+void metrics_add_drop(metrics_source_t *src)
+{
+    if (src != NULL)
+        atomic_fetch_add_explicit(&src->drops, 1, memory_order_relaxed);
+}
+
+void metrics_add_seek(metrics_source_t *src)
+{
+    if (src != NULL)
+        atomic_fetch_add_explicit(&src->seeks, 1, memory_order_relaxed);
+}
+
+void metrics_observe_write(metrics_source_t *src, int64_t us)
+{
+    int i = 0;
+
+    if (src == NULL)
+        return;
+
+    while (i < METRICS_BUCKETS && us > write_bounds[i])
+        i++;
+
+    atomic_fetch_add_explicit(&src->write_buckets[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&src->write_sum_us, us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&src->write_count, 1, memory_order_relaxed);
+}
+
+void metrics_set_queue(metrics_source_t *src, int64_t packets, int64_t bytes)
+{
+    if (src == NULL)
+        return;
+
+    atomic_store_explicit(&src->queue_packets, packets, memory_order_relaxed);
+    atomic_store_explicit(&src->queue_bytes, bytes, memory_order_relaxed);
+}
+
+//标签值中的\ " 换行需要转义
+static void __metrics_labels(AVBPrint *bp, const metrics_source_t *src)
+{
+    const char *p = NULL;
+
+    av_bprintf(bp, "id=\"%lld\",file=\"", (long long)src->id);
+    for (p = src->file; *p != '\0'; p++) {
+        if (*p == '\\' || *p == '"')
+            av_bprintf(bp, "\\%c", *p);
+        else if (*p == '\n')
+            av_bprintf(bp, "\\n");
+        else
+            av_bprint_chars(bp, *p, 1);
+    }
+    av_bprintf(bp, "\"");
+}
+
+static void __metrics_render_desc(AVBPrint *bp, const metrics_desc_t *d)
+{
+    const metrics_source_t *src = NULL;
+    const atomic_llong *v = NULL;
+    int m = 0;
+
+    av_bprintf(bp, "# HELP %s %s\n# TYPE %s %s\n", d->name, d->help, d->name, d->type);
+
+    for (src = registry.head; src != NULL; src = src->next) {
+        if (src->kind != d->kind)
+            continue;
+
+        v = (const atomic_llong *)((const uint8_t *)src + d->offset);
+        for (m = 0; m < (d->per_media ? METRICS_MEDIA_MAX : 1); m++) {
+            av_bprintf(bp, "%s{", d->name);
+            __metrics_labels(bp, src);
+            if (d->per_media)
+                av_bprintf(bp, ",media=\"%s\"", media_names[m]);
+            av_bprintf(bp, "} %lld\n", (long long)atomic_load_explicit((atomic_llong *)&v[m], memory_order_relaxed));
+        }
+    }
+}
+
+static void __metrics_render_histogram(AVBPrint *bp)
+{
+    const char *name = "media_muxer_write_seconds";
+    const metrics_source_t *src = NULL;
+    int64_t cumulative = 0;
+    int i = 0;
+
+    av_bprintf(bp, "# HELP %s Time spent writing one packet to the output.\n# TYPE %s histogram\n", name, name);
+
+    for (src = registry.head; src != NULL; src = src->next) {
+        if (src->kind != METRICS_KIND_MUXER)
+            continue;
+
+        cumulative = 0;
+        for (i = 0; i <= METRICS_BUCKETS; i++) {
+            cumulative += atomic_load_explicit((atomic_llong *)&src->write_buckets[i], memory_order_relaxed);
+            av_bprintf(bp, "%s_bucket{", name);
+            __metrics_labels(bp, src);
+            if (i < METRICS_BUCKETS)
+                av_bprintf(bp, ",le=\"%g\"} %lld\n", write_bounds[i] / 1000000.0, (long long)cumulative);
+            else
+                av_bprintf(bp, ",le=\"+Inf\"} %lld\n", (long long)cumulative);
+        }
+
+        av_bprintf(bp, "%s_sum{", name);
+        __metrics_labels(bp, src);
+        av_bprintf(bp, "} %.6f\n", atomic_load_explicit((atomic_llong *)&src->write_sum_us, memory_order_relaxed) / 1000000.0);
+
+        //各个桶是分别读的,count用桶的总和,保证和+Inf一致
+        av_bprintf(bp, "%s_count{", name);
+        __metrics_labels(bp, src);
+        av_bprintf(bp, "} %lld\n", (long long)cumulative);
+    }
+}
+
+int metrics_render(char **text)
+{
+    AVBPrint bp;
+    size_t i = 0;
+    int k = 0, ret = 0;
+
+    if (text == NULL)
+        return -1;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+
+    pthread_mutex_lock(&registry.mutex);
+
+    for (k = 0; k < METRICS_KIND_MAX; k++) {
+        av_bprintf(&bp, "# HELP media_%s_instances Live %s instances.\n# TYPE media_%s_instances gauge\n"
+                        "media_%s_instances %d\n",
+                   kind_names[k], kind_names[k], kind_names[k], kind_names[k], registry.count[k]);
+    }
+
+    for (i = 0; i < sizeof(descs) / sizeof(descs[0]); i++)
+        __metrics_render_desc(&bp, &descs[i]);
+
+    __metrics_render_histogram(&bp);
+
+    pthread_mutex_unlock(&registry.mutex);
+
+    if (!av_bprint_is_complete(&bp)) {
+        av_bprint_finalize(&bp, NULL);
+        return -2;
+    }
+
+    ret = (int)bp.len;
+    if (av_bprint_finalize(&bp, text) < 0)
+        return -2;
+
+    return ret;
+}
+
+int metrics_dump(const char *filename)
+{
+    char *text = NULL, *tmp = NULL;
+    FILE *fp = NULL;
+    int len = 0, ret = -1;
+
+    if (filename == NULL)
+        return -1;
+
+    len = metrics_render(&text);
+    if (len < 0)
+        return -2;
+
+    tmp = av_asprintf("%s.tmp", filename);
+    if (tmp == NULL) {
+        ret = -2;
+        goto fail;
+    }
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        ret = -3;
+        goto fail;
+    }
+
+    if (fwrite(text, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        remove(tmp);
+        ret = -4;
+        goto fail;
+    }
+
+    if (fclose(fp) != 0 || rename(tmp, filename) != 0) {
+        remove(tmp);
+        ret = -4;
+        goto fail;
+    }
+
+    ret = 0;
+
+fail:
+    av_free(tmp);
+    av_free(text);
+
+    return ret;
+}
+
+#ifndef _WIN32
+
+#define METRICS_POLL_MS         200
+#define METRICS_REQUEST_MS      1000
+#define METRICS_REQUEST_SIZE    4096
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    int fd;
+    int running;
+    atomic_int quit;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} server = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+static int __metrics_send(int fd, const char *data, int len)
+{
+    ssize_t n = 0;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (int)n;
+    }
+
+    return 0;
+}
+
+/**
+ * 读掉http请求头(不解析,任何路径都返回指标),nc -U这种不发请求的客户端等待超时后也返回
+ */
+static void __metrics_handle(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char request[METRICS_REQUEST_SIZE + 1];
+    char header[256];
+    char *text = NULL;
+    int received = 0, len = 0, n = 0;
+
+    while (received < METRICS_REQUEST_SIZE && poll(&pfd, 1, METRICS_REQUEST_MS) > 0) {
+        n = (int)recv(fd, request + received, METRICS_REQUEST_SIZE - received, 0);
+        if (n <= 0)
+            break;
+        received += n;
+        request[received] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+
+    len = metrics_render(&text);
+    if (len < 0) {
+        n = snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+        __metrics_send(fd, header, n);
+        return;
+    }
+
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", len);
+    if (__metrics_send(fd, header, n) == 0)
+        __metrics_send(fd, text, len);
+
+    av_free(text);
+}
+
+static void *__metrics_server(void *arg)
+{
+    struct pollfd pfd = { .fd = server.fd, .events = POLLIN };
+    int client = -1;
+
+    (void)arg;
+
+    while (!atomic_load(&server.quit)) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+            continue;
+
+        client = accept(server.fd, NULL, NULL);
+        if (client < 0)
+            continue;
+
+        __metrics_handle(client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+int metrics_serve(const char *path)
+{
+    struct sockaddr_un addr;
+    int ret = -1;
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    pthread_mutex_lock(&server.mutex);
+
+    if (server.running)
+        goto fail;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+
+    server.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server.fd < 0) {
+        ret = -2;
+        goto fail;
+    }
+
+    //上次异常退出留下的socket文件
+    unlink(path);
+    if (bind(server.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server.fd, 16) != 0) {
+        close(server.fd);
+        server.fd = -1;
+        ret = -2;
+        goto fail;
+    }
+
+    snprintf(server.path, sizeof(server.path), "%s", path);
+    atomic_store(&server.quit, 0);
+
+    if (pthread_create(&server.thread, NULL, __metrics_server, NULL) != 0) {
+        close(server.fd);
+        server.fd = -1;
+        unlink(path);
+        ret = -3;
+        goto fail;
+    }
+
+    server.running = 1;
+    ret = 0;
+
+fail:
+    pthread_mutex_unlock(&server.mutex);
+
+    return ret;
+}
+
+void metrics_serve_stop(void)
+{
+    pthread_mutex_lock(&server.mutex);
+
+    if (server.running) {
+        atomic_store(&server.quit, 1);
+        pthread_join(server.thread, NULL);
+        close(server.fd);
+        server.fd = -1;
+        unlink(server.path);
+        server.running = 0;
+    }
+
+    pthread_mutex_unlock(&server.mutex);
+}
+
+#else
+
+int metrics_serve(const char *path)
+{
+    (void)path;
+
+    return -4;
+}
+
+void metrics_serve_stop(void)
+{
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @brief 所有存活的demuxer/muxer的运行指标,输出prometheus文本格式
+ *   demuxer_create/muxer_create时自动注册,destroy时注销,每个实例有唯一的id标签,
+ *   重新open文件时file标签跟着变化
+ *   计数都是原子变量,写入路径上不加锁;只有注册,注销和输出时持有全局锁
+ *   输出到文件(node_exporter textfile collector)或者unix socket(curl --unix-socket)
+ */
+struct metrics_source;
+typedef struct metrics_source metrics_source_t;
+
+enum METRICS_KIND {
+    METRICS_KIND_DEMUXER    = 0,
+    METRICS_KIND_MUXER      = 1,
+    METRICS_KIND_MAX,
+};
+
+enum METRICS_MEDIA {
+    METRICS_MEDIA_VIDEO     = 0,
+    METRICS_MEDIA_AUDIO     = 1,
+    METRICS_MEDIA_OTHER     = 2,
+    METRICS_MEDIA_MAX,
+};
+
+/**
+ * @brief 注册一个实例,demuxer_create/muxer_create内部调用
+ *
+ * @param kind: METRICS_KIND
+ * @return metrics_source_t*: NULL失败,之后的metrics_*调用都忽略NULL
+ */
+metrics_source_t *metrics_register(int kind);
+
+/**
+ * @brief 注销并释放,之后不再输出这个实例
+ *
+ * @param src
+ */
+void metrics_unregister(metrics_source_t **src);
+
+/**
+ * @brief 设置file标签
+ *
+ * @param src
+ * @param filename: NULL清空
+ */
+void metrics_set_file(metrics_source_t *src, const char *filename);
+
+/**
+ * @brief 读出或者写入一个packet
+ *
+ * @param src
+ * @param media: METRICS_MEDIA,可以用metrics_media_type从AVMediaType转换
+ * @param bytes: packet大小
+ */
+void metrics_add_packet(metrics_source_t *src, int media, int64_t bytes);
+
+/**
+ * @brief AVMediaType转换为METRICS_MEDIA
+ */
+int metrics_media_type(int codec_type);
+
+/**
+ * @brief 读写失败
+ */
+void metrics_add_error(metrics_source_t *src);
+
+/**
+ * @brief muxer丢弃的packet(参数错误,放不进交织队列)
+ */
+void metrics_add_drop(metrics_source_t *src);
+
+/**
+ * @brief demuxer的seek次数
+ */
+void metrics_add_seek(metrics_source_t *src);
+
+/**
+ * @brief 记录一次写入packet的耗时,进入直方图
+ *
+ * @param src
+ * @param us: 微秒
+ */
+void metrics_observe_write(metrics_source_t *src, int64_t us);
+
+/**
+ * @brief 更新muxer交织队列的深度
+ *
+ * @param src
+ * @param packets: 排队的packet数
+ * @param bytes: 排队的字节数
+ */
+void metrics_set_queue(metrics_source_t *src, int64_t packets, int64_t bytes);
+
+/**
+ * @brief 生成prometheus文本格式
+ *
+ * @param text: 输出,使用完av_free
+ * @return int: >=0文本长度 <0失败
+ */
+int metrics_render(char **text);
+
+/**
+ * @brief 写到文件,先写临时文件再rename,读取方不会读到一半的内容
+ *
+ * @param filename: 输出文件,node_exporter要求扩展名为.prom
+ * @return int: 0成功 其他失败
+ */
+int metrics_dump(const char *filename);
+
+/**
+ * @brief 启动一个线程在unix socket上提供指标,每个连接返回一次http响应后关闭
+ *   curl --unix-socket path http://localhost/metrics
+ *
+ * @param path: socket文件路径,已存在时先删除
+ * @return int: 0成功 其他失败
+ *              -1:参数错误或者已经启动
+ *              -2:创建socket失败
+ *              -3:创建线程失败
+ *              -4:不支持(windows)
+ */
+int metrics_serve(const char *path);
+
+/**
+ * @brief 停止metrics_serve的线程,删除socket文件
+ */
+void metrics_serve_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__METRICS_H
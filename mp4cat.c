@@ -0,0 +1,132 @@
+/*
+ * 无损合并mp4分段: 把一天的录像合并成一个文件,样本数据在内核中拷贝,见concat.h
+ *
+ * mp4cat [-l 列表文件] 输出文件 [输入文件...]
+ *
+ * 列表文件每行一个输入文件,和命令行中的输入一起按顺序合并
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "libavutil/time.h"
+
+#include "concat.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-l list_file] output [input...]\n", name);
+}
+
+static int __add_input(char ***inputs, int *count, int *capacity, const char *name)
+{
+    char **p = NULL;
+
+    if (*count == *capacity) {
+        *capacity = *capacity > 0 ? *capacity * 2 : 64;
+        p = realloc(*inputs, *capacity * sizeof(char *));
+        if (p == NULL)
+            return -1;
+        *inputs = p;
+    }
+
+    (*inputs)[*count] = strdup(name);
+    if ((*inputs)[*count] == NULL)
+        return -1;
+    (*count)++;
+
+    return 0;
+}
+
+static int __read_list(const char *list, char ***inputs, int *count, int *capacity)
+{
+    FILE *fp = fopen(list, "r");
+    char line[4096];
+    size_t len = 0;
+
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        if (__add_input(inputs, count, capacity, line) != 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    concat_stats_t stats;
+    const char *list = NULL, *output = NULL;
+    char **inputs = NULL;
+    int64_t start = 0, elapsed = 0;
+    int count = 0, capacity = 0, opt = 0, i = 0, ret = -1;
+
+    while ((opt = getopt(argc, argv, "l:h")) != -1) {
+        switch (opt) {
+        case 'l':
+            list = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    output = argv[optind++];
+
+    if (list != NULL && __read_list(list, &inputs, &count, &capacity) != 0) {
+        fprintf(stderr, "read %s failed\n", list);
+        goto fail;
+    }
+
+    for (; optind < argc; optind++) {
+        if (__add_input(&inputs, &count, &capacity, argv[optind]) != 0)
+            goto fail;
+    }
+
+    if (count == 0) {
+        usage(argv[0]);
+        goto fail;
+    }
+
+    start = av_gettime_relative();
+    ret = concat_mp4(output, (const char **)inputs, count, &stats);
+    elapsed = av_gettime_relative() - start;
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    if (ret != 0) {
+        fprintf(stderr, "concat failed: %d\n", ret);
+        goto fail;
+    }
+
+    fprintf(stderr, "%d files, %lld samples, %.1f MB in %lld copies (%lld fallback), %.1f s of media\n"
+                    "%.2f s: %.1f MB/s\n",
+            count, (long long)stats.samples, stats.bytes / 1048576.0, (long long)stats.copies,
+            (long long)stats.fallback_copies, stats.duration_ms / 1000.0,
+            elapsed / 1000000.0, stats.bytes / 1.048576 / elapsed);
+
+fail:
+    for (i = 0; i < count; i++)
+        free(inputs[i]);
+    free(inputs);
+
+    return ret;
+}
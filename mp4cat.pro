@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = mp4cat
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += mp4cat.c
+
+include(media.pri)
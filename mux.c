@@ -11,12 +11,49 @@
 #include "libavutil/opt.h"
 #include "libavutil/avutil.h"
 #include "libavutil/mathematics.h"
+#include "libavutil/avstring.h"
 
 #include <log.h>
 
 #include "mux.h"
+#include "demux.h"
+#include "journal.h"
+#include "mux_io.h"
+#include "mux_manager.h"
+#include "sync_group.h"
+#include "nal.h"
+#include "mux_ts.h"
+#include "interleave.h"
+#include "alloc_trace.h"
+#include "trace.h"
+#include "metrics.h"
 #include <limits.h>
 
+#define MAX_STREAMS 32
+
+#define MOOV_CHUNK_SIZE         (1 << 20)   //mov_build_chunks合并样本的上限
+#define MOOV_FIXED_SIZE         1024        //mvhd,udta等
+#define MOOV_TRACK_SIZE         2048        //每个trak中样本表之外的部分
+
+#define TS_PACKET_SIZE          188
+#define TS_DEFAULT_PCR_MS       20
+#define TS_DEFAULT_AGGREGATE    348     //188*348约64K
+
+/**
+ * 统计每个流的样本表,关闭时估算moov大小的上限
+ */
+typedef struct moov_track {
+    int64_t samples;
+    int64_t keyframes;
+    int64_t chunks;
+    int64_t chunk_bytes;
+    int64_t stts_entries;
+    int64_t ctts_entries;
+    int64_t last_dts;
+    int64_t last_delta;
+    int64_t last_cts;
+} moov_track_t;
+
 struct muxer {
     AVFormatContext *output_ctx;
     pthread_mutex_t mutex;
@@ -25,16 +62,59 @@ struct muxer {
     int audio_index;
     int complete;
     //video pts
-    int64_t video_total_pts;
-    int64_t  video_prev_pts;
+    mux_ts_t video_ts;
 
     //audio pts
-    int64_t audio_total_pts;
-    int64_t audio_prev_pts;
+    mux_ts_t audio_ts;
 
     int video_codecid;
-    float fps;
+    AVRational frame_rate;
     char *filename;
+
+    //annexb视频转换为长度前缀,extradata是avcC/hvcC时需要
+    int annexb_to_mp4;
+    nal_param_sets_t extradata_ps;
+    int ps_changed;
+    AVBufferPool *video_pool;
+    int video_pool_size;
+    int keyframe_detect;
+
+    //交织队列
+    interleave_t queue;
+    int64_t max_delta_ms;
+    int64_t max_bytes;
+
+    //输出格式
+    int format;
+    int pcr_interval_ms;
+    int ts_packets_per_write;
+
+    //durability
+    mux_io_t *io;
+    mux_manager_t *manager;
+
+    //文件头预留moov
+    int64_t faststart_ms;
+    int64_t moov_reserved;
+    moov_track_t *moov_tracks;
+    int moov_last_stream;
+
+    //崩溃恢复日志
+    journal_t *journal;
+    int journal_interval_ms;
+    int64_t journal_last;
+    uint32_t journal_config;        //已经记录了extradata的流
+    int durability;
+    int sync_interval_ms;
+
+    metrics_source_t *metrics;
+
+    //关闭回调,记录分段的时间范围
+    muxer_close_hook_t close_hook;
+    void *close_hook_opaque;
+    int64_t segment_start_us;
+    int64_t segment_first_us;
+    int64_t segment_end_us;
 };
 
 #define MUXER_INIT()                        \
@@ -46,20 +126,54 @@ struct muxer {
         .video_index = -1,                  \
         .audio_index = -1,                  \
         .complete = 0,                      \
-        .video_total_pts = 0,               \
-        .video_prev_pts = -1,               \
-        .audio_total_pts = 0,               \
-        .audio_prev_pts = -1,               \
+        .video_ts = {{0}},                  \
+        .audio_ts = {{0}},                  \
         .video_codecid = AV_CODEC_ID_NONE,  \
-        .fps = 0.,                          \
+        .frame_rate = {25, 1},              \
         .filename = NULL,                   \
+        .annexb_to_mp4 = 0,                 \
+        .extradata_ps = {0},                \
+        .ps_changed = 0,                    \
+        .video_pool = NULL,                 \
+        .video_pool_size = 0,               \
+        .keyframe_detect = 0,               \
+        .queue = {0},                       \
+        .max_delta_ms = 1000,               \
+        .max_bytes = 8 * 1024 * 1024,       \
+        .format = MUXER_FORMAT_MP4,         \
+        .pcr_interval_ms = TS_DEFAULT_PCR_MS,\
+        .ts_packets_per_write = TS_DEFAULT_AGGREGATE,\
+        .io = NULL,                         \
+        .manager = NULL,                    \
+        .faststart_ms = 0,                  \
+        .moov_reserved = 0,                 \
+        .moov_tracks = NULL,                \
+        .moov_last_stream = -1,             \
+        .journal = NULL,                    \
+        .journal_interval_ms = 0,           \
+        .journal_last = 0,                  \
+        .journal_config = 0,                \
+        .durability = MUXER_DURABILITY_NONE,\
+        .sync_interval_ms = 0,              \
+        .metrics = NULL,                    \
+        .close_hook = NULL,                 \
+        .close_hook_opaque = NULL,          \
+        .segment_start_us = AV_NOPTS_VALUE, \
+        .segment_first_us = 0,              \
+        .segment_end_us = 0,                \
     }
 
+static int __muxer_drain(muxer_t *muxer, int flush);
+static int __muxer_check_moov(muxer_t *muxer);
+static void __muxer_segment_closed(muxer_t *muxer, int64_t size);
+
 muxer_t *muxer_create(void)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
     muxer_t *muxer = (muxer_t *)calloc(sizeof(muxer_t), 1);
     if (muxer != NULL) {
         *muxer = MUXER_INIT();
+        muxer->metrics = metrics_register(METRICS_KIND_MUXER);
     }
 
     return muxer;
@@ -67,8 +181,10 @@ muxer_t *muxer_create(void)
 
 void muxer_destroy(muxer_t **muxer)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
     if (muxer != NULL && *muxer != NULL) {
         muxer_close(*muxer);
+        metrics_unregister(&(*muxer)->metrics);
 
         free(*muxer);
 
@@ -78,8 +194,8 @@ void muxer_destroy(muxer_t **muxer)
 
 int muxer_open(muxer_t *muxer, const char *filename)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
     int ret = -3, err = -1;
-    AVStream *out = NULL;
 
     if (muxer == NULL) {
         LOG("muxer is null\n");
@@ -91,7 +207,7 @@ int muxer_open(muxer_t *muxer, const char *filename)
         return -2;
     }
 
-    pthread_mutex_lock(&muxer->mutex);
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
 
     if (muxer->isStart == 0) {
 
@@ -107,7 +223,9 @@ int muxer_open(muxer_t *muxer, const char *filename)
             goto fail;
         }
 
-        err = avformat_alloc_output_context2(&muxer->output_ctx, 0, "mp4", muxer->filename);
+        err = avformat_alloc_output_context2(&muxer->output_ctx, 0,
+                                             muxer->format == MUXER_FORMAT_MPEGTS ? "mpegts" : "mp4",
+                                             muxer->filename);
         if (err < 0 || muxer->output_ctx == NULL) {
             LOG("allo rmp output failed: '%s'\n", muxer->filename);
             ret = -5;
@@ -115,6 +233,7 @@ int muxer_open(muxer_t *muxer, const char *filename)
         }
 
         LOG("open '%s' success\n", muxer->filename);
+        metrics_set_file(muxer->metrics, muxer->filename);
 
         ret = 0;
 
@@ -130,49 +249,93 @@ fail:
 
 int muxer_close(muxer_t *muxer)
 {
-    int ret = -1;
-    int64_t err = -1;
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    TRACE_SCOPE("muxer_close", "mux");
+    int ret = -1, err = 0, written = 0;
+    int64_t size = 0;
 
     if (muxer != NULL) {
 
-        pthread_mutex_lock(&muxer->mutex);
+        TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
 
         if (muxer->isStart == 1) {
+            ret = 0;
 
             if (muxer->output_ctx != NULL) {
                 if (muxer->complete == 1) {
-                    LOG("close '%s' success\n", muxer->filename);
-                    av_write_trailer(muxer->output_ctx);
-                    if (muxer->output_ctx != NULL && !(muxer->output_ctx->flags & AVFMT_NOFILE))
-                        avio_closep(&muxer->output_ctx->pb);
+                    //缓存在交织队列里的包在这里才写,失败时文件缺数据
+                    if (__muxer_drain(muxer, 1) < 0)
+                        ret = -3;
+                    if (__muxer_check_moov(muxer) != 0) {
+                        ret = -3;
+                    } else {
+                        TRACE_BEGIN(trailer_begin);
+                        err = av_write_trailer(muxer->output_ctx);
+                        TRACE_END(trailer_begin, "av_write_trailer", "mux");
+                        if (err < 0) {
+                            LOG("write trailer of '%s' failed: %s\n", muxer->filename, av_err2str(err));
+                            ret = -2;
+                        } else {
+                            written = 1;
+                        }
+                    }
+
+                    //异步写入和刷盘的错误只有在这里才能发现
+                    if (muxer->io != NULL) {
+                        if (muxer->durability != MUXER_DURABILITY_NONE)
+                            err = mux_io_sync(muxer->io);
+                        else
+                            err = mux_manager_drain(muxer->io);
+                        if (err != 0 && ret == 0)
+                            ret = -3;
+                        size = muxer->io->size;
+                    }
                 } else {
+                    //没有写文件头,文件不能播放
                     LOG("close '%s' error\n", muxer->filename);
+                    ret = -2;
                 }
+                muxer->output_ctx->pb = NULL;
                 avformat_free_context(muxer->output_ctx);
                 muxer->output_ctx = NULL;
             }
 
+            interleave_uninit(&muxer->queue);
+            av_freep(&muxer->moov_tracks);
+            muxer->moov_reserved = 0;
+            muxer->moov_last_stream = -1;
 
+            if (muxer->io != NULL) {
+                if (muxer->durability == MUXER_DURABILITY_GROUP)
+                    sync_group_remove(muxer->io);
+                if (mux_io_close(&muxer->io) != 0 && ret == 0)
+                    ret = -3;
+            }
 
+            //数据都已经写进文件才算完整: 删除日志,通知关闭回调
+            journal_close(&muxer->journal, written && ret == 0);
+            if (written && ret == 0)
+                __muxer_segment_closed(muxer, size);
 
             if (muxer->filename != NULL) {
                 free(muxer->filename);
                 muxer->filename = NULL;
             }
+            metrics_set_file(muxer->metrics, NULL);
+            metrics_set_queue(muxer->metrics, 0, 0);
+            muxer->segment_start_us = AV_NOPTS_VALUE;
 
             muxer->video_index			= -1;
             muxer->audio_index			= -1;
             muxer->complete				= 0;
-            muxer->video_total_pts		= 0;
-            muxer->video_prev_pts		= -1;
-            muxer->audio_total_pts		= 0;
-            muxer->audio_prev_pts		= -1;
             muxer->video_codecid		= AV_CODEC_ID_NONE;
-            muxer->fps					= 0.;
+            muxer->annexb_to_mp4		= 0;
+            muxer->ps_changed			= 0;
+            nal_param_sets_free(&muxer->extradata_ps);
+            av_buffer_pool_uninit(&muxer->video_pool);
+            muxer->video_pool_size		= 0;
 
             muxer->isStart = 0;
-
-            ret = 0;
         }
 
         pthread_mutex_unlock(&muxer->mutex);
@@ -181,85 +344,597 @@ int muxer_close(muxer_t *muxer)
     return ret;
 }
 
-static inline int write_frame(muxer_t *muxer, AVPacket * pkt)
+static void __muxer_moov_count(muxer_t *muxer, const AVPacket *pkt)
 {
-    int ret = -1;
+    moov_track_t *t = &muxer->moov_tracks[pkt->stream_index];
+    int64_t cts = pkt->pts - pkt->dts;
 
-    ret = av_interleaved_write_frame(muxer->output_ctx, pkt);
-    if (ret != 0) {
-        LOG("Error muxer pkt error: %s\n", av_err2str(ret));
+    if (t->samples == 0) {
+        t->stts_entries = 1;
+        t->ctts_entries = 1;
+    } else {
+        if (pkt->dts - t->last_dts != t->last_delta)
+            t->stts_entries++;
+        if (cts != t->last_cts)
+            t->ctts_entries++;
+        t->last_delta = pkt->dts - t->last_dts;
     }
 
-    return ret;
+    //和mov_build_chunks一样: 文件中连续并且不超过1M的样本在同一个chunk
+    if (muxer->moov_last_stream != pkt->stream_index || t->chunk_bytes + pkt->size >= MOOV_CHUNK_SIZE) {
+        t->chunks++;
+        t->chunk_bytes = 0;
+    }
+    t->chunk_bytes += pkt->size;
+    muxer->moov_last_stream = pkt->stream_index;
+
+    if (pkt->flags & AV_PKT_FLAG_KEY)
+        t->keyframes++;
+
+    t->last_dts = pkt->dts;
+    t->last_cts = cts;
+    t->samples++;
+}
+
+/**
+ * moov大小的上限: 每个表项按最大的格式(co64, 每个样本单独的stsz)计算
+ */
+static int64_t __muxer_moov_bound(muxer_t *muxer)
+{
+    moov_track_t *t = NULL;
+    int64_t size = MOOV_FIXED_SIZE;
+    unsigned int i = 0;
+
+    for (i = 0; i < muxer->output_ctx->nb_streams; i++) {
+        t = &muxer->moov_tracks[i];
+        size += MOOV_TRACK_SIZE + muxer->output_ctx->streams[i]->codecpar->extradata_size;
+        size += 16 + 8 * (t->stts_entries + 1);     //stts
+        size += 16 + 8 * (t->ctts_entries + 1);     //ctts
+        size += 16 + 4 * t->keyframes;              //stss
+        size += 20 + 4 * t->samples;                //stsz
+        size += 16 + 12 * t->chunks;                //stsc
+        size += 16 + 8 * t->chunks;                 //co64
+    }
+
+    return size;
+}
+
+/**
+ * 按预计时长估算需要预留的moov大小
+ */
+static int64_t __muxer_moov_estimate(muxer_t *muxer)
+{
+    AVStream *st = NULL;
+    AVRational rate;
+    int64_t size = MOOV_FIXED_SIZE, samples = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < muxer->output_ctx->nb_streams; i++) {
+        st = muxer->output_ctx->streams[i];
+
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && st->codecpar->sample_rate > 0)
+            rate = (AVRational){st->codecpar->sample_rate, st->codecpar->frame_size > 0 ? st->codecpar->frame_size : 1024};
+        else if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            rate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : muxer->frame_rate;
+        else
+            rate = (AVRational){50, 1};
+
+        samples = av_rescale(muxer->faststart_ms, rate.num, rate.den * 1000LL);
+
+        //stsz 4字节,交织写入时大约每个样本一个chunk(stsc+stco)
+        size += MOOV_TRACK_SIZE + st->codecpar->extradata_size + samples * 20;
+    }
+
+    return size + size / 8;
+}
+
+/**
+ * 写trailer之前检查预留的空间是否够用,不够时改用faststart整个文件重写一遍
+ * 返回非0时文件不完整,不能再写trailer
+ */
+static int __muxer_check_moov(muxer_t *muxer)
+{
+    int64_t bound = 0;
+
+    if (muxer->moov_reserved <= 0 || muxer->moov_tracks == NULL)
+        return 0;
+
+    bound = __muxer_moov_bound(muxer);
+
+    //预留空间不够时mov的trailer直接返回AVERROR(EINVAL),文件没有moov
+    if (bound + 8 <= muxer->moov_reserved)
+        return 0;
+
+    LOG("reserved moov %lld too small for '%s' (need up to %lld), rewrite file\n",
+        (long long)muxer->moov_reserved, muxer->filename, (long long)bound);
+
+    //faststart重新打开文件读取数据,异步队列必须先写完,写入失败时读到的数据不完整
+    avio_flush(muxer->output_ctx->pb);
+    if (mux_io_sync(muxer->io) != 0 || mux_manager_detach(muxer->io) != 0) {
+        LOG("flush '%s' before rewrite failed\n", muxer->filename);
+        return -1;
+    }
+
+    av_opt_set(muxer->output_ctx->priv_data, "movflags", "+faststart", 0);
+
+    return 0;
+}
+
+/**
+ * 预留空间在mov里是跳过的,写一个free box头,
+ * 这样改用faststart或者崩溃恢复把moov写在文件末尾时文件也是合法的
+ */
+static void __muxer_reserve_moov(muxer_t *muxer)
+{
+    AVIOContext *pb = muxer->output_ctx->pb;
+    int64_t pos = avio_tell(pb);
+
+    if (muxer->io->hole_size != muxer->moov_reserved) {
+        LOG("reserved moov not found in '%s'\n", muxer->filename);
+        muxer->moov_reserved = 0;
+        return;
+    }
+
+    avio_seek(pb, muxer->io->hole_pos, SEEK_SET);
+    avio_wb32(pb, (uint32_t)muxer->moov_reserved);
+    avio_wl32(pb, MKTAG('f', 'r', 'e', 'e'));
+    avio_seek(pb, pos, SEEK_SET);
+
+    muxer->moov_tracks = av_mallocz_array(muxer->output_ctx->nb_streams, sizeof(moov_track_t));
+    if (muxer->moov_tracks == NULL)
+        muxer->moov_reserved = 0;
+}
+
+/**
+ * 定期把日志记录写到文件
+ * 需要保证断电安全时先让数据落盘,日志中的记录不会超过文件中的数据
+ */
+static void __muxer_checkpoint(muxer_t *muxer, int force)
+{
+    int64_t now = av_gettime_relative();
+
+    if (!force && now - muxer->journal_last < muxer->journal_interval_ms * 1000LL)
+        return;
+
+    muxer->journal_last = now;
+
+    if (muxer->durability != MUXER_DURABILITY_NONE) {
+        mux_io_sync(muxer->io);
+        journal_flush(muxer->journal, 1);
+    } else {
+        journal_flush(muxer->journal, 0);
+    }
 }
 
-static inline int __muxer_write_video(muxer_t *muxer, const void *data, int32_t len, int64_t pts, const unsigned char keyframe)
+/**
+ * 记录分段的媒体时间范围,第一个packet写入时记下系统时间
+ */
+static void __muxer_segment_count(muxer_t *muxer, const AVPacket *pkt)
+{
+    AVRational tb = muxer->output_ctx->streams[pkt->stream_index]->time_base;
+    int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    int64_t first = 0, end = 0;
+
+    if (dts == AV_NOPTS_VALUE)
+        return;
+
+    first = av_rescale_q(dts, tb, AV_TIME_BASE_Q);
+    end = av_rescale_q(dts + FFMAX(pkt->duration, 0), tb, AV_TIME_BASE_Q);
+
+    if (muxer->segment_start_us == AV_NOPTS_VALUE) {
+        muxer->segment_start_us = av_gettime();
+        muxer->segment_first_us = first;
+        muxer->segment_end_us = end;
+        return;
+    }
+
+    muxer->segment_first_us = FFMIN(muxer->segment_first_us, first);
+    muxer->segment_end_us = FFMAX(muxer->segment_end_us, end);
+}
+
+static void __muxer_segment_closed(muxer_t *muxer, int64_t size)
+{
+    muxer_segment_t segment;
+
+    if (muxer->close_hook == NULL || muxer->segment_start_us == AV_NOPTS_VALUE)
+        return;
+
+    segment.filename = muxer->filename;
+    segment.start_us = muxer->segment_start_us;
+    segment.end_us = muxer->segment_start_us + (muxer->segment_end_us - muxer->segment_first_us);
+    segment.size = size;
+
+    muxer->close_hook(muxer->close_hook_opaque, &segment);
+}
+
+/**
+ * 把交织队列里可以写的packet写入文件
+ * flush为1时不等待落后的流,关闭文件前调用
+ */
+/**
+ * ADTS的AAC写头时没有extradata,mov的aac_adtstoasc在第一个包才生成AudioSpecificConfig,
+ * 日志头里没有,这里从第一个ADTS头生成一份记到日志里,崩溃恢复的文件才能解码
+ */
+static void __muxer_journal_config(muxer_t *muxer, const AVPacket *pkt)
+{
+    const AVCodecParameters *par = muxer->output_ctx->streams[pkt->stream_index]->codecpar;
+    const uint8_t *p = pkt->data;
+    uint8_t asc[2];
+    int object_type = 0, sr_index = 0, channels = 0;
+
+    if (pkt->stream_index >= 32 || (muxer->journal_config & (1u << pkt->stream_index)))
+        return;
+    muxer->journal_config |= 1u << pkt->stream_index;
+
+    if (par->codec_id != AV_CODEC_ID_AAC || par->extradata_size > 0 ||
+        pkt->size < 7 || p[0] != 0xff || (p[1] & 0xf6) != 0xf0)
+        return;
+
+    object_type = (p[2] >> 6) + 1;
+    sr_index = (p[2] >> 2) & 0x0f;
+    channels = ((p[2] & 0x01) << 2) | (p[3] >> 6);
+
+    asc[0] = (object_type << 3) | (sr_index >> 1);
+    asc[1] = ((sr_index & 0x01) << 7) | (channels << 3);
+
+    if (journal_set_extradata(muxer->journal, pkt->stream_index, asc, sizeof(asc)) != 0)
+        LOG("journal config of '%s' failed\n", muxer->filename);
+}
+
+static int __muxer_drain(muxer_t *muxer, int flush)
 {
     AVPacket pkt;
-    int ret = -1;
-    AVStream *out_stream = NULL;
+    int64_t offset = 0, begin = 0, queued = 0;
+    int ret = 0, err = 0, media = 0, size = 0, i = 0;
 
     av_init_packet(&pkt);
 
-    if (pts < 0)
-        pts = 0;
+    while (interleave_pop(&muxer->queue, &pkt, flush)) {
+        //av_write_frame之后pkt可能被清空,先记下来
+        media = metrics_media_type(muxer->output_ctx->streams[pkt.stream_index]->codecpar->codec_type);
+        size = pkt.size;
+        if (muxer->journal != NULL)
+            __muxer_journal_config(muxer, &pkt);
+        offset = avio_tell(muxer->output_ctx->pb);
+        begin = av_gettime_relative();
+        TRACE_BEGIN(write_begin);
+        err = av_write_frame(muxer->output_ctx, &pkt);
+        TRACE_END(write_begin, "av_write_frame", "mux");
+        metrics_observe_write(muxer->metrics, av_gettime_relative() - begin);
+        if (err < 0) {
+            LOG("Error muxer pkt error: %s\n", av_err2str(err));
+            metrics_add_error(muxer->metrics);
+            if (ret == 0)
+                ret = err;
+        } else {
+            metrics_add_packet(muxer->metrics, media, size);
+            if (muxer->journal != NULL) {
+                //mov把样本原样写在当前位置
+                journal_add(muxer->journal, pkt.stream_index, offset,
+                            (int)(avio_tell(muxer->output_ctx->pb) - offset),
+                            pkt.dts, pkt.pts, pkt.duration, pkt.flags);
+            }
+            if (muxer->moov_tracks != NULL)
+                __muxer_moov_count(muxer, &pkt);
+            if (muxer->close_hook != NULL)
+                __muxer_segment_count(muxer, &pkt);
+        }
+        av_packet_unref(&pkt);
+    }
+
+    if (muxer->journal != NULL)
+        __muxer_checkpoint(muxer, flush);
 
-    // printf("Original PTS: %lld\n", pts); // Print original PTS value
+    for (i = 0; i < muxer->queue.nb_streams; i++)
+        queued += muxer->queue.streams[i].count;
+    metrics_set_queue(muxer->metrics, queued, muxer->queue.bytes);
 
-    pkt.flags = (keyframe) ? AV_PKT_FLAG_KEY : 0;
+    return ret;
+}
+
+static inline int write_frame(muxer_t *muxer, AVPacket * pkt)
+{
+    int ret = -1;
+
+    ret = interleave_push(&muxer->queue, pkt);
+    if (ret != 0) {
+        LOG("Error queue pkt error: %d\n", ret);
+        metrics_add_drop(muxer->metrics);
+        return ret;
+    }
+
+    return __muxer_drain(muxer, 0);
+}
+
+/**
+ * 关键帧里带的参数集和extradata不一致时(比如分辨率切换),不重新打开文件,
+ * 让新的参数集留在这个关键帧里,解码器会从码流中更新
+ */
+static void __muxer_check_param_sets(muxer_t *muxer, const void *data, int32_t len)
+{
+    nal_param_sets_t ps = {0};
+
+    if (nal_extract_param_sets(muxer->video_codecid, data, len, &ps) <= 0)
+        return;
 
-    if (muxer->video_prev_pts == -1) {
-        muxer->video_total_pts = 0;
-        muxer->video_prev_pts = pts;
-    } else if ((pts - muxer->video_prev_pts) > 0) {
-        muxer->video_total_pts += (pts - muxer->video_prev_pts) * 1000;
-        muxer->video_prev_pts = pts;
+    if (!nal_param_sets_equal(&ps, &muxer->extradata_ps)) {
+        if (muxer->ps_changed == 0)
+            LOG("'%s' parameter sets changed, keep them in-band\n", muxer->filename);
+        muxer->ps_changed = 1;
     } else {
-        muxer->video_total_pts += (int64_t)((1000000. / muxer->fps));
+        muxer->ps_changed = 0;
+    }
+
+    nal_param_sets_free(&ps);
+}
+
+/**
+ * annexb关键帧只提取参数集生成avcC/hvcC,之后的视频数据转成长度前缀,
+ * 其他格式的extradata原样拷贝
+ */
+static int __muxer_set_video_extradata(muxer_t *muxer, AVCodecParameters *par, const uint8_t *extradata, int32_t extradata_size)
+{
+    uint8_t *config = NULL;
+    int config_size = 0, err = -1;
+
+    //ts里视频保持annexb,extradata原样保存
+    if (muxer->format != MUXER_FORMAT_MPEGTS &&
+        nal_is_annexb(extradata, extradata_size) &&
+        nal_extract_param_sets(par->codec_id, extradata, extradata_size, &muxer->extradata_ps) > 0) {
+        if (par->codec_id == AV_CODEC_ID_HEVC)
+            err = nal_build_hvcc(&muxer->extradata_ps, &config, &config_size);
+        else
+            err = nal_build_avcc(&muxer->extradata_ps, &config, &config_size);
+
+        if (err == 0) {
+            par->extradata = config;
+            par->extradata_size = config_size;
+            muxer->annexb_to_mp4 = 1;
+            return 0;
+        }
+
+        LOG("build %s config failed, use extradata as is\n", avcodec_get_name(par->codec_id));
+        nal_param_sets_free(&muxer->extradata_ps);
+    }
+
+    par->extradata = av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (par->extradata == NULL) {
+        LOG("no memory to allocate extradata\n");
+        return -1;
+    }
+
+    memcpy(par->extradata, extradata, extradata_size);
+    par->extradata_size = extradata_size;
+
+    return 0;
+}
+
+static AVBufferRef *__muxer_get_video_buffer(muxer_t *muxer, int size)
+{
+    size += AV_INPUT_BUFFER_PADDING_SIZE;
+
+    //池里的buffer大小固定,遇到更大的帧换一个更大的池,旧池在所有buffer归还后自动释放
+    if (muxer->video_pool == NULL || size > muxer->video_pool_size) {
+        av_buffer_pool_uninit(&muxer->video_pool);
+        muxer->video_pool_size = size + size / 2;
+        muxer->video_pool = av_buffer_pool_init(muxer->video_pool_size, NULL);
+        if (muxer->video_pool == NULL) {
+            muxer->video_pool_size = 0;
+            return NULL;
+        }
     }
 
-    // printf("Calculated total PTS: %lld\n", muxer->video_total_pts); // Print calculated total PTS
+    return av_buffer_pool_get(muxer->video_pool);
+}
+
+/**
+ * 生成一个视频packet放入交织队列,成功后pkt的数据已经move到队列中
+ */
+static int __muxer_queue_video(muxer_t *muxer, AVPacket *pkt, AVBufferRef *src, const void *data, int32_t len, int64_t pts, int64_t dts, unsigned char keyframe)
+{
+    AVBufferRef *buf = NULL;
+    int key = -1;
 
-    pkt.pts = muxer->video_total_pts;
-    pkt.dts = muxer->video_total_pts;
+    if (muxer->video_index < 0)
+        return -4;
 
-    // printf("Before scaling - PTS: %lld, DTS: %lld\n", pkt.pts, pkt.dts); // Print PTS and DTS before scaling
+    //调用者传的关键帧标志不可靠时以码流为准,判断不了再用调用者的
+    if (muxer->keyframe_detect) {
+        key = nal_is_keyframe(muxer->video_codecid, data, len);
+        if (key >= 0)
+            keyframe = key;
+    }
 
-    pkt.data = (uint8_t *)data;
-    pkt.size = len;
-    pkt.stream_index = muxer->video_index;
-    out_stream = muxer->output_ctx->streams[muxer->video_index];
+    //转换到池里的buffer,packet带引用计数,放入队列时不会再拷贝一次
+    if (muxer->annexb_to_mp4 && nal_is_annexb(data, len)) {
+        if (keyframe)
+            __muxer_check_param_sets(muxer, data, len);
+
+        buf = __muxer_get_video_buffer(muxer, NAL_MP4_MAX_SIZE(len));
+        if (buf == NULL)
+            return -3;
+
+        len = nal_annexb_to_mp4(muxer->video_codecid, data, len, buf->data, !muxer->ps_changed);
+        data = buf->data;
+        pkt->buf = buf;
+    } else if (src != NULL) {
+        //数据本来就有引用计数,只增加引用
+        pkt->buf = av_buffer_ref(src);
+        if (pkt->buf == NULL)
+            return -3;
+    }
 
-    pkt.pts = av_rescale_q_rnd(pkt.pts, (AVRational){1, 1000000}, out_stream->time_base, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
-    pkt.dts = av_rescale_q_rnd(pkt.dts, (AVRational){1, 1000000}, out_stream->time_base, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
+    pkt->flags = (keyframe) ? AV_PKT_FLAG_KEY : 0;
 
-    // printf("After scaling - PTS: %lld, DTS: %lld\n", pkt.pts, pkt.dts); // Print PTS and DTS after scaling
+    //关键帧是一个片段的边界,把上一个片段刷盘
+    if (keyframe && muxer->durability == MUXER_DURABILITY_FRAGMENT)
+        mux_io_sync(muxer->io);
 
-    pkt.pos = -1;
+    mux_ts_next(&muxer->video_ts, pts, dts, &pkt->pts, &pkt->dts);
 
-    ret = write_frame(muxer, &pkt);
+    pkt->data = (uint8_t *)data;
+    pkt->size = len;
+    pkt->stream_index = muxer->video_index;
+    pkt->pos = -1;
+
+    if (interleave_push(&muxer->queue, pkt) != 0) {
+        av_packet_unref(pkt);
+        return -3;
+    }
+
+    return 0;
+}
+
+static inline int __muxer_write_video(muxer_t *muxer, const void *data, int32_t len, int64_t pts, int64_t dts, unsigned char keyframe)
+{
+    AVPacket pkt;
+    int ret = -1;
+
+    av_init_packet(&pkt);
+
+    ret = __muxer_queue_video(muxer, &pkt, NULL, data, len, pts, dts, keyframe);
     if (ret != 0)
+        metrics_add_drop(muxer->metrics);
+    else if (__muxer_drain(muxer, 0) != 0)
         ret = -3;
 
-    av_packet_unref(&pkt);
-
     return ret;
 }
 
 
 
 
+static void __muxer_init_timestamps(muxer_t *muxer)
+{
+    AVStream *st = NULL;
+    AVRational duration = {1024, 48000};
+
+    //调用者的时间戳单位是毫秒,输出时间基要在avformat_write_header之后才确定
+    if (muxer->video_index >= 0) {
+        st = muxer->output_ctx->streams[muxer->video_index];
+        mux_ts_init(&muxer->video_ts, (AVRational){1, 1000}, st->time_base, av_inv_q(muxer->frame_rate));
+    }
+
+    if (muxer->audio_index >= 0) {
+        st = muxer->output_ctx->streams[muxer->audio_index];
+        if (st->codecpar->sample_rate > 0) {
+            duration.num = st->codecpar->frame_size > 0 ? st->codecpar->frame_size : 1024;
+            duration.den = st->codecpar->sample_rate;
+        }
+        mux_ts_init(&muxer->audio_ts, (AVRational){1, 1000}, st->time_base, duration);
+    }
+}
+
+static int __muxer_init_queue(muxer_t *muxer)
+{
+    AVRational time_bases[MAX_STREAMS];
+    unsigned int i = 0;
+
+    if (muxer->output_ctx->nb_streams > MAX_STREAMS)
+        return -8;
+
+    for (i = 0; i < muxer->output_ctx->nb_streams; i++)
+        time_bases[i] = muxer->output_ctx->streams[i]->time_base;
+
+    if (interleave_init(&muxer->queue, muxer->output_ctx->nb_streams, time_bases,
+                        muxer->max_delta_ms * 1000, muxer->max_bytes) != 0)
+        return -8;
+
+    return 0;
+}
+
+static int __muxer_write_header(muxer_t *muxer)
+{
+    int ret = -1;
+    int buffer_size = 0;
+    AVDictionary *options = NULL;
+    char *options_str = NULL, *journal_name = NULL;
+
+    //ts按188*N字节整块写,不在每个packet后flush
+    if (muxer->format == MUXER_FORMAT_MPEGTS) {
+        buffer_size = TS_PACKET_SIZE * muxer->ts_packets_per_write;
+        muxer->output_ctx->flush_packets = 0;
+        av_dict_set_int(&options, "pcr_period", muxer->pcr_interval_ms, 0);
+    }
+
+    if (!(muxer->output_ctx->oformat->flags & AVFMT_NOFILE)) {
+        muxer->io = mux_io_open(muxer->filename, buffer_size);
+        if (muxer->io == NULL) {
+            LOG("Could not open output file '%s'\n", muxer->filename);
+            av_dict_free(&options);
+            return -6;
+        }
+        muxer->output_ctx->pb = muxer->io->pb;
+
+        if (muxer->manager != NULL && mux_manager_attach(muxer->manager, muxer->io) != 0)
+            LOG("attach '%s' to mux manager failed, write synchronously\n", muxer->filename);
+
+        //没有刷盘线程时达不到设置的断电保护,不能静默降级
+        if (muxer->durability == MUXER_DURABILITY_GROUP
+            && sync_group_add(muxer->io, muxer->sync_interval_ms) != 0) {
+            LOG("add '%s' to sync group failed\n", muxer->filename);
+            muxer->output_ctx->pb = NULL;
+            mux_io_close(&muxer->io);
+            av_dict_free(&options);
+            return -6;
+        }
+    }
+
+    if (muxer->faststart_ms > 0 && muxer->format == MUXER_FORMAT_MP4 && muxer->io != NULL) {
+        muxer->moov_reserved = __muxer_moov_estimate(muxer);
+        av_dict_set_int(&options, "moov_size", muxer->moov_reserved, 0);
+    }
+
+    //恢复时需要用同样的选项重放,write_header会修改options
+    if (muxer->journal_interval_ms > 0 && muxer->format == MUXER_FORMAT_MP4 && muxer->io != NULL)
+        av_dict_get_string(options, &options_str, '=', ':');
+
+    TRACE_BEGIN(header_begin);
+    ret = avformat_write_header(muxer->output_ctx, &options);
+    TRACE_END(header_begin, "avformat_write_header", "mux");
+    av_dict_free(&options);
+    if (ret < 0) {
+        LOG("Error occurred when opening output file: %s\n", av_err2str(ret));
+        av_free(options_str);
+        return -7;
+    }
+
+    if (muxer->moov_reserved > 0)
+        __muxer_reserve_moov(muxer);
+
+    if (muxer->journal_interval_ms > 0 && muxer->format == MUXER_FORMAT_MP4 && muxer->io != NULL) {
+        journal_name = av_asprintf("%s%s", muxer->filename, JOURNAL_SUFFIX);
+        if (journal_name != NULL)
+            muxer->journal = journal_create(journal_name, muxer->output_ctx, options_str);
+        if (muxer->journal == NULL)
+            LOG("create journal for '%s' failed\n", muxer->filename);
+        muxer->journal_last = av_gettime_relative();
+        muxer->journal_config = 0;
+        av_free(journal_name);
+    }
+    av_free(options_str);
+
+    __muxer_init_timestamps(muxer);
+
+    ret = __muxer_init_queue(muxer);
+    if (ret != 0)
+        return ret;
+
+    muxer->complete = 1;
+
+    return 0;
+}
+
 int muxer_add_video_and_audio(muxer_t *muxer, int videocodecid, int width, int height, uint8_t *extradata, int32_t extradata_size)
 {
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
     AVStream *out_stream = NULL;
     int ret = -1;
-    int err = 0;
-    AVDictionary *options = NULL;
 
     if (muxer == NULL)
         return -1;
 
-    pthread_mutex_lock(&muxer->mutex);
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
 
     if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 0) {
         out_stream = avformat_new_stream(muxer->output_ctx, NULL);
@@ -280,15 +955,10 @@ int muxer_add_video_and_audio(muxer_t *muxer, int videocodecid, int width, int h
 
         out_stream->codecpar->codec_tag = 0;
 
-        if (extradata != NULL && extradata_size > 0) {
-
-            out_stream->codecpar->extradata_size = extradata_size;
-            out_stream->codecpar->extradata = av_mallocz(out_stream->codecpar->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        muxer->video_codecid = out_stream->codecpar->codec_id;
 
-            if (out_stream->codecpar->extradata != NULL) {
-                memcpy(out_stream->codecpar->extradata, extradata, extradata_size);
-            } else {
-                LOG("no memory to allocate extradata\n");
+        if (extradata != NULL && extradata_size > 0) {
+            if (__muxer_set_video_extradata(muxer, out_stream->codecpar, extradata, extradata_size) != 0) {
                 ret = -2;
                 goto fail;
             }
@@ -324,6 +994,7 @@ int muxer_add_video_and_audio(muxer_t *muxer, int videocodecid, int width, int h
         out_stream->codecpar->bit_rate = 128 * 1024;                // 假设比特率为128kbps，具体值可以根据需要调整
         // out_stream->codecpar->frame_size = 不需要设置这个参数，因为对于AAC，frame_size可以是可变的。
         out_stream->time_base = (AVRational){1, 1000};              // 时间基准，通常对于音频可以保持这个设置
+
         // out_stream->codecpar->codec_tag = 0;                     // codec_tag通常不需要手动设置，除非有特定需求
 
 
@@ -349,24 +1020,146 @@ int muxer_add_video_and_audio(muxer_t *muxer, int videocodecid, int width, int h
 
         muxer->audio_index = ret;
 
-        if (!(muxer->output_ctx->oformat->flags & AVFMT_NOFILE)) {
-            ret = avio_open(&muxer->output_ctx->pb, muxer->filename, AVIO_FLAG_WRITE);
-            if (ret < 0) {
-                LOG("Could not open output file '%s'\n", muxer->filename);
-                ret = -6;
-                goto fail;
+        ret = __muxer_write_header(muxer);
+    }
+
+fail:
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_add_stream(muxer_t *muxer, const AVCodecParameters *par, AVRational time_base)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    AVStream *out_stream = NULL;
+    int ret = -2;
+
+    if (muxer == NULL || par == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 0) {
+        //mpegts等没有codec tag表的格式返回AVERROR_PATCHWELCOME,表示不确定,交给write_header检查
+        if (avformat_query_codec(muxer->output_ctx->oformat, par->codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+            LOG("codec '%s' not supported by '%s'\n", avcodec_get_name(par->codec_id), muxer->output_ctx->oformat->name);
+            ret = -3;
+            goto fail;
+        }
+
+        if (muxer->output_ctx->nb_streams >= MAX_STREAMS) {
+            LOG("too many streams\n");
+            ret = -4;
+            goto fail;
+        }
+
+        out_stream = avformat_new_stream(muxer->output_ctx, NULL);
+        if (out_stream == NULL) {
+            LOG("Failed allocating output stream\n");
+            ret = -4;
+            goto fail;
+        }
+
+        if (avcodec_parameters_copy(out_stream->codecpar, par) < 0) {
+            LOG("Failed to copy codec parameters\n");
+            ret = -4;
+            goto fail;
+        }
+
+        //不同容器的tag不一样,让muxer自己选
+        out_stream->codecpar->codec_tag = 0;
+        out_stream->time_base = time_base;
+
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO && muxer->video_index < 0) {
+            muxer->video_index = out_stream->index;
+            //muxer_write_video的关键帧检测和annexb转换需要知道编码
+            if (par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC) {
+                muxer->video_codecid = par->codec_id;
+                if (par->extradata != NULL && par->extradata_size > 0) {
+                    av_freep(&out_stream->codecpar->extradata);
+                    out_stream->codecpar->extradata_size = 0;
+                    if (__muxer_set_video_extradata(muxer, out_stream->codecpar, par->extradata, par->extradata_size) != 0) {
+                        ret = -4;
+                        goto fail;
+                    }
+                }
             }
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO && muxer->audio_index < 0)
+            muxer->audio_index = out_stream->index;
+
+        ret = out_stream->index;
+    }
+
+fail:
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_start(muxer_t *muxer)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 0) {
+        if (muxer->output_ctx->nb_streams == 0) {
+            LOG("no stream added to '%s'\n", muxer->filename);
+            ret = -3;
+        } else {
+            ret = __muxer_write_header(muxer);
         }
+    }
 
-        ret = avformat_write_header(muxer->output_ctx, NULL);
-        if (ret < 0) {
-            LOG("Error occurred when opening output file: %s\n", av_err2str(ret));
-            ret = -7;
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_write_packet(muxer_t *muxer, int stream_index, const AVPacket *pkt, AVRational time_base)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    TRACE_SCOPE("muxer_write_packet", "mux");
+    AVPacket out;
+    int ret = -2;
+
+    if (muxer == NULL || pkt == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
+        if (stream_index < 0 || stream_index >= (int)muxer->output_ctx->nb_streams) {
+            metrics_add_drop(muxer->metrics);
+            ret = -4;
             goto fail;
         }
 
-        muxer->complete = 1;
-        ret = 0;
+        //只增加引用计数,不拷贝数据
+        av_init_packet(&out);
+        if (av_packet_ref(&out, pkt) < 0) {
+            metrics_add_drop(muxer->metrics);
+            ret = -3;
+            goto fail;
+        }
+
+        out.stream_index = stream_index;
+        out.pos = -1;
+        av_packet_rescale_ts(&out, time_base, muxer->output_ctx->streams[stream_index]->time_base);
+
+        if (stream_index == muxer->video_index && (out.flags & AV_PKT_FLAG_KEY) && muxer->durability == MUXER_DURABILITY_FRAGMENT)
+            mux_io_sync(muxer->io);
+
+        ret = write_frame(muxer, &out);
+        if (ret != 0)
+            ret = -3;
+
+        av_packet_unref(&out);
     }
 
 fail:
@@ -375,21 +1168,44 @@ fail:
     return ret;
 }
 
-int muxer_write_video(muxer_t *muxer, const char *data, const int len, const unsigned char keyframe, int64_t pts)
+int muxer_set_format(muxer_t *muxer, int format)
 {
     int ret = -2;
-    int width = 0, height = 0;
 
-    if (pts < 0)
-        pts = 0;
+    if (muxer == NULL)
+        return -1;
+
+    if (format != MUXER_FORMAT_MP4 && format != MUXER_FORMAT_MPEGTS)
+        return -3;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 0) {
+        muxer->format = format;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_set_ts_options(muxer_t *muxer, int pcr_interval_ms, int packets_per_write)
+{
+    int ret = -2;
 
     if (muxer == NULL)
         return -1;
 
-    pthread_mutex_lock(&muxer->mutex);
+    if (pcr_interval_ms <= 0 || packets_per_write <= 0)
+        return -3;
 
-    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
-        ret = __muxer_write_video(muxer, data, len, pts, keyframe);
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->complete == 0) {
+        muxer->pcr_interval_ms = pcr_interval_ms;
+        muxer->ts_packets_per_write = packets_per_write;
+        ret = 0;
     }
 
     pthread_mutex_unlock(&muxer->mutex);
@@ -397,90 +1213,353 @@ int muxer_write_video(muxer_t *muxer, const char *data, const int len, const uns
     return ret;
 }
 
-static int __muxer_write_audio_pcma(muxer_t *muxer, const void *data, int32_t len, int64_t pts)
+int muxer_set_faststart(muxer_t *muxer, int64_t expected_duration_ms)
 {
-    int ret = -3;
-    AVPacket pkt;
-    AVStream *out_stream = NULL;
+    int ret = -2;
 
-    if (pts < 0)
-        pts = 0;
+    if (muxer == NULL)
+        return -1;
 
-    av_init_packet(&pkt);
+    if (expected_duration_ms < 0)
+        return -3;
 
-    if (muxer->audio_prev_pts == -1) {
-        muxer->audio_total_pts = 0;
-        muxer->audio_prev_pts = pts;
-    } else if ((pts - muxer->audio_prev_pts) > 0) {
-        muxer->audio_total_pts += (pts - muxer->audio_prev_pts) * 1000;
-        muxer->audio_prev_pts = pts;
-    } else {
-        muxer->audio_total_pts += (len * 1000 / 8);
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->complete == 0) {
+        muxer->faststart_ms = expected_duration_ms;
+        ret = 0;
     }
 
-    pkt.pts = muxer->audio_total_pts;
+    pthread_mutex_unlock(&muxer->mutex);
 
-    pkt.dts = pkt.pts;
+    return ret;
+}
 
-    pkt.data = (uint8_t *)data;
+int muxer_set_journal(muxer_t *muxer, int interval_ms)
+{
+    int ret = -2;
 
-    pkt.size = len;
+    if (muxer == NULL)
+        return -1;
 
-    pkt.stream_index = muxer->audio_index;
+    if (interval_ms < 0)
+        return -3;
 
-    out_stream = muxer->output_ctx->streams[muxer->audio_index];
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
 
-    pkt.pts = av_rescale_q_rnd(pkt.pts, (AVRational){1, 1000000}, out_stream->time_base, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
-    pkt.dts = av_rescale_q_rnd(pkt.dts, (AVRational){1, 1000000}, out_stream->time_base, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
+    if (muxer->complete == 0) {
+        muxer->journal_interval_ms = interval_ms;
+        ret = 0;
+    }
 
-    pkt.pos = -1;
+    pthread_mutex_unlock(&muxer->mutex);
 
-    ret = write_frame(muxer, &pkt);
-    if (ret != 0)
-        ret = -3;
+    return ret;
+}
+
+int muxer_set_manager(muxer_t *muxer, struct mux_manager *manager)
+{
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
 
-    av_packet_unref(&pkt);
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->complete == 0) {
+        muxer->manager = manager;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
 
     return ret;
 }
 
-int muxer_write_audio(muxer_t *muxer, const char *data, const int data_size, const int64_t pts)
+int muxer_set_close_hook(muxer_t *muxer, muxer_close_hook_t hook, void *opaque)
+{
+    if (muxer == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+    muxer->close_hook = hook;
+    muxer->close_hook_opaque = opaque;
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return 0;
+}
+
+int muxer_set_durability(muxer_t *muxer, int policy, int interval_ms)
+{
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
+
+    if (policy < MUXER_DURABILITY_NONE || policy > MUXER_DURABILITY_GROUP)
+        return -3;
+
+    if (policy == MUXER_DURABILITY_GROUP && interval_ms <= 0)
+        return -3;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    //文件已经打开后不能再修改策略
+    if (muxer->io == NULL) {
+        muxer->durability = policy;
+        muxer->sync_interval_ms = interval_ms;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_set_interleave(muxer_t *muxer, int64_t max_delta_ms, int64_t max_bytes)
 {
     int ret = -2;
 
     if (muxer == NULL)
         return -1;
 
-    uint8_t *aac_data = NULL;
-    int aac_data_size = 0;
+    if (max_delta_ms < 0 || max_bytes <= 0)
+        return -3;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->complete == 0) {
+        muxer->max_delta_ms = max_delta_ms;
+        muxer->max_bytes = max_bytes;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+int muxer_set_keyframe_detect(muxer_t *muxer, int enable)
+{
+    if (muxer == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+    muxer->keyframe_detect = enable ? 1 : 0;
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return 0;
+}
+
+int muxer_set_video_fps(muxer_t *muxer, int num, int den)
+{
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
+
+    if (num <= 0 || den <= 0)
+        return -3;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->complete == 0) {
+        muxer->frame_rate = (AVRational){num, den};
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+/**
+ * 接口上-1表示没有时间戳,内部统一用AV_NOPTS_VALUE,负数的dts(B帧开头)是有效的
+ */
+static inline int64_t __muxer_api_ts(int64_t ts)
+{
+    return ts == -1 ? AV_NOPTS_VALUE : ts;
+}
+
+int muxer_write_video(muxer_t *muxer, const char *data, const int len, const unsigned char keyframe, int64_t pts)
+{
+    return muxer_write_video_ts(muxer, data, len, keyframe, pts, -1);
+}
+
+int muxer_write_video_ts(muxer_t *muxer, const char *data, const int len, const unsigned char keyframe, int64_t pts, int64_t dts)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    TRACE_SCOPE("muxer_write_video", "mux");
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
+        ret = __muxer_write_video(muxer, data, len, __muxer_api_ts(pts), __muxer_api_ts(dts), keyframe);
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
+
+/**
+ * 加上ADTS头生成一个音频packet放入交织队列,成功后pkt的数据已经move到队列中
+ */
+static int __muxer_queue_audio(muxer_t *muxer, AVPacket *pkt, const void *data, int32_t data_size, int64_t pts)
+{
+    AVBufferRef *buf = NULL;
     int adts_header_size = 7;
 
-    // 计算总长度
-    aac_data_size = data_size + adts_header_size;
+    if (muxer->audio_index < 0)
+        return -4;
 
-    // 分配缓冲区
-    aac_data = av_malloc(aac_data_size);
+    // 直接分配带引用计数的buffer,放入队列时不会再拷贝
+    buf = av_buffer_alloc(data_size + adts_header_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (buf == NULL)
+        return -3;
 
     // 添加ADTS头
-    adts_header(aac_data, data_size, 
+    adts_header((char *)buf->data, data_size,
                 FF_PROFILE_AAC_LOW,
                 48000,
                 2);
 
     // 拷贝AAC数据
-    memcpy(aac_data + adts_header_size, data, data_size);
+    memcpy(buf->data + adts_header_size, data, data_size);
+
+    pkt->buf = buf;
+    pkt->data = buf->data;
+    pkt->size = data_size + adts_header_size;
+    pkt->stream_index = muxer->audio_index;
+    pkt->pos = -1;
+
+    mux_ts_next(&muxer->audio_ts, pts, AV_NOPTS_VALUE, &pkt->pts, &pkt->dts);
+
+    if (interleave_push(&muxer->queue, pkt) != 0) {
+        av_packet_unref(pkt);
+        return -3;
+    }
+
+    return 0;
+}
+
+int muxer_write_audio(muxer_t *muxer, const char *data, const int data_size, const int64_t pts)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    TRACE_SCOPE("muxer_write_audio", "mux");
+    AVPacket pkt;
+    int ret = -2;
+
+    if (muxer == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
+        av_init_packet(&pkt);
+        ret = __muxer_queue_audio(muxer, &pkt, data, data_size, __muxer_api_ts(pts));
+        if (ret != 0)
+            metrics_add_drop(muxer->metrics);
+        else if (__muxer_drain(muxer, 0) != 0)
+            ret = -3;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
 
-    pthread_mutex_lock(&muxer->mutex);
+int muxer_write_video_packet(muxer_t *muxer, const AVPacket *pkt)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    AVPacket out;
+    int ret = -2;
+
+    if (muxer == NULL || pkt == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
 
     if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
-        ret = __muxer_write_audio_pcma(muxer, aac_data, aac_data_size, pts);
+        av_init_packet(&out);
+        ret = __muxer_queue_video(muxer, &out, pkt->buf, pkt->data, pkt->size,
+                                  pkt->pts, pkt->dts,
+                                  (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0);
+        if (ret != 0)
+            metrics_add_drop(muxer->metrics);
+        else if (__muxer_drain(muxer, 0) != 0)
+            ret = -3;
     }
 
     pthread_mutex_unlock(&muxer->mutex);
 
-    av_free(aac_data);
+    return ret;
+}
+
+int muxer_write_audio_packet(muxer_t *muxer, const AVPacket *pkt)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    AVPacket out;
+    int ret = -2;
+
+    if (muxer == NULL || pkt == NULL)
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
+        av_init_packet(&out);
+        ret = __muxer_queue_audio(muxer, &out, pkt->data, pkt->size, pkt->pts);
+        if (ret != 0)
+            metrics_add_drop(muxer->metrics);
+        else if (__muxer_drain(muxer, 0) != 0)
+            ret = -3;
+    }
+
+    pthread_mutex_unlock(&muxer->mutex);
 
     return ret;
 }
 
+int muxer_write_batch(muxer_t *muxer, const muxer_packet_t *pkts, int count)
+{
+    ALLOC_TRACE_SCOPE(ALLOC_SCOPE_MUXER);
+    TRACE_SCOPE("muxer_write_batch", "mux");
+    AVPacket pkt;
+    int ret = -2, err = 0, i = 0, j = 0;
+
+    if (muxer == NULL || (pkts == NULL && count > 0))
+        return -1;
+
+    TRACE_MUTEX_LOCK(&muxer->mutex, "muxer->mutex");
+
+    if (muxer->isStart == 1 && muxer->output_ctx != NULL && muxer->complete == 1) {
+        av_init_packet(&pkt);
+
+        //packet放入队列后会被重置,同一个AVPacket可以一直使用
+        for (i = 0; i < count; i++) {
+            if (pkts[i].is_video)
+                err = __muxer_queue_video(muxer, &pkt, NULL, pkts[i].data, pkts[i].len,
+                                          __muxer_api_ts(pkts[i].pts), __muxer_api_ts(pkts[i].dts), pkts[i].keyframe);
+            else
+                err = __muxer_queue_audio(muxer, &pkt, pkts[i].data, pkts[i].len, __muxer_api_ts(pkts[i].pts));
+            if (err != 0)
+                break;
+        }
+
+        //出错之后的packet都没有写
+        for (j = i; j < count; j++)
+            metrics_add_drop(muxer->metrics);
+
+        //所有packet放入队列后只做一次交织
+        ret = (__muxer_drain(muxer, 0) != 0) ? -3 : i;
+    }
 
+    pthread_mutex_unlock(&muxer->mutex);
+
+    return ret;
+}
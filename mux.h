@@ -14,6 +14,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <libavutil/rational.h>
 
 /**
  * @brief mp4暂时只支持h264和h265与g711a数据封装
@@ -21,11 +22,44 @@ extern "C" {
 struct muxer;
 typedef struct muxer muxer_t;
 
+struct AVCodecParameters;
+struct AVPacket;
+struct mux_manager;
+
+/**
+ * @brief muxer_write_batch使用的packet描述
+ */
+typedef struct muxer_packet {
+    const char *data;
+    int len;
+    unsigned char is_video;     //1视频 0音频
+    unsigned char keyframe;     //视频是否关键帧
+    int64_t pts;                //毫秒,-1自动产生
+    int64_t dts;                //视频解码时间戳(毫秒),-1表示和pts相同,音频忽略
+} muxer_packet_t;
+
 enum MUXER_CODEC_ID {
     MUXER_CODEC_H265 		= 0,
     MUXER_CODEC_H264 		= 1,
 };
 
+/**
+ * @brief 输出格式
+ */
+enum MUXER_FORMAT {
+    MUXER_FORMAT_MP4            = 0,
+    MUXER_FORMAT_MPEGTS         = 1,    //只追加写,没有trailer,崩溃后也可以播放
+};
+
+/**
+ * @brief 断电时的数据保护策略
+ */
+enum MUXER_DURABILITY {
+    MUXER_DURABILITY_NONE       = 0,    //不主动fsync,由系统决定何时落盘
+    MUXER_DURABILITY_FRAGMENT   = 1,    //每个视频关键帧前把上一个片段fsync
+    MUXER_DURABILITY_GROUP      = 2,    //共享后台线程定时批量fsync所有muxer
+};
+
 /**
  * @brief 创建muxer
  *
@@ -49,19 +83,197 @@ void muxer_destroy(muxer_t **muxer);
  */
 int muxer_open(muxer_t *muxer, const char *filename);
 
+/**
+ * @brief 设置输出格式,必须在muxer_open之前调用,默认MUXER_FORMAT_MP4
+ *   MUXER_FORMAT_MPEGTS时视频保持annexb,其他写入接口不变
+ *
+ * @param muxer: muxer_create返回值
+ * @param format: MUXER_FORMAT
+ * @return int: 0成功 其他失败
+ *              -1:muxer为NULL
+ *              -2:文件已经打开
+ *              -3:参数错误
+ */
+int muxer_set_format(muxer_t *muxer, int format);
+
+/**
+ * @brief 设置ts参数,必须在muxer_add_video_and_audio或muxer_start之前调用
+ *
+ * @param muxer: muxer_create返回值
+ * @param pcr_interval_ms: PCR间隔(毫秒),默认20
+ * @param packets_per_write: 攒够多少个188字节的ts包写一次文件,默认348(约64K)
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_ts_options(muxer_t *muxer, int pcr_interval_ms, int packets_per_write);
+
 /**
  * @brief 添加音视频流
  *   音频只支持g711a 8000 16bit mono
+ *   extradata可以直接传annexb关键帧,只会提取VPS/SPS/PPS生成avcC/hvcC,
+ *   之后muxer_write_video写入的annexb数据会自动转换成长度前缀
  */
 int muxer_add_video_and_audio(muxer_t *muxer, int videocodecid, int width, int height, uint8_t *extradata, int32_t extradata_size);
 /**
- * @brief 关闭mp4文件
+ * @brief 按AVCodecParameters添加一路输出流(stream copy),可以调用多次,
+ *   所有流添加完成后调用muxer_start.不能和muxer_add_video_and_audio混用
+ *   第一路h264/h265视频流和muxer_add_video_and_audio一样支持muxer_write_video,
+ *   annexb的extradata转换成avcC/hvcC,关键帧检测和annexb转换同样有效
+ *
+ * @param muxer: muxer_create返回值
+ * @param par: 一般来自demuxer_get_codecpar
+ * @param time_base: 之后muxer_write_packet传入packet的时间基
+ * @return int: >=0输出流序号 其他失败
+ *              -1:参数错误
+ *              -2:文件没有打开或者已经开始写
+ *              -3:输出格式不支持该编码
+ *              -4:分配流失败
+ */
+int muxer_add_stream(muxer_t *muxer, const struct AVCodecParameters *par, AVRational time_base);
+
+/**
+ * @brief 所有muxer_add_stream完成后打开文件写文件头
+ *
+ * @param muxer: muxer_create返回值
+ * @return int: 0成功 其他失败
+ */
+int muxer_start(muxer_t *muxer);
+
+/**
+ * @brief 原样写入一个packet(stream copy),数据只增加引用不拷贝,packet不会被修改
+ *
+ * @param muxer: muxer_create返回值
+ * @param stream_index: muxer_add_stream返回值
+ * @param pkt: 一般来自demuxer_read_packet
+ * @param time_base: pkt时间戳的时间基
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -2:文件没有打开
+ *              -3:写数据失败
+ *              -4:stream_index错误
+ */
+int muxer_write_packet(muxer_t *muxer, int stream_index, const struct AVPacket *pkt, AVRational time_base);
+
+/**
+ * @brief 设置断电保护策略,必须在muxer_add_video_and_audio或muxer_start之前调用
+ *   MUXER_DURABILITY_GROUP最多丢失interval_ms加一个avio缓冲区(32K)的数据
+ *
+ * @param muxer: muxer_create返回值
+ * @param policy: MUXER_DURABILITY
+ * @param interval_ms: MUXER_DURABILITY_GROUP时的刷盘间隔(毫秒),其他策略忽略
+ * @return int: 0成功 其他失败
+ *              -1:muxer为NULL
+ *              -2:文件已经打开
+ *              -3:参数错误
+ */
+int muxer_set_durability(muxer_t *muxer, int policy, int interval_ms);
+
+/**
+ * @brief moov放在文件头,边下边播不需要先下载整个文件
+ *   按预计时长和帧率在文件头预留moov的空间,关闭时直接写进去,不需要faststart的第二遍重写,
+ *   实际录制超出预计太多,预留空间不够时才退回到faststart重写整个文件
+ *   必须在muxer_add_video_and_audio或muxer_start之前调用,ts格式不支持
+ *
+ * @param muxer: muxer_create返回值
+ * @param expected_duration_ms: 预计时长(毫秒),0关闭,默认关闭
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_faststart(muxer_t *muxer, int64_t expected_duration_ms);
+
+/**
+ * @brief 写mp4时同时记录样本表日志(文件名+".journal"),每interval_ms追加一次,
+ *   程序崩溃没有调用muxer_close时可以用journal_recover重建moov,正常关闭后日志被删除
+ *   设置了durability时每次追加日志前先让数据落盘. ts格式不需要
+ *   必须在muxer_add_video_and_audio或muxer_start之前调用
+ *
+ * @param muxer: muxer_create返回值
+ * @param interval_ms: 追加间隔(毫秒),0关闭,默认关闭
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_journal(muxer_t *muxer, int interval_ms);
+
+/**
+ * @brief 使用共享的I/O线程池写文件(见mux_manager.h),调用线程只拷贝数据,
+ *   必须在muxer_add_video_and_audio或muxer_start之前调用,NULL恢复为调用线程同步写入
+ *   muxer关闭之前不能摧毁manager
+ *
+ * @param muxer: muxer_create返回值
+ * @param manager: mux_manager_create返回值
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_manager(muxer_t *muxer, struct mux_manager *manager);
+
+/**
+ * @brief 成功关闭的文件(分段)信息,传给muxer_close_hook_t
+ */
+typedef struct muxer_segment {
+    const char *filename;   //muxer_open传入的文件名
+    int64_t start_us;       //第一个packet写入时的系统时间(微秒,1970年起)
+    int64_t end_us;         //start_us加上写入的媒体时长
+    int64_t size;           //文件大小(字节),未知时为0
+} muxer_segment_t;
+
+/**
+ * @brief muxer_close写完文件尾,所有数据写入文件(设置了durability时已经刷盘)并关闭之后调用,
+ *   在muxer的锁内,不能再调用这个muxer的接口
+ *   文件写入失败(muxer_close返回非0)或者没有写入任何packet时不调用
+ */
+typedef void (*muxer_close_hook_t)(void *opaque, const muxer_segment_t *segment);
+
+/**
+ * @brief 设置文件关闭回调,比如用archive_index_on_close把分段加入录像索引
+ *   对之后的每个文件都有效,hook为NULL取消
+ *
+ * @param muxer: muxer_create返回值
+ * @param hook: 回调
+ * @param opaque: 传给回调的参数
+ * @return int: 0成功 -1:muxer为NULL
+ */
+int muxer_set_close_hook(muxer_t *muxer, muxer_close_hook_t hook, void *opaque);
+
+/**
+ * @brief 关闭mp4文件,等待异步写入完成,设置了durability时刷盘
  *
  * @param muxer:muxer_create返回值
  * @return int: 0:关闭成功　其他失败
+ *              -1:muxer为NULL或者没有打开
+ *              -2:写文件尾失败或者没有写过文件头
+ *              -3:数据没有完整写入文件(写包,异步写入,刷盘或者close失败,比如磁盘满)
  */
 int muxer_close(muxer_t *muxer);
 
+/**
+ * @brief 设置视频帧率,自动产生时间戳时使用,默认25fps
+ *   必须在muxer_add_video_and_audio或muxer_start之前调用
+ *
+ * @param muxer: muxer_create返回值
+ * @param num: 帧率分子,比如30000
+ * @param den: 帧率分母,比如1001
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_video_fps(muxer_t *muxer, int num, int den);
+
+/**
+ * @brief 设置交织队列,某一路流断了之后最多等待max_delta_ms,最多缓存max_bytes,
+ *   超出后不再等待这路流,保证每个muxer占用的内存有上限
+ *   默认1000毫秒,8M. 必须在muxer_add_video_and_audio或muxer_start之前调用
+ *
+ * @param muxer: muxer_create返回值
+ * @param max_delta_ms: 最多等待多久(毫秒)
+ * @param max_bytes: 最多缓存多少字节
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_interleave(muxer_t *muxer, int64_t max_delta_ms, int64_t max_bytes);
+
+/**
+ * @brief 由muxer解析nal头判断关键帧,忽略muxer_write_video传入的keyframe
+ *   (H.264 IDR, HEVC IDR/CRA/BLA),无法判断时仍然使用keyframe
+ *
+ * @param muxer: muxer_create返回值
+ * @param enable: 1开启 0关闭
+ * @return int: 0成功 其他失败
+ */
+int muxer_set_keyframe_detect(muxer_t *muxer, int enable);
+
 /**
  * @brief 写入视频数据，现在只支持h264和h265
  *
@@ -77,6 +289,19 @@ int muxer_close(muxer_t *muxer);
  */
 int muxer_write_video(muxer_t *muxer, const char *data, const int len, const unsigned char keyframe, int64_t pts);
 
+/**
+ * @brief 写入视频数据,pts和dts分开传入,用于有B帧的码流
+ *
+ * @param muxer: muxer_create返回值
+ * @param data: 视频数据
+ * @param len: 视频数据长度
+ * @param keyframe: 当前视频是否为关键帧
+ * @param pts: 显示时间戳(毫秒),-1自动产生
+ * @param dts: 解码时间戳(毫秒),-1表示和pts相同,其他负数是有效的时间戳(有B帧时开头的dts)
+ * @return int: 同muxer_write_video
+ */
+int muxer_write_video_ts(muxer_t *muxer, const char *data, const int len, const unsigned char keyframe, int64_t pts, int64_t dts);
+
 /**
  * @brief 写入音频数据,现在只支持g711a或者pcma数据
  *
@@ -91,6 +316,39 @@ int muxer_write_video(muxer_t *muxer, const char *data, const int len, const uns
  */
 int muxer_write_audio(muxer_t *muxer, const char *data, const int data_size, const int64_t pts);
 
+/**
+ * @brief 和muxer_write_video_ts一样,数据来自带引用计数的AVPacket,
+ *   不需要转换格式时只增加引用不拷贝,用于一份数据写多个muxer
+ *
+ * @param muxer: muxer_create返回值
+ * @param pkt: pts/dts单位毫秒(AV_NOPTS_VALUE自动产生), flags带AV_PKT_FLAG_KEY表示关键帧
+ * @return int: 同muxer_write_video
+ */
+int muxer_write_video_packet(muxer_t *muxer, const struct AVPacket *pkt);
+
+/**
+ * @brief 和muxer_write_audio一样,数据来自AVPacket,需要加ADTS头,数据会拷贝一次
+ *
+ * @param muxer: muxer_create返回值
+ * @param pkt: pts单位毫秒(AV_NOPTS_VALUE自动产生)
+ * @return int: 同muxer_write_audio
+ */
+int muxer_write_audio_packet(muxer_t *muxer, const struct AVPacket *pkt);
+
+/**
+ * @brief 批量写入音视频数据,只加一次锁,全部放入交织队列后只做一次交织
+ *   用于采集驱动一次送来多帧的情况,每个packet的处理和muxer_write_video/muxer_write_audio一样
+ *
+ * @param muxer: muxer_create返回值
+ * @param pkts: packet数组
+ * @param count: 数组长度
+ * @return int: >=0成功放入的个数(遇到错误的packet就停止) 其他失败
+ *              -1:参数错误
+ *              -2:文件没有打开
+ *              -3:写数据失败
+ */
+int muxer_write_batch(muxer_t *muxer, const muxer_packet_t *pkts, int count);
+
 #ifdef __cplusplus
 }
 #endif
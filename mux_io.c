@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+
+#include <log.h>
+
+#include "mux_io.h"
+#include "mux_manager.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define fdatasync(fd)   _commit(fd)
+#else
+#define O_BINARY        0
+#endif
+
+#define MUX_IO_BUFFER_SIZE  (32 * 1024)
+
+static int __mux_io_pwrite(int fd, const uint8_t *buf, int size, int64_t offset)
+{
+    int done = 0;
+    ssize_t n = 0;
+
+#ifdef _WIN32
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+#endif
+
+    while (done < size) {
+#ifdef _WIN32
+        n = write(fd, buf + done, size - done);
+#else
+        n = pwrite(fd, buf + done, size - done, offset + done);
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+int mux_io_write_at(mux_io_t *io, const uint8_t *buf, int size, int64_t offset)
+{
+    if (__mux_io_pwrite(io->fd, buf, size, offset) != size) {
+        LOG("write '%s' failed: %s\n", io->filename, strerror(errno));
+        return AVERROR(errno);
+    }
+
+    atomic_store(&io->dirty, 1);
+
+    return size;
+}
+
+static int __mux_io_write_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    mux_io_t *io = (mux_io_t *)opaque;
+    int ret = atomic_load(&io->error);
+
+    if (ret != 0)
+        return AVERROR(ret);
+
+    if (io->queue != NULL)
+        ret = mux_manager_submit(io, buf, buf_size, io->pos);
+    else
+        ret = mux_io_write_at(io, buf, buf_size, io->pos);
+
+    if (ret < 0)
+        return ret;
+
+    io->pos += buf_size;
+    if (io->pos > io->size)
+        io->size = io->pos;
+
+    return buf_size;
+}
+
+static int64_t __mux_io_seek(void *opaque, int64_t offset, int whence)
+{
+    mux_io_t *io = (mux_io_t *)opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return io->size;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += io->pos;
+        break;
+    case SEEK_END:
+        offset += io->size;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+
+    if (offset < 0)
+        return AVERROR(EINVAL);
+
+    if (offset > io->size && io->hole_size == 0) {
+        io->hole_pos = io->size;
+        io->hole_size = offset - io->size;
+    }
+
+    io->pos = offset;
+
+    return offset;
+}
+
+mux_io_t *mux_io_open(const char *filename, int buffer_size)
+{
+    mux_io_t *io = NULL;
+    uint8_t *buffer = NULL;
+    struct stat st;
+
+    if (filename == NULL || *filename == '\0')
+        return NULL;
+
+    if (buffer_size <= 0)
+        buffer_size = MUX_IO_BUFFER_SIZE;
+
+    io = (mux_io_t *)calloc(1, sizeof(mux_io_t));
+    if (io == NULL)
+        return NULL;
+
+    io->fd = -1;
+    atomic_init(&io->dirty, 0);
+    atomic_init(&io->error, 0);
+
+    io->filename = strdup(filename);
+    if (io->filename == NULL)
+        goto fail;
+
+    io->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (io->fd < 0) {
+        LOG("open '%s' failed: %s\n", filename, strerror(errno));
+        goto fail;
+    }
+
+    if (fstat(io->fd, &st) == 0)
+        io->dev = st.st_dev;
+
+    buffer = av_malloc(buffer_size);
+    if (buffer == NULL)
+        goto fail;
+
+    io->pb = avio_alloc_context(buffer, buffer_size, 1, io, NULL, __mux_io_write_packet, __mux_io_seek);
+    if (io->pb == NULL) {
+        av_free(buffer);
+        goto fail;
+    }
+
+    return io;
+
+fail:
+    if (io->fd >= 0)
+        close(io->fd);
+    free(io->filename);
+    free(io);
+
+    return NULL;
+}
+
+int mux_io_close(mux_io_t **io)
+{
+    int ret = 0, pb_error = 0;
+
+    if (io == NULL || *io == NULL)
+        return 0;
+
+    if ((*io)->pb != NULL) {
+        avio_flush((*io)->pb);
+        pb_error = (*io)->pb->error;
+        av_freep(&(*io)->pb->buffer);
+        avio_context_free(&(*io)->pb);
+    }
+
+    //异步写入的错误最先发生,pb->error一般是它的结果
+    ret = mux_manager_detach(*io);
+    if (ret == 0)
+        ret = pb_error;
+    if (ret == 0 && atomic_load(&(*io)->error) != 0)
+        ret = AVERROR(atomic_load(&(*io)->error));
+
+    if ((*io)->fd >= 0 && close((*io)->fd) != 0 && ret == 0)
+        ret = AVERROR(errno);
+
+    if (ret < 0)
+        LOG("close '%s' failed: %s\n", (*io)->filename, av_err2str(ret));
+
+    free((*io)->filename);
+    free(*io);
+    *io = NULL;
+
+    return ret;
+}
+
+int mux_io_sync_fd(mux_io_t *io)
+{
+    int expected = 0;
+
+    if (io == NULL || io->fd < 0)
+        return -1;
+
+    //fsync失败后内核可能已经丢掉了脏页,再次fsync成功也不代表数据写入了
+    if (atomic_load(&io->error) != 0)
+        return -2;
+
+    if (atomic_exchange(&io->dirty, 0) == 0)
+        return 0;
+
+    if (fdatasync(io->fd) != 0) {
+        atomic_compare_exchange_strong(&io->error, &expected, errno);
+        atomic_store(&io->dirty, 1);
+        return -2;
+    }
+
+    return 0;
+}
+
+int mux_io_sync(mux_io_t *io)
+{
+    if (io == NULL || io->pb == NULL)
+        return -1;
+
+    avio_flush(io->pb);
+
+    if (mux_manager_drain(io) != 0)
+        return -2;
+
+    return mux_io_sync_fd(io);
+}
@@ -0,0 +1,84 @@
+#ifndef __MUX_IO_H
+#define __MUX_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <libavformat/avio.h>
+
+/**
+ * @brief muxer输出文件,用自己的fd替代avio_open,这样可以控制fsync
+ */
+typedef struct mux_io {
+    int fd;
+    dev_t dev;
+    int64_t pos;
+    int64_t size;
+    atomic_int dirty;           //有数据写入fd但还没有fsync
+    atomic_int error;           //刷盘失败的errno,之后的写入,mux_io_sync和mux_io_close都返回失败
+    AVIOContext *pb;
+    char *filename;
+
+    //第一次seek超过文件末尾跳过的区域,比如mov预留的moov
+    int64_t hole_pos;
+    int64_t hole_size;
+
+    //sync_group使用
+    struct mux_io *next;
+    int sync_interval_ms;
+
+    //mux_manager使用,不为NULL时异步写入
+    struct mux_io_queue *queue;
+} mux_io_t;
+
+/**
+ * @brief 创建文件并生成可写可seek的AVIOContext
+ *
+ * @param filename: 文件名字
+ * @param buffer_size: avio缓冲区大小,<=0使用默认32K
+ * @return mux_io_t*: NULL失败
+ */
+mux_io_t *mux_io_open(const char *filename, int buffer_size);
+
+/**
+ * @brief 刷新avio缓冲区,等待异步写入完成,关闭文件,释放AVIOContext
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 <0(AVERROR)第一个错误: 异步写入失败,avio写入失败,close失败
+ */
+int mux_io_close(mux_io_t **io);
+
+/**
+ * @brief 在offset写入一块数据并标记为脏,可以在其他线程调用
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 写入的字节数 <0失败
+ */
+int mux_io_write_at(mux_io_t *io, const uint8_t *buf, int size, int64_t offset);
+
+/**
+ * @brief 刷新avio缓冲区,等待异步写入完成并fdatasync, 只能在写线程调用
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 其他失败
+ */
+int mux_io_sync(mux_io_t *io);
+
+/**
+ * @brief 只fdatasync已经写到fd的数据,不碰avio缓冲区,可以在其他线程调用
+ *   失败之后(包括sync_group线程的失败)一直返回失败,数据可能已经丢失,不能靠重试恢复
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 其他失败
+ */
+int mux_io_sync_fd(mux_io_t *io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MUX_IO_H
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "libavutil/error.h"
+
+#include <log.h>
+
+#include "mux_manager.h"
+#include "trace.h"
+
+#define MUX_MANAGER_DEFAULT_THREADS     4
+#define MUX_MANAGER_DEFAULT_MEMORY      (256 * 1024 * 1024LL)
+#define MUX_MANAGER_DEFAULT_PER_MUXER   (4 * 1024 * 1024LL)
+#define MUX_MANAGER_REQ_SIZE            (32 * 1024)
+#define MUX_MANAGER_MAX_FREE            256
+
+typedef struct mux_io_req {
+    struct mux_io_req *next;
+    int64_t offset;
+    int size;
+    int capacity;
+    uint8_t data[];
+} mux_io_req_t;
+
+struct mux_io_queue {
+    mux_manager_t *manager;
+    mux_io_t *io;
+    mux_io_req_t *head;
+    mux_io_req_t *tail;
+    int64_t bytes;
+    int scheduled;                  //在就绪队列中或者正在被写线程处理
+    int error;
+    struct mux_io_queue *next;      //就绪队列
+};
+
+struct mux_manager {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;       //写线程等待数据
+    pthread_cond_t space_cond;      //写入方等待内存,drain等待写完
+    pthread_t threads[MUX_MANAGER_MAX_THREADS];
+    int nb_threads;
+    int quit;
+    int64_t max_memory;
+    int64_t max_per_muxer;
+    int64_t bytes;
+    struct mux_io_queue *ready_head;
+    struct mux_io_queue *ready_tail;
+    mux_io_req_t *free_reqs;
+    int nb_free;
+    int nb_ios;
+};
+
+static void __mux_manager_ready(mux_manager_t *mgr, struct mux_io_queue *q)
+{
+    q->next = NULL;
+    if (mgr->ready_tail != NULL)
+        mgr->ready_tail->next = q;
+    else
+        mgr->ready_head = q;
+    mgr->ready_tail = q;
+
+    pthread_cond_signal(&mgr->work_cond);
+}
+
+static void __mux_manager_recycle(mux_manager_t *mgr, mux_io_req_t *req)
+{
+    mux_io_req_t *next = NULL;
+
+    for (; req != NULL; req = next) {
+        next = req->next;
+        //只复用默认大小的块,大块直接释放
+        if (req->capacity == MUX_MANAGER_REQ_SIZE && mgr->nb_free < MUX_MANAGER_MAX_FREE) {
+            req->next = mgr->free_reqs;
+            mgr->free_reqs = req;
+            mgr->nb_free++;
+        } else {
+            free(req);
+        }
+    }
+}
+
+static void *__mux_manager_thread(void *arg)
+{
+    mux_manager_t *mgr = (mux_manager_t *)arg;
+    struct mux_io_queue *q = NULL;
+    mux_io_req_t *batch = NULL, *last = NULL, *req = NULL;
+    int64_t taken = 0;
+    int error = 0;
+
+    TRACE_THREAD_NAME("mux_manager io");
+    pthread_mutex_lock(&mgr->mutex);
+
+    for (;;) {
+        while (mgr->ready_head == NULL && !mgr->quit)
+            pthread_cond_wait(&mgr->work_cond, &mgr->mutex);
+
+        if (mgr->ready_head == NULL)
+            break;
+
+        q = mgr->ready_head;
+        mgr->ready_head = q->next;
+        if (mgr->ready_head == NULL)
+            mgr->ready_tail = NULL;
+
+        //每次只写一部分,写完放回队尾,数据多的文件不会饿死其他文件
+        batch = q->head;
+        taken = 0;
+        for (last = batch; ; last = last->next) {
+            taken += last->size;
+            if (last->next == NULL || taken >= MUX_MANAGER_BATCH_BYTES)
+                break;
+        }
+        q->head = last->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+        last->next = NULL;
+        error = q->error;
+
+        pthread_mutex_unlock(&mgr->mutex);
+
+        TRACE_BEGIN(write_begin);
+        for (req = batch; req != NULL && error == 0; req = req->next) {
+            if (mux_io_write_at(q->io, req->data, req->size, req->offset) != req->size)
+                error = AVERROR(EIO);
+        }
+        TRACE_END(write_begin, "mux_io_write", "io");
+
+        pthread_mutex_lock(&mgr->mutex);
+
+        if (error != 0 && q->error == 0) {
+            LOG("async write '%s' failed\n", q->io->filename);
+            q->error = error;
+        }
+
+        q->bytes -= taken;
+        mgr->bytes -= taken;
+        __mux_manager_recycle(mgr, batch);
+
+        if (q->head != NULL)
+            __mux_manager_ready(mgr, q);
+        else
+            q->scheduled = 0;
+
+        pthread_cond_broadcast(&mgr->space_cond);
+    }
+
+    pthread_mutex_unlock(&mgr->mutex);
+
+    return NULL;
+}
+
+mux_manager_t *mux_manager_create(int nb_threads, int64_t max_memory, int64_t max_per_muxer)
+{
+    mux_manager_t *mgr = NULL;
+    int i = 0;
+
+    if (nb_threads <= 0)
+        nb_threads = MUX_MANAGER_DEFAULT_THREADS;
+    if (nb_threads > MUX_MANAGER_MAX_THREADS)
+        nb_threads = MUX_MANAGER_MAX_THREADS;
+    if (max_memory <= 0)
+        max_memory = MUX_MANAGER_DEFAULT_MEMORY;
+    if (max_per_muxer <= 0)
+        max_per_muxer = MUX_MANAGER_DEFAULT_PER_MUXER;
+
+    mgr = (mux_manager_t *)calloc(1, sizeof(mux_manager_t));
+    if (mgr == NULL)
+        return NULL;
+
+    pthread_mutex_init(&mgr->mutex, NULL);
+    pthread_cond_init(&mgr->work_cond, NULL);
+    pthread_cond_init(&mgr->space_cond, NULL);
+    mgr->max_memory = max_memory;
+    mgr->max_per_muxer = max_per_muxer;
+
+    for (i = 0; i < nb_threads; i++) {
+        if (pthread_create(&mgr->threads[i], NULL, __mux_manager_thread, mgr) != 0) {
+            LOG("create mux manager thread failed\n");
+            break;
+        }
+        mgr->nb_threads++;
+    }
+
+    if (mgr->nb_threads == 0) {
+        mux_manager_destroy(&mgr);
+        return NULL;
+    }
+
+    return mgr;
+}
+
+void mux_manager_destroy(mux_manager_t **manager)
+{
+    mux_manager_t *mgr = NULL;
+    mux_io_req_t *req = NULL;
+    int i = 0;
+
+    if (manager == NULL || *manager == NULL)
+        return;
+
+    mgr = *manager;
+
+    pthread_mutex_lock(&mgr->mutex);
+    if (mgr->nb_ios != 0)
+        LOG("mux manager destroyed with %d files attached\n", mgr->nb_ios);
+    mgr->quit = 1;
+    pthread_cond_broadcast(&mgr->work_cond);
+    pthread_mutex_unlock(&mgr->mutex);
+
+    for (i = 0; i < mgr->nb_threads; i++)
+        pthread_join(mgr->threads[i], NULL);
+
+    while ((req = mgr->free_reqs) != NULL) {
+        mgr->free_reqs = req->next;
+        free(req);
+    }
+
+    pthread_cond_destroy(&mgr->space_cond);
+    pthread_cond_destroy(&mgr->work_cond);
+    pthread_mutex_destroy(&mgr->mutex);
+    free(mgr);
+    *manager = NULL;
+}
+
+int mux_manager_attach(mux_manager_t *manager, mux_io_t *io)
+{
+    struct mux_io_queue *q = NULL;
+
+    if (manager == NULL || io == NULL || io->queue != NULL)
+        return -1;
+
+    q = (struct mux_io_queue *)calloc(1, sizeof(struct mux_io_queue));
+    if (q == NULL)
+        return -2;
+
+    q->manager = manager;
+    q->io = io;
+
+    //已经在avio缓冲区里的数据之后由线程池写
+    pthread_mutex_lock(&manager->mutex);
+    manager->nb_ios++;
+    io->queue = q;
+    pthread_mutex_unlock(&manager->mutex);
+
+    return 0;
+}
+
+int mux_manager_detach(mux_io_t *io)
+{
+    struct mux_io_queue *q = NULL;
+    mux_manager_t *mgr = NULL;
+    int ret = 0;
+
+    if (io == NULL || io->queue == NULL)
+        return 0;
+
+    ret = mux_manager_drain(io);
+
+    q = io->queue;
+    mgr = q->manager;
+
+    pthread_mutex_lock(&mgr->mutex);
+
+    //写失败之后drain不等待,这里等写线程放手
+    while (q->scheduled)
+        pthread_cond_wait(&mgr->space_cond, &mgr->mutex);
+
+    mgr->bytes -= q->bytes;
+    __mux_manager_recycle(mgr, q->head);
+    mgr->nb_ios--;
+    io->queue = NULL;
+
+    pthread_cond_broadcast(&mgr->space_cond);
+    pthread_mutex_unlock(&mgr->mutex);
+
+    free(q);
+
+    return ret;
+}
+
+int mux_manager_submit(mux_io_t *io, const uint8_t *buf, int size, int64_t offset)
+{
+    struct mux_io_queue *q = io->queue;
+    mux_manager_t *mgr = q->manager;
+    mux_io_req_t *req = NULL;
+    int ret = 0;
+
+    pthread_mutex_lock(&mgr->mutex);
+
+    //内存超出时阻塞写入方,队列为空时总是允许,避免超大的块永远等待
+    while (q->error == 0 &&
+           ((mgr->bytes > 0 && mgr->bytes + size > mgr->max_memory) ||
+            (q->bytes > 0 && q->bytes + size > mgr->max_per_muxer)))
+        pthread_cond_wait(&mgr->space_cond, &mgr->mutex);
+
+    if (q->error != 0) {
+        ret = q->error;
+        goto unlock;
+    }
+
+    if (size <= MUX_MANAGER_REQ_SIZE && mgr->free_reqs != NULL) {
+        req = mgr->free_reqs;
+        mgr->free_reqs = req->next;
+        mgr->nb_free--;
+    }
+
+    q->bytes += size;
+    mgr->bytes += size;
+
+    pthread_mutex_unlock(&mgr->mutex);
+
+    //拷贝不占锁
+    if (req == NULL) {
+        int capacity = size > MUX_MANAGER_REQ_SIZE ? size : MUX_MANAGER_REQ_SIZE;
+        req = (mux_io_req_t *)malloc(sizeof(mux_io_req_t) + capacity);
+        if (req != NULL)
+            req->capacity = capacity;
+    }
+
+    if (req != NULL) {
+        memcpy(req->data, buf, size);
+        req->offset = offset;
+        req->size = size;
+        req->next = NULL;
+    }
+
+    pthread_mutex_lock(&mgr->mutex);
+
+    if (req == NULL) {
+        q->bytes -= size;
+        mgr->bytes -= size;
+        pthread_cond_broadcast(&mgr->space_cond);
+        ret = AVERROR(ENOMEM);
+        goto unlock;
+    }
+
+    if (q->tail != NULL)
+        q->tail->next = req;
+    else
+        q->head = req;
+    q->tail = req;
+
+    if (!q->scheduled) {
+        q->scheduled = 1;
+        __mux_manager_ready(mgr, q);
+    }
+
+unlock:
+    pthread_mutex_unlock(&mgr->mutex);
+
+    return ret;
+}
+
+int mux_manager_drain(mux_io_t *io)
+{
+    struct mux_io_queue *q = NULL;
+    mux_manager_t *mgr = NULL;
+    int ret = 0;
+
+    if (io == NULL || io->queue == NULL)
+        return 0;
+
+    q = io->queue;
+    mgr = q->manager;
+
+    pthread_mutex_lock(&mgr->mutex);
+
+    while (q->scheduled && q->error == 0)
+        pthread_cond_wait(&mgr->space_cond, &mgr->mutex);
+
+    ret = q->error;
+
+    pthread_mutex_unlock(&mgr->mutex);
+
+    return ret;
+}
+
+int64_t mux_manager_get_pending(mux_manager_t *manager)
+{
+    int64_t bytes = 0;
+
+    if (manager == NULL)
+        return -1;
+
+    pthread_mutex_lock(&manager->mutex);
+    bytes = manager->bytes;
+    pthread_mutex_unlock(&manager->mutex);
+
+    return bytes;
+}
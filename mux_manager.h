@@ -0,0 +1,86 @@
+#ifndef __MUX_MANAGER_H
+#define __MUX_MANAGER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "mux_io.h"
+
+/**
+ * @brief 多路录像共享的I/O线程池
+ *   每个muxer的avio缓冲区满时只把数据拷贝到自己的队列,由少量写线程pwrite到文件,
+ *   写线程按轮询方式服务有数据的文件,每次最多写MUX_MANAGER_BATCH_BYTES,
+ *   一个文件同一时间只有一个线程在写,
+ *   所有文件排队的数据超过max_memory,或者单个文件超过max_per_muxer时,写入方阻塞等待
+ */
+struct mux_manager;
+typedef struct mux_manager mux_manager_t;
+
+#define MUX_MANAGER_MAX_THREADS 64
+#define MUX_MANAGER_BATCH_BYTES (256 * 1024)
+
+/**
+ * @brief 创建线程池
+ *
+ * @param nb_threads: 写线程个数,<=0使用默认值4
+ * @param max_memory: 所有文件最多排队多少字节,<=0使用默认值256M
+ * @param max_per_muxer: 单个文件最多排队多少字节,<=0使用默认值4M
+ * @return mux_manager_t*: NULL失败
+ */
+mux_manager_t *mux_manager_create(int nb_threads, int64_t max_memory, int64_t max_per_muxer);
+
+/**
+ * @brief 停止写线程,摧毁线程池,调用前所有使用它的muxer必须已经关闭
+ *
+ * @param manager
+ */
+void mux_manager_destroy(mux_manager_t **manager);
+
+/**
+ * @brief 文件改为由线程池异步写入,之后avio写入的数据都进入队列
+ *
+ * @param manager: mux_manager_create返回值
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 其他失败
+ */
+int mux_manager_attach(mux_manager_t *manager, mux_io_t *io);
+
+/**
+ * @brief 等待文件的队列写完,然后改回同步写入. mux_io_close会自动调用
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 <0之前的异步写入失败
+ */
+int mux_manager_detach(mux_io_t *io);
+
+/**
+ * @brief 把一块数据放入文件的队列,mux_io内部使用
+ *
+ * @return int: 0成功 <0之前的异步写入失败(AVERROR)
+ */
+int mux_manager_submit(mux_io_t *io, const uint8_t *buf, int size, int64_t offset);
+
+/**
+ * @brief 等待文件的队列写完
+ *
+ * @param io: mux_io_open返回值
+ * @return int: 0成功 <0异步写入失败(AVERROR)
+ */
+int mux_manager_drain(mux_io_t *io);
+
+/**
+ * @brief 获取所有文件当前排队的字节数
+ *
+ * @param manager: mux_manager_create返回值
+ * @return int64_t: 字节数 <0失败
+ */
+int64_t mux_manager_get_pending(mux_manager_t *manager);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MUX_MANAGER_H
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <limits.h>
+
+#include "libavutil/avutil.h"
+#include "libavutil/mathematics.h"
+
+#include "mux_ts.h"
+
+static void __mux_ts_ratio(int64_t num, int64_t den, int64_t *out_num, int64_t *out_den)
+{
+    int n = 0, d = 0;
+
+    //num/den都是两个int的乘积,av_reduce失败时用原值
+    if (av_reduce(&n, &d, num, den, INT_MAX)) {
+        *out_num = n;
+        *out_den = d;
+    } else {
+        *out_num = num;
+        *out_den = den;
+    }
+}
+
+void mux_ts_init(mux_ts_t *ts, AVRational in_tb, AVRational out_tb, AVRational duration)
+{
+    ts->out_tb = out_tb;
+
+    __mux_ts_ratio((int64_t)in_tb.num * out_tb.den, (int64_t)in_tb.den * out_tb.num,
+                   &ts->scale_num, &ts->scale_den);
+
+    if (duration.num <= 0 || duration.den <= 0)
+        duration = (AVRational){1, 25};
+
+    __mux_ts_ratio((int64_t)duration.num * out_tb.den, (int64_t)duration.den * out_tb.num,
+                   &ts->dur_num, &ts->dur_den);
+
+    ts->first_in = AV_NOPTS_VALUE;
+    ts->prev_in = AV_NOPTS_VALUE;
+    ts->anchor_out = 0;
+    ts->gen_count = 0;
+    ts->last_dts = AV_NOPTS_VALUE;
+}
+
+void mux_ts_next(mux_ts_t *ts, int64_t pts, int64_t dts, int64_t *out_pts, int64_t *out_dts)
+{
+    int64_t ref = (dts != AV_NOPTS_VALUE) ? dts : pts;
+    int64_t odts = 0, opts = 0;
+
+    if (ts->first_in == AV_NOPTS_VALUE) {
+        ts->first_in = (ref != AV_NOPTS_VALUE) ? ref : 0;
+        ts->prev_in = ts->first_in;
+        ts->anchor_out = 0;
+        ts->gen_count = 0;
+        odts = 0;
+    } else if (ref != AV_NOPTS_VALUE && ref > ts->prev_in) {
+        ts->prev_in = ref;
+        ts->anchor_out = mux_ts_rescale(ts, ref - ts->first_in);
+        ts->gen_count = 0;
+        odts = ts->anchor_out;
+    } else {
+        //调用者没有给时间戳或者时间戳没有增长,按帧时长生成
+        ts->gen_count++;
+        odts = ts->anchor_out + (ts->dur_den == 1 ? ts->gen_count * ts->dur_num :
+                                 av_rescale(ts->gen_count, ts->dur_num, ts->dur_den));
+    }
+
+    //B帧: pts和dts的差值单独换算,开头的dts可以是负数
+    if (dts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && pts >= dts)
+        opts = odts + mux_ts_rescale(ts, pts - dts);
+    else
+        opts = odts;
+
+    if (ts->last_dts != AV_NOPTS_VALUE && odts <= ts->last_dts)
+        odts = ts->last_dts + 1;
+    if (opts < odts)
+        opts = odts;
+
+    ts->last_dts = odts;
+
+    *out_pts = opts;
+    *out_dts = odts;
+}
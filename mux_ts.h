@@ -0,0 +1,63 @@
+#ifndef __MUX_TS_H
+#define __MUX_TS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libavutil/rational.h>
+#include <libavutil/mathematics.h>
+
+/**
+ * @brief 一路流的时间戳生成,全部用整数有理数计算
+ *   输入时间戳(比如毫秒)到输出时间基的比例在初始化时算好,
+ *   每个packet只做一次乘法或一次av_rescale
+ *   自动生成的时间戳按"最近一个有效时间戳 + n * 帧时长"计算,不会累积误差
+ */
+typedef struct mux_ts {
+    AVRational out_tb;
+    int64_t scale_num;          //out = in * scale_num / scale_den
+    int64_t scale_den;
+    int64_t dur_num;            //第n个自动帧 = n * dur_num / dur_den
+    int64_t dur_den;
+
+    int64_t first_in;
+    int64_t prev_in;
+    int64_t anchor_out;
+    int64_t gen_count;
+    int64_t last_dts;
+} mux_ts_t;
+
+/**
+ * @brief 初始化
+ *
+ * @param in_tb: 调用者时间戳的时间基,比如{1, 1000}
+ * @param out_tb: 输出流的时间基(avformat_write_header之后的)
+ * @param duration: 每帧时长(秒),视频为1/fps,音频为frame_size/sample_rate
+ */
+void mux_ts_init(mux_ts_t *ts, AVRational in_tb, AVRational out_tb, AVRational duration);
+
+/**
+ * @brief 把调用者时间戳转换到输出时间基
+ */
+static inline int64_t mux_ts_rescale(const mux_ts_t *ts, int64_t in)
+{
+    return ts->scale_den == 1 ? in * ts->scale_num : av_rescale(in, ts->scale_num, ts->scale_den);
+}
+
+/**
+ * @brief 计算下一个packet的输出pts/dts,第一个packet从0开始
+ *
+ * @param pts: 显示时间戳,AV_NOPTS_VALUE表示自动生成
+ * @param dts: 解码时间戳,AV_NOPTS_VALUE表示和pts相同(没有B帧),有B帧时开头的dts可以是负数
+ * @param out_pts: 输出pts(输出时间基)
+ * @param out_dts: 输出dts(输出时间基),保证单调递增
+ */
+void mux_ts_next(mux_ts_t *ts, int64_t pts, int64_t dts, int64_t *out_pts, int64_t *out_dts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__MUX_TS_H
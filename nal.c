@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "libavutil/mem.h"
+#include "libavutil/intreadwrite.h"
+
+#include "nal.h"
+
+#define NAL_RBSP_MAX_SIZE   512
+
+//参数集和SEI一般不超过几百字节,超过这个范围还没找到slice就不判断了
+#define NAL_KEYFRAME_SCAN_MAX   4096
+
+typedef struct bit_reader {
+    const uint8_t *data;
+    int size;
+    int index;      //bit
+} bit_reader_t;
+
+static inline int __br_read(bit_reader_t *br, int n)
+{
+    int v = 0;
+
+    while (n-- > 0) {
+        int byte = br->index >> 3;
+        v <<= 1;
+        if (byte < br->size)
+            v |= (br->data[byte] >> (7 - (br->index & 7))) & 1;
+        br->index++;
+    }
+
+    return v;
+}
+
+static inline void __br_skip(bit_reader_t *br, int n)
+{
+    br->index += n;
+}
+
+static inline int __br_read_ue(bit_reader_t *br)
+{
+    int zeros = 0;
+
+    while (__br_read(br, 1) == 0 && zeros < 31 && (br->index >> 3) < br->size)
+        zeros++;
+
+    return (1 << zeros) - 1 + __br_read(br, zeros);
+}
+
+//去掉防竞争字节00 00 03
+static int __nal_to_rbsp(const uint8_t *src, int size, uint8_t *dst, int dst_size)
+{
+    int i = 0, n = 0, zeros = 0;
+
+    for (i = 0; i < size && n < dst_size; i++) {
+        if (zeros >= 2 && src[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        zeros = (src[i] == 0) ? zeros + 1 : 0;
+        dst[n++] = src[i];
+    }
+
+    return n;
+}
+
+int nal_is_annexb(const uint8_t *data, int size)
+{
+    if (data == NULL || size < 4)
+        return 0;
+
+    return (data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+           (data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+}
+
+/**
+ * 一次检查8个字节里有没有0,没有0的话不可能有起始码,
+ * 视频数据里0很少,绝大部分时间都在这个快速路径上
+ */
+#define HAS_ZERO_BYTE(x)    (((x) - 0x0101010101010101ULL) & ~(x) & 0x8080808080808080ULL)
+
+const uint8_t *nal_find_startcode(const uint8_t *p, const uint8_t *end)
+{
+    uint64_t x = 0;
+    int i = 0;
+
+    while (p + 10 <= end) {
+        memcpy(&x, p, 8);
+        if (HAS_ZERO_BYTE(x)) {
+            for (i = 0; i < 8; i++) {
+                if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+                    return p + i;
+            }
+        }
+        p += 8;
+    }
+
+    for (; p + 2 < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+
+    return end;
+}
+
+int nal_next(enum AVCodecID codec_id, const uint8_t **p, const uint8_t *end, nal_unit_t *nal)
+{
+    const uint8_t *start = nal_find_startcode(*p, end);
+    const uint8_t *next = NULL;
+    int size = 0;
+
+    while (start < end) {
+        start += 3;
+        next = nal_find_startcode(start, end);
+
+        //去掉尾部的0(4字节起始码的第一个0或trailing_zero_8bits)
+        size = next - start;
+        while (size > 0 && start[size - 1] == 0)
+            size--;
+
+        *p = next;
+
+        if (size > 0) {
+            nal->data = start;
+            nal->size = size;
+            nal->type = nal_type(codec_id, start);
+            return 1;
+        }
+
+        start = next;
+    }
+
+    *p = end;
+
+    return 0;
+}
+
+int nal_is_param_set(enum AVCodecID codec_id, int type)
+{
+    if (codec_id == AV_CODEC_ID_HEVC)
+        return type == NAL_HEVC_VPS || type == NAL_HEVC_SPS || type == NAL_HEVC_PPS;
+
+    return type == NAL_H264_SPS || type == NAL_H264_PPS;
+}
+
+static int __nal_vcl_is_key(enum AVCodecID codec_id, int type)
+{
+    if (codec_id == AV_CODEC_ID_HEVC) {
+        if (type >= 32)
+            return -1;
+        //BLA/IDR/CRA以及保留的IRAP类型
+        return type >= NAL_HEVC_BLA_W_LP && type <= 23;
+    }
+
+    if (type < NAL_H264_SLICE || type > NAL_H264_IDR)
+        return -1;
+
+    return type == NAL_H264_IDR;
+}
+
+int nal_is_keyframe(enum AVCodecID codec_id, const uint8_t *data, int size)
+{
+    const uint8_t *p = data, *end = NULL;
+    uint32_t nal_size = 0;
+    int key = -1;
+
+    if (data == NULL || size <= 0 || (codec_id != AV_CODEC_ID_H264 && codec_id != AV_CODEC_ID_HEVC))
+        return -1;
+
+    end = data + (size < NAL_KEYFRAME_SCAN_MAX ? size : NAL_KEYFRAME_SCAN_MAX);
+
+    if (nal_is_annexb(data, size)) {
+        //只需要每个nal的头,找到第一个slice就返回,不会扫描slice数据
+        while ((p = nal_find_startcode(p, end)) < end && p + 3 < end) {
+            p += 3;
+            key = __nal_vcl_is_key(codec_id, nal_type(codec_id, p));
+            if (key >= 0)
+                return key;
+        }
+    } else {
+        //4字节长度前缀
+        while (p + 5 <= end) {
+            nal_size = AV_RB32(p);
+            key = __nal_vcl_is_key(codec_id, nal_type(codec_id, p + 4));
+            if (key >= 0)
+                return key;
+            if (nal_size > (uint32_t)(data + size - p - 4))
+                break;
+            p += 4 + nal_size;
+        }
+    }
+
+    return -1;
+}
+
+void nal_param_sets_free(nal_param_sets_t *ps)
+{
+    int i = 0;
+
+    if (ps == NULL)
+        return;
+
+    for (i = 0; i < ps->count; i++)
+        av_freep(&ps->ps[i].data);
+
+    ps->count = 0;
+}
+
+int nal_param_sets_equal(const nal_param_sets_t *a, const nal_param_sets_t *b)
+{
+    int i = 0;
+
+    if (a->count != b->count)
+        return 0;
+
+    for (i = 0; i < a->count; i++) {
+        if (a->ps[i].type != b->ps[i].type || a->ps[i].size != b->ps[i].size ||
+            memcmp(a->ps[i].data, b->ps[i].data, a->ps[i].size) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+int nal_extract_param_sets(enum AVCodecID codec_id, const uint8_t *data, int size, nal_param_sets_t *ps)
+{
+    const uint8_t *p = data, *end = data + size;
+    nal_unit_t nal;
+    int i = 0, dup = 0;
+
+    if (data == NULL || ps == NULL)
+        return -1;
+
+    ps->count = 0;
+
+    while (nal_next(codec_id, &p, end, &nal)) {
+        if (!nal_is_param_set(codec_id, nal.type)) {
+            //参数集都在第一个slice之前
+            if (ps->count > 0)
+                break;
+            continue;
+        }
+
+        for (i = 0, dup = 0; i < ps->count; i++) {
+            if (ps->ps[i].size == nal.size && memcmp(ps->ps[i].data, nal.data, nal.size) == 0) {
+                dup = 1;
+                break;
+            }
+        }
+
+        if (dup || ps->count >= NAL_MAX_PARAM_SETS)
+            continue;
+
+        ps->ps[ps->count].data = av_malloc(nal.size);
+        if (ps->ps[ps->count].data == NULL) {
+            nal_param_sets_free(ps);
+            return -2;
+        }
+        memcpy(ps->ps[ps->count].data, nal.data, nal.size);
+        ps->ps[ps->count].size = nal.size;
+        ps->ps[ps->count].type = nal.type;
+        ps->count++;
+    }
+
+    return ps->count;
+}
+
+static int __nal_count(const nal_param_sets_t *ps, int type)
+{
+    int i = 0, n = 0;
+
+    for (i = 0; i < ps->count; i++) {
+        if (ps->ps[i].type == type)
+            n++;
+    }
+
+    return n;
+}
+
+static uint8_t *__nal_write_array(uint8_t *p, const nal_param_sets_t *ps, int type)
+{
+    int i = 0;
+
+    for (i = 0; i < ps->count; i++) {
+        if (ps->ps[i].type != type)
+            continue;
+        AV_WB16(p, ps->ps[i].size);
+        memcpy(p + 2, ps->ps[i].data, ps->ps[i].size);
+        p += 2 + ps->ps[i].size;
+    }
+
+    return p;
+}
+
+static const nal_param_set_t *__nal_first(const nal_param_sets_t *ps, int type)
+{
+    int i = 0;
+
+    for (i = 0; i < ps->count; i++) {
+        if (ps->ps[i].type == type)
+            return &ps->ps[i];
+    }
+
+    return NULL;
+}
+
+int nal_build_avcc(const nal_param_sets_t *ps, uint8_t **out, int *out_size)
+{
+    const nal_param_set_t *sps = __nal_first(ps, NAL_H264_SPS);
+    int nb_sps = __nal_count(ps, NAL_H264_SPS);
+    int nb_pps = __nal_count(ps, NAL_H264_PPS);
+    int i = 0, size = 7;
+    uint8_t *buf = NULL, *p = NULL;
+
+    if (sps == NULL || sps->size < 4 || nb_pps == 0)
+        return -1;
+
+    for (i = 0; i < ps->count; i++)
+        size += 2 + ps->ps[i].size;
+
+    buf = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (buf == NULL)
+        return -2;
+
+    p = buf;
+    *p++ = 1;                   //configurationVersion
+    *p++ = sps->data[1];        //AVCProfileIndication
+    *p++ = sps->data[2];        //profile_compatibility
+    *p++ = sps->data[3];        //AVCLevelIndication
+    *p++ = 0xff;                //lengthSizeMinusOne = 3
+    *p++ = 0xe0 | nb_sps;
+    p = __nal_write_array(p, ps, NAL_H264_SPS);
+    *p++ = nb_pps;
+    p = __nal_write_array(p, ps, NAL_H264_PPS);
+
+    *out = buf;
+    *out_size = p - buf;
+
+    return 0;
+}
+
+int nal_build_hvcc(const nal_param_sets_t *ps, uint8_t **out, int *out_size)
+{
+    static const int types[3] = { NAL_HEVC_VPS, NAL_HEVC_SPS, NAL_HEVC_PPS };
+    const nal_param_set_t *sps = __nal_first(ps, NAL_HEVC_SPS);
+    uint8_t rbsp[NAL_RBSP_MAX_SIZE];
+    bit_reader_t br;
+    int max_sub_layers_minus1 = 0, temporal_id_nesting = 0;
+    int profile_present[8], level_present[8];
+    int chroma_format_idc = 1, bit_depth_luma = 0, bit_depth_chroma = 0;
+    uint8_t ptl[12];
+    int i = 0, size = 23, arrays = 0;
+    uint8_t *buf = NULL, *p = NULL;
+
+    if (sps == NULL || __nal_count(ps, NAL_HEVC_VPS) == 0 || __nal_count(ps, NAL_HEVC_PPS) == 0)
+        return -1;
+
+    br.data = rbsp;
+    br.size = __nal_to_rbsp(sps->data, sps->size, rbsp, sizeof(rbsp));
+    br.index = 16;      //nal头
+
+    __br_skip(&br, 4);  //sps_video_parameter_set_id
+    max_sub_layers_minus1 = __br_read(&br, 3);
+    temporal_id_nesting = __br_read(&br, 1);
+
+    //general_profile_tier_level原样拷贝到hvcC
+    for (i = 0; i < 12; i++)
+        ptl[i] = __br_read(&br, 8);
+
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        profile_present[i] = __br_read(&br, 1);
+        level_present[i] = __br_read(&br, 1);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        for (i = max_sub_layers_minus1; i < 8; i++)
+            __br_skip(&br, 2);
+    }
+    for (i = 0; i < max_sub_layers_minus1; i++) {
+        if (profile_present[i])
+            __br_skip(&br, 88);
+        if (level_present[i])
+            __br_skip(&br, 8);
+    }
+
+    __br_read_ue(&br);  //sps_seq_parameter_set_id
+    chroma_format_idc = __br_read_ue(&br);
+    if (chroma_format_idc == 3)
+        __br_skip(&br, 1);
+    __br_read_ue(&br);  //pic_width_in_luma_samples
+    __br_read_ue(&br);  //pic_height_in_luma_samples
+    if (__br_read(&br, 1)) {
+        for (i = 0; i < 4; i++)
+            __br_read_ue(&br);
+    }
+    bit_depth_luma = __br_read_ue(&br);
+    bit_depth_chroma = __br_read_ue(&br);
+
+    if ((br.index >> 3) > br.size)
+        return -3;
+
+    for (i = 0; i < ps->count; i++)
+        size += 2 + ps->ps[i].size;
+    size += 3 * 3;
+
+    buf = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (buf == NULL)
+        return -2;
+
+    p = buf;
+    *p++ = 1;                               //configurationVersion
+    memcpy(p, ptl, 12);                     //profile/tier/compat/constraint/level
+    p += 12;
+    AV_WB16(p, 0xf000);                     //min_spatial_segmentation_idc
+    p += 2;
+    *p++ = 0xfc;                            //parallelismType
+    *p++ = 0xfc | (chroma_format_idc & 3);
+    *p++ = 0xf8 | (bit_depth_luma & 7);
+    *p++ = 0xf8 | (bit_depth_chroma & 7);
+    AV_WB16(p, 0);                          //avgFrameRate
+    p += 2;
+    *p++ = ((max_sub_layers_minus1 + 1) & 7) << 3 | temporal_id_nesting << 2 | 3;
+
+    for (i = 0; i < 3; i++) {
+        if (__nal_count(ps, types[i]) > 0)
+            arrays++;
+    }
+    *p++ = arrays;
+
+    for (i = 0; i < 3; i++) {
+        int n = __nal_count(ps, types[i]);
+        if (n == 0)
+            continue;
+        *p++ = 0x80 | types[i];             //array_completeness
+        AV_WB16(p, n);
+        p += 2;
+        p = __nal_write_array(p, ps, types[i]);
+    }
+
+    *out = buf;
+    *out_size = p - buf;
+
+    return 0;
+}
+
+int nal_annexb_to_mp4(enum AVCodecID codec_id, const uint8_t *in, int size, uint8_t *out, int strip_ps)
+{
+    const uint8_t *p = in, *end = in + size;
+    uint8_t *o = out;
+    nal_unit_t nal;
+
+    while (nal_next(codec_id, &p, end, &nal)) {
+        if (strip_ps && nal_is_param_set(codec_id, nal.type))
+            continue;
+        AV_WB32(o, nal.size);
+        memcpy(o + 4, nal.data, nal.size);
+        o += 4 + nal.size;
+    }
+
+    return o - out;
+}
@@ -0,0 +1,152 @@
+#ifndef __NAL_H
+#define __NAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+enum NAL_H264_TYPE {
+    NAL_H264_SLICE      = 1,
+    NAL_H264_IDR        = 5,
+    NAL_H264_SEI        = 6,
+    NAL_H264_SPS        = 7,
+    NAL_H264_PPS        = 8,
+    NAL_H264_AUD        = 9,
+};
+
+enum NAL_HEVC_TYPE {
+    NAL_HEVC_BLA_W_LP   = 16,
+    NAL_HEVC_BLA_W_RADL = 17,
+    NAL_HEVC_BLA_N_LP   = 18,
+    NAL_HEVC_IDR_W_RADL = 19,
+    NAL_HEVC_IDR_N_LP   = 20,
+    NAL_HEVC_CRA        = 21,
+    NAL_HEVC_VPS        = 32,
+    NAL_HEVC_SPS        = 33,
+    NAL_HEVC_PPS        = 34,
+    NAL_HEVC_AUD        = 35,
+};
+
+#define NAL_MAX_PARAM_SETS  8
+
+typedef struct nal_unit {
+    const uint8_t *data;    //指向nal头,不包含起始码
+    int size;
+    int type;
+} nal_unit_t;
+
+typedef struct nal_param_set {
+    int type;
+    int size;
+    uint8_t *data;
+} nal_param_set_t;
+
+/**
+ * @brief 一个关键帧里的VPS/SPS/PPS
+ */
+typedef struct nal_param_sets {
+    int count;
+    nal_param_set_t ps[NAL_MAX_PARAM_SETS];
+} nal_param_sets_t;
+
+/**
+ * @brief 数据是否以annexb起始码(00 00 01或00 00 00 01)开头
+ */
+int nal_is_annexb(const uint8_t *data, int size);
+
+/**
+ * @brief 查找下一个00 00 01起始码,按8字节一组扫描
+ *
+ * @return const uint8_t*: 起始码位置,没有找到返回end
+ */
+const uint8_t *nal_find_startcode(const uint8_t *p, const uint8_t *end);
+
+/**
+ * @brief 遍历annexb数据中的nal
+ *
+ * @param codec_id: AV_CODEC_ID_H264或AV_CODEC_ID_HEVC
+ * @param p: 当前位置,调用后指向下一个起始码
+ * @param end: 数据结尾
+ * @param nal: 输出的nal
+ * @return int: 1找到 0没有了
+ */
+int nal_next(enum AVCodecID codec_id, const uint8_t **p, const uint8_t *end, nal_unit_t *nal);
+
+/**
+ * @brief nal类型
+ */
+static inline int nal_type(enum AVCodecID codec_id, const uint8_t *nal)
+{
+    return codec_id == AV_CODEC_ID_HEVC ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+/**
+ * @brief 是否VPS/SPS/PPS
+ */
+int nal_is_param_set(enum AVCodecID codec_id, int type);
+
+/**
+ * @brief 根据第一个slice的nal类型判断是否关键帧(H.264 IDR, HEVC IDR/CRA/BLA)
+ *   支持annexb和4字节长度前缀,只检查数据开头的4K
+ *
+ * @param codec_id: AV_CODEC_ID_H264或AV_CODEC_ID_HEVC
+ * @return int: 1关键帧 0非关键帧 -1无法判断
+ */
+int nal_is_keyframe(enum AVCodecID codec_id, const uint8_t *data, int size);
+
+/**
+ * @brief 从annexb关键帧中提取VPS/SPS/PPS, 重复的只保留一份
+ *
+ * @param codec_id: AV_CODEC_ID_H264或AV_CODEC_ID_HEVC
+ * @param data: annexb数据
+ * @param size: 数据长度
+ * @param ps: 输出,使用完调用nal_param_sets_free
+ * @return int: 提取到的个数 <0失败
+ */
+int nal_extract_param_sets(enum AVCodecID codec_id, const uint8_t *data, int size, nal_param_sets_t *ps);
+
+void nal_param_sets_free(nal_param_sets_t *ps);
+
+/**
+ * @brief 两组参数集内容是否完全一致
+ */
+int nal_param_sets_equal(const nal_param_sets_t *a, const nal_param_sets_t *b);
+
+/**
+ * @brief 用SPS/PPS生成AVCDecoderConfigurationRecord(avcC)
+ *
+ * @param out: av_malloc分配,包含AV_INPUT_BUFFER_PADDING_SIZE
+ * @return int: 0成功 其他失败
+ */
+int nal_build_avcc(const nal_param_sets_t *ps, uint8_t **out, int *out_size);
+
+/**
+ * @brief 用VPS/SPS/PPS生成HEVCDecoderConfigurationRecord(hvcC)
+ *
+ * @param out: av_malloc分配,包含AV_INPUT_BUFFER_PADDING_SIZE
+ * @return int: 0成功 其他失败
+ */
+int nal_build_hvcc(const nal_param_sets_t *ps, uint8_t **out, int *out_size);
+
+/**
+ * @brief annexb转换为4字节长度前缀后的最大长度
+ */
+#define NAL_MP4_MAX_SIZE(size)  ((size) + (size) / 3 + 4)
+
+/**
+ * @brief annexb转换为4字节长度前缀格式
+ *
+ * @param out: 至少NAL_MP4_MAX_SIZE(size)大小
+ * @param strip_ps: 1去掉VPS/SPS/PPS(已经在avcC/hvcC里)
+ * @return int: 输出长度
+ */
+int nal_annexb_to_mp4(enum AVCodecID codec_id, const uint8_t *in, int size, uint8_t *out, int strip_ps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__NAL_H
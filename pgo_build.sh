@@ -0,0 +1,48 @@
+#!/bin/sh
+# Linux上PGO+LTO编译库: 插桩编译bench -> 用gen_media生成的文件运行bench训练 -> 用训练数据编译动态库和静态库
+#
+# ./pgo_build.sh [构建目录]     默认_pgo,需要qmake和系统ffmpeg开发包,QMAKE环境变量可以指定qmake
+set -e
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+BUILD=${1:-$SRC/_pgo}
+QMAKE=${QMAKE:-qmake}
+JOBS=$(nproc 2>/dev/null || echo 4)
+
+build() {
+    dir=$1
+    pro=$2
+    shift 2
+    mkdir -p "$dir"
+    (cd "$dir" && "$QMAKE" "$SRC/$pro" CONFIG+=release CONFIG+=ltcg "$@" && make -j"$JOBS")
+}
+
+# 旧的.gcda会和新的累加,每次重新训练
+rm -rf "$BUILD/train" "$BUILD/shared" "$BUILD/static"
+
+# 1. 训练用的文件: h264/hevc, mp4/ts, 不同分辨率,gop和轨道数
+build "$BUILD/gen_media" gen_media.pro
+mkdir -p "$BUILD/media"
+"$BUILD/gen_media/gen_media" -c h264 -s 1920x1080 -b 4000 -g 50 -d 120 "$BUILD/media/h264.mp4"
+"$BUILD/gen_media/gen_media" -c hevc -s 3840x2160 -b 12000 -g 25 -d 60 "$BUILD/media/hevc.mp4"
+"$BUILD/gen_media/gen_media" -c h264 -s 1280x720 -b 2000 -g 100 -d 120 -f ts "$BUILD/media/h264.ts"
+"$BUILD/gen_media/gen_media" -c h264 -s 1280x720 -v 2 -n 2 -d 60 "$BUILD/media/multi.mp4"
+
+# 2. 插桩编译bench并运行,.gcda生成在目标文件旁边
+build "$BUILD/train" bench.pro CONFIG+=pgo_generate
+for f in "$BUILD"/media/*.mp4 "$BUILD"/media/*.ts; do
+    "$BUILD/train/bench" -n 10 -s 100 -t "$BUILD" -o "$f.json" "$f"
+done
+
+# 3. 库和bench的源文件,编译选项相同,.gcda拷贝到库的目标文件目录
+for lib in shared static; do
+    mkdir -p "$BUILD/$lib"
+    for gcda in "$BUILD"/train/*.gcda; do
+        [ "$(basename "$gcda")" = bench.gcda ] || cp "$gcda" "$BUILD/$lib/"
+    done
+done
+
+build "$BUILD/shared" demux_mp4_lib.pro CONFIG+=pgo_use
+build "$BUILD/static" demux_mp4_lib.pro CONFIG+=pgo_use CONFIG+=staticlib
+
+echo "libraries in $BUILD/shared and $BUILD/static, benchmark results in $BUILD/media"
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavutil/time.h"
+
+#include "pipeline.h"
+#include "spsc_queue.h"
+#include "trace.h"
+
+#define PIPELINE_DEFAULT_QUEUE 256
+
+struct pipeline {
+    demuxer_t *demuxer;
+    muxer_t *muxer;
+    int queue_size;
+
+    int nb_streams;
+    int stream_map[PIPELINE_MAX_STREAMS];
+    AVRational time_base[PIPELINE_MAX_STREAMS];     //进入muxer的时间基
+    char *bsf_name[PIPELINE_MAX_STREAMS];
+    AVBSFContext *bsf[PIPELINE_MAX_STREAMS];
+    int has_bsf;
+
+    spsc_queue_t read_queue;        //读取 -> 转换
+    spsc_queue_t write_queue;       //转换(或读取) -> 写入
+
+    atomic_int quit;
+    atomic_llong read_bytes;
+    int read_error;
+    int write_error;
+
+    pipeline_stats_t stats;
+};
+
+static void __pipeline_free_queue(spsc_queue_t *q)
+{
+    AVPacket *pkt = NULL;
+
+    if (q->items == NULL)
+        return;
+
+    while ((pkt = spsc_queue_try_pop(q)) != NULL)
+        av_packet_free(&pkt);
+
+    spsc_queue_uninit(q);
+}
+
+static int __pipeline_push(spsc_queue_t *q, AVPacket *pkt, pipeline_stage_stats_t *stats)
+{
+    int64_t start = av_gettime_relative();
+    int ret = spsc_queue_push(q, pkt);
+
+    stats->blocked_us += av_gettime_relative() - start;
+
+    if (ret != 0)
+        av_packet_free(&pkt);
+
+    return ret;
+}
+
+static AVPacket *__pipeline_pop(spsc_queue_t *q, pipeline_stage_stats_t *stats)
+{
+    int64_t start = av_gettime_relative();
+    AVPacket *pkt = spsc_queue_pop(q);
+
+    stats->blocked_us += av_gettime_relative() - start;
+
+    return pkt;
+}
+
+static void *__pipeline_read_thread(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *)arg;
+    pipeline_stage_stats_t *stats = &pipeline->stats.read;
+    spsc_queue_t *out = pipeline->has_bsf ? &pipeline->read_queue : &pipeline->write_queue;
+    AVPacket *pkt = NULL;
+    int64_t start = 0;
+    int ret = 0;
+
+    TRACE_THREAD_NAME("pipeline read");
+    while (!atomic_load(&pipeline->quit)) {
+        pkt = av_packet_alloc();
+        if (pkt == NULL) {
+            pipeline->read_error = -2;
+            break;
+        }
+
+        start = av_gettime_relative();
+        ret = demuxer_read_packet(pipeline->demuxer, pkt);
+        stats->busy_us += av_gettime_relative() - start;
+
+        if (ret < 0) {
+            av_packet_free(&pkt);
+            if (ret != -5)
+                pipeline->read_error = ret;
+            break;
+        }
+
+        if (pkt->stream_index >= pipeline->nb_streams || pipeline->stream_map[pkt->stream_index] < 0) {
+            av_packet_free(&pkt);
+            continue;
+        }
+
+        stats->packets++;
+        stats->bytes += pkt->size;
+        atomic_store_explicit(&pipeline->read_bytes, stats->bytes, memory_order_relaxed);
+
+        if (__pipeline_push(out, pkt, stats) != 0)
+            break;
+    }
+
+    spsc_queue_close(out);
+
+    return NULL;
+}
+
+static int __pipeline_convert_one(pipeline_t *pipeline, int stream_index, AVPacket *pkt)
+{
+    TRACE_SCOPE("bsf", "pipeline");
+    pipeline_stage_stats_t *stats = &pipeline->stats.convert;
+    AVBSFContext *bsf = pipeline->bsf[stream_index];
+    AVPacket *out = NULL;
+    int64_t start = av_gettime_relative();
+    int ret = 0;
+
+    //pkt为NULL时冲刷bsf中缓存的数据
+    ret = av_bsf_send_packet(bsf, pkt);
+    av_packet_free(&pkt);
+    if (ret < 0)
+        goto done;
+
+    for (;;) {
+        out = av_packet_alloc();
+        if (out == NULL) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+
+        ret = av_bsf_receive_packet(bsf, out);
+        if (ret < 0) {
+            av_packet_free(&out);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                ret = 0;
+            break;
+        }
+
+        out->stream_index = stream_index;
+
+        stats->busy_us += av_gettime_relative() - start;
+        stats->packets++;
+        stats->bytes += out->size;
+
+        if (__pipeline_push(&pipeline->write_queue, out, stats) != 0)
+            return -1;
+
+        start = av_gettime_relative();
+    }
+
+done:
+    stats->busy_us += av_gettime_relative() - start;
+    return ret;
+}
+
+static void *__pipeline_convert_thread(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *)arg;
+    pipeline_stage_stats_t *stats = &pipeline->stats.convert;
+    AVPacket *pkt = NULL;
+    int i = 0;
+
+    TRACE_THREAD_NAME("pipeline convert");
+    while ((pkt = __pipeline_pop(&pipeline->read_queue, stats)) != NULL) {
+        if (pipeline->bsf[pkt->stream_index] == NULL) {
+            stats->packets++;
+            stats->bytes += pkt->size;
+            if (__pipeline_push(&pipeline->write_queue, pkt, stats) != 0)
+                break;
+            continue;
+        }
+
+        if (__pipeline_convert_one(pipeline, pkt->stream_index, pkt) < 0)
+            break;
+    }
+
+    if (pkt == NULL) {
+        for (i = 0; i < pipeline->nb_streams; i++) {
+            if (pipeline->bsf[i] != NULL)
+                __pipeline_convert_one(pipeline, i, NULL);
+        }
+    } else {
+        //写入线程已经退出,让读取线程也退出
+        spsc_queue_close(&pipeline->read_queue);
+    }
+
+    spsc_queue_close(&pipeline->write_queue);
+
+    return NULL;
+}
+
+static void *__pipeline_write_thread(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *)arg;
+    pipeline_stage_stats_t *stats = &pipeline->stats.write;
+    AVPacket *pkt = NULL;
+    int64_t start = 0;
+    int ret = 0;
+
+    TRACE_THREAD_NAME("pipeline write");
+    while ((pkt = __pipeline_pop(&pipeline->write_queue, stats)) != NULL) {
+        start = av_gettime_relative();
+        ret = muxer_write_packet(pipeline->muxer, pipeline->stream_map[pkt->stream_index],
+                                 pkt, pipeline->time_base[pkt->stream_index]);
+        stats->busy_us += av_gettime_relative() - start;
+
+        stats->packets++;
+        stats->bytes += pkt->size;
+        av_packet_free(&pkt);
+
+        if (ret < 0) {
+            pipeline->write_error = ret;
+            break;
+        }
+    }
+
+    //出错时关闭队列,上游push失败后退出
+    spsc_queue_close(&pipeline->write_queue);
+    if (pipeline->has_bsf)
+        spsc_queue_close(&pipeline->read_queue);
+
+    return NULL;
+}
+
+static int __pipeline_setup(pipeline_t *pipeline)
+{
+    const AVCodecParameters *par = NULL;
+    const AVBitStreamFilter *filter = NULL;
+    AVRational time_base;
+    int i = 0;
+
+    pipeline->nb_streams = demuxer_get_nb_streams(pipeline->demuxer);
+    if (pipeline->nb_streams <= 0)
+        return -1;
+    if (pipeline->nb_streams > PIPELINE_MAX_STREAMS)
+        pipeline->nb_streams = PIPELINE_MAX_STREAMS;
+
+    for (i = 0; i < pipeline->nb_streams; i++) {
+        par = demuxer_get_codecpar(pipeline->demuxer, i, &time_base);
+        if (par == NULL) {
+            pipeline->stream_map[i] = -1;
+            continue;
+        }
+
+        if (pipeline->bsf_name[i] != NULL) {
+            if (av_bsf_list_parse_str(pipeline->bsf_name[i], &pipeline->bsf[i]) < 0 ||
+                avcodec_parameters_copy(pipeline->bsf[i]->par_in, par) < 0) {
+                fprintf(stderr, "invalid bsf '%s'\n", pipeline->bsf_name[i]);
+                return -2;
+            }
+
+            pipeline->bsf[i]->time_base_in = time_base;
+
+            if (av_bsf_init(pipeline->bsf[i]) < 0) {
+                filter = pipeline->bsf[i]->filter;
+                fprintf(stderr, "init bsf '%s' failed\n", filter ? filter->name : pipeline->bsf_name[i]);
+                return -2;
+            }
+
+            par = pipeline->bsf[i]->par_out;
+            time_base = pipeline->bsf[i]->time_base_out;
+            pipeline->has_bsf = 1;
+        }
+
+        pipeline->time_base[i] = time_base;
+        pipeline->stream_map[i] = muxer_add_stream(pipeline->muxer, par, time_base);
+        if (pipeline->stream_map[i] < 0)
+            fprintf(stderr, "skip stream %d: %d\n", i, pipeline->stream_map[i]);
+    }
+
+    return muxer_start(pipeline->muxer) == 0 ? 0 : -3;
+}
+
+pipeline_t *pipeline_create(demuxer_t *demuxer, muxer_t *muxer, int queue_size)
+{
+    pipeline_t *pipeline = NULL;
+
+    if (demuxer == NULL || muxer == NULL)
+        return NULL;
+
+    pipeline = (pipeline_t *)calloc(1, sizeof(pipeline_t));
+    if (pipeline == NULL)
+        return NULL;
+
+    pipeline->demuxer = demuxer;
+    pipeline->muxer = muxer;
+    pipeline->queue_size = queue_size > 0 ? queue_size : PIPELINE_DEFAULT_QUEUE;
+    atomic_init(&pipeline->quit, 0);
+    atomic_init(&pipeline->read_bytes, 0);
+
+    return pipeline;
+}
+
+void pipeline_destroy(pipeline_t **pipeline)
+{
+    int i = 0;
+
+    if (pipeline == NULL || *pipeline == NULL)
+        return;
+
+    for (i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        av_bsf_free(&(*pipeline)->bsf[i]);
+        free((*pipeline)->bsf_name[i]);
+    }
+
+    __pipeline_free_queue(&(*pipeline)->read_queue);
+    __pipeline_free_queue(&(*pipeline)->write_queue);
+
+    free(*pipeline);
+    *pipeline = NULL;
+}
+
+int pipeline_set_bsf(pipeline_t *pipeline, int stream_index, const char *bsf)
+{
+    if (pipeline == NULL || stream_index < 0 || stream_index >= PIPELINE_MAX_STREAMS)
+        return -1;
+
+    free(pipeline->bsf_name[stream_index]);
+    pipeline->bsf_name[stream_index] = NULL;
+
+    if (bsf != NULL && *bsf != '\0') {
+        pipeline->bsf_name[stream_index] = strdup(bsf);
+        if (pipeline->bsf_name[stream_index] == NULL)
+            return -2;
+    }
+
+    return 0;
+}
+
+int pipeline_run(pipeline_t *pipeline, pipeline_stats_t *stats)
+{
+    pthread_t read_thread, convert_thread, write_thread;
+    int64_t start = 0;
+    int ret = 0;
+
+    if (pipeline == NULL)
+        return -1;
+
+    ret = __pipeline_setup(pipeline);
+    if (ret != 0)
+        return ret;
+
+    if (spsc_queue_init(&pipeline->write_queue, pipeline->queue_size) != 0)
+        return -4;
+    if (pipeline->has_bsf && spsc_queue_init(&pipeline->read_queue, pipeline->queue_size) != 0)
+        return -4;
+
+    start = av_gettime_relative();
+
+    if (pthread_create(&write_thread, NULL, __pipeline_write_thread, pipeline) != 0)
+        return -4;
+
+    if (pipeline->has_bsf &&
+        pthread_create(&convert_thread, NULL, __pipeline_convert_thread, pipeline) != 0) {
+        spsc_queue_close(&pipeline->write_queue);
+        pthread_join(write_thread, NULL);
+        return -4;
+    }
+
+    //读取在调用线程里也可以,但单独的线程方便统计和pipeline_stop
+    if (pthread_create(&read_thread, NULL, __pipeline_read_thread, pipeline) != 0) {
+        if (pipeline->has_bsf) {
+            spsc_queue_close(&pipeline->read_queue);
+            pthread_join(convert_thread, NULL);
+        } else {
+            spsc_queue_close(&pipeline->write_queue);
+        }
+        pthread_join(write_thread, NULL);
+        return -4;
+    }
+
+    pthread_join(read_thread, NULL);
+    if (pipeline->has_bsf)
+        pthread_join(convert_thread, NULL);
+    pthread_join(write_thread, NULL);
+
+    pipeline->stats.elapsed_us = av_gettime_relative() - start;
+    pipeline->stats.read.waits = pipeline->has_bsf ? pipeline->read_queue.full_waits :
+                                                     pipeline->write_queue.full_waits;
+    pipeline->stats.write.waits = pipeline->write_queue.empty_waits;
+    if (pipeline->has_bsf)
+        pipeline->stats.convert.waits = pipeline->read_queue.empty_waits + pipeline->write_queue.full_waits;
+    pipeline->stats.errors = (pipeline->read_error != 0) + (pipeline->write_error != 0);
+
+    if (stats != NULL)
+        *stats = pipeline->stats;
+
+    return pipeline->stats.errors ? -5 : 0;
+}
+
+void pipeline_stop(pipeline_t *pipeline)
+{
+    if (pipeline != NULL)
+        atomic_store(&pipeline->quit, 1);
+}
+
+int64_t pipeline_get_read_bytes(pipeline_t *pipeline)
+{
+    if (pipeline == NULL)
+        return -1;
+
+    return atomic_load_explicit(&pipeline->read_bytes, memory_order_relaxed);
+}
+
+static void __pipeline_print_stage(FILE *fp, const char *name, const pipeline_stage_stats_t *stage, int64_t elapsed_us)
+{
+    fprintf(fp, "  %-8s %10lld pkts %10.2f MB %8.2f MB/s  busy %5.1f%%  blocked %5.1f%%  waits %lld\n",
+            name, (long long)stage->packets, stage->bytes / 1048576.0,
+            elapsed_us > 0 ? stage->bytes / 1.048576 / elapsed_us : 0.0,
+            elapsed_us > 0 ? stage->busy_us * 100.0 / elapsed_us : 0.0,
+            elapsed_us > 0 ? stage->blocked_us * 100.0 / elapsed_us : 0.0,
+            (long long)stage->waits);
+}
+
+void pipeline_print_stats(const pipeline_stats_t *stats, FILE *fp)
+{
+    if (stats == NULL || fp == NULL)
+        return;
+
+    fprintf(fp, "pipeline: %.3f s, %d errors\n", stats->elapsed_us / 1000000.0, stats->errors);
+    __pipeline_print_stage(fp, "read", &stats->read, stats->elapsed_us);
+    if (stats->convert.packets > 0)
+        __pipeline_print_stage(fp, "convert", &stats->convert, stats->elapsed_us);
+    __pipeline_print_stage(fp, "write", &stats->write, stats->elapsed_us);
+}
@@ -0,0 +1,107 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "demux.h"
+#include "mux.h"
+
+/**
+ * @brief 转封装流水线: 读取,码流转换,写入三个线程,之间用有界无锁队列连接
+ *   写入慢时队列满,读取线程阻塞等待(背压),内存占用有上限
+ *   没有设置码流转换时只有读取和写入两个线程
+ */
+typedef struct pipeline pipeline_t;
+
+#define PIPELINE_MAX_STREAMS 16
+
+typedef struct pipeline_stage_stats {
+    int64_t packets;
+    int64_t bytes;
+    int64_t busy_us;            //处理数据的时间
+    int64_t blocked_us;         //等待队列的时间
+    int64_t waits;              //队列满或空导致等待的次数
+} pipeline_stage_stats_t;
+
+typedef struct pipeline_stats {
+    pipeline_stage_stats_t read;
+    pipeline_stage_stats_t convert;
+    pipeline_stage_stats_t write;
+    int64_t elapsed_us;
+    int errors;
+} pipeline_stats_t;
+
+/**
+ * @brief 创建流水线
+ *
+ * @param demuxer: 已经demuxer_open
+ * @param muxer: 已经muxer_open,还没有添加流
+ * @param queue_size: 每个队列最多缓存的packet数,<=0使用默认值
+ * @return pipeline_t*: NULL失败
+ */
+pipeline_t *pipeline_create(demuxer_t *demuxer, muxer_t *muxer, int queue_size);
+
+/**
+ * @brief 摧毁流水线,不会关闭demuxer和muxer
+ *
+ * @param pipeline
+ */
+void pipeline_destroy(pipeline_t **pipeline);
+
+/**
+ * @brief 设置某一路流的码流转换,必须在pipeline_run之前调用
+ *
+ * @param pipeline: pipeline_create返回值
+ * @param stream_index: 输入流序号
+ * @param bsf: bitstream filter列表,格式同ffmpeg -bsf,比如"h264_mp4toannexb"
+ * @return int: 0成功 其他失败
+ */
+int pipeline_set_bsf(pipeline_t *pipeline, int stream_index, const char *bsf);
+
+/**
+ * @brief 把输入的所有流添加到muxer并muxer_start,然后运行到输入结束或者pipeline_stop
+ *
+ * @param pipeline: pipeline_create返回值
+ * @param stats: 输出,吞吐量统计,可以为NULL
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -2:码流转换初始化失败
+ *              -3:muxer_start失败
+ *              -4:创建线程失败
+ *              -5:读取或者写入出错
+ */
+int pipeline_run(pipeline_t *pipeline, pipeline_stats_t *stats);
+
+/**
+ * @brief 让pipeline_run尽快返回,可以在其他线程或者信号处理函数中调用
+ *
+ * @param pipeline: pipeline_create返回值
+ */
+void pipeline_stop(pipeline_t *pipeline);
+
+/**
+ * @brief 获取已经读取的数据量,用于显示进度,可以在其他线程调用
+ *
+ * @param pipeline: pipeline_create返回值
+ * @return int64_t: 字节数 <0失败
+ */
+int64_t pipeline_get_read_bytes(pipeline_t *pipeline);
+
+/**
+ * @brief 打印吞吐量统计
+ *
+ * @param stats: pipeline_run的输出
+ * @param fp: 比如stderr
+ */
+void pipeline_print_stats(const pipeline_stats_t *stats, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__PIPELINE_H
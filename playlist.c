@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "libavutil/mathematics.h"
+
+#include "playlist.h"
+#include "trace.h"
+
+#define PLAYLIST_INIT_CAPACITY  16
+
+typedef struct playlist_item {
+    char *filename;
+    int64_t start_us;           //在全局时间轴上的起始时间,用微秒累加,文件多时不会累积取整误差
+    int64_t duration_us;
+} playlist_item_t;
+
+struct playlist {
+    playlist_item_t *items;
+    int nb_items;
+    int capacity;
+    int64_t duration_us;
+    int is_open;
+
+    //流参数,以第一个打开的文件为准
+    int nb_streams;
+    AVCodecParameters *par[PLAYLIST_MAX_STREAMS];
+    AVRational time_base[PLAYLIST_MAX_STREAMS];
+    int64_t last_dts[PLAYLIST_MAX_STREAMS];
+
+    //当前文件,输入时间戳换算到输出时间基后加上delta
+    demuxer_t *current;
+    int current_index;
+    int current_streams;
+    int64_t first_us;
+    AVRational in_time_base[PLAYLIST_MAX_STREAMS];
+    int64_t delta[PLAYLIST_MAX_STREAMS];
+
+    //预打开线程,items在playlist_open之后不再改变,线程中可以直接读
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int quit;
+    int prefetch_index;         //请求预打开的文件,-1没有
+    int opening_index;          //正在打开的文件,-1没有
+    demuxer_t *prefetched;      //打开失败时为NULL,prefetched_index仍然记录
+    int prefetched_index;
+};
+
+static demuxer_t *__playlist_open_file(const char *filename)
+{
+    demuxer_t *demuxer = demuxer_create();
+
+    if (demuxer == NULL)
+        return NULL;
+
+    if (demuxer_open(demuxer, filename) != 0) {
+        fprintf(stderr, "playlist: open '%s' failed\n", filename);
+        demuxer_destroy(&demuxer);
+    }
+
+    return demuxer;
+}
+
+static void *__playlist_prefetch_thread(void *arg)
+{
+    playlist_t *playlist = (playlist_t *)arg;
+    demuxer_t *demuxer = NULL, *stale = NULL;
+    int index = -1;
+
+    TRACE_THREAD_NAME("playlist prefetch");
+
+    pthread_mutex_lock(&playlist->mutex);
+
+    while (!playlist->quit) {
+        if (playlist->prefetch_index < 0 || playlist->prefetched_index == playlist->prefetch_index) {
+            pthread_cond_wait(&playlist->cond, &playlist->mutex);
+            continue;
+        }
+
+        //seek之后请求变了,之前预打开的文件不再需要
+        stale = playlist->prefetched;
+        playlist->prefetched = NULL;
+        playlist->prefetched_index = -1;
+        index = playlist->prefetch_index;
+        playlist->opening_index = index;
+
+        pthread_mutex_unlock(&playlist->mutex);
+
+        demuxer_destroy(&stale);
+        TRACE_BEGIN(open_begin);
+        demuxer = __playlist_open_file(playlist->items[index].filename);
+        TRACE_END(open_begin, "playlist_prefetch", "playlist");
+
+        pthread_mutex_lock(&playlist->mutex);
+
+        playlist->opening_index = -1;
+        playlist->prefetched = demuxer;
+        playlist->prefetched_index = index;
+        pthread_cond_broadcast(&playlist->cond);
+    }
+
+    pthread_mutex_unlock(&playlist->mutex);
+
+    return NULL;
+}
+
+/**
+ * 取出第index个文件,预打开过就直接用,否则在当前线程打开
+ * 同时请求后台线程预打开index+1
+ */
+static demuxer_t *__playlist_take(playlist_t *playlist, int index)
+{
+    demuxer_t *demuxer = NULL;
+    int found = 0;
+
+    pthread_mutex_lock(&playlist->mutex);
+
+    while (playlist->opening_index == index)
+        pthread_cond_wait(&playlist->cond, &playlist->mutex);
+
+    if (playlist->prefetched_index == index) {
+        demuxer = playlist->prefetched;
+        playlist->prefetched = NULL;
+        playlist->prefetched_index = -1;
+        found = 1;
+    }
+
+    playlist->prefetch_index = (index + 1 < playlist->nb_items) ? index + 1 : -1;
+    pthread_cond_broadcast(&playlist->cond);
+
+    pthread_mutex_unlock(&playlist->mutex);
+
+    if (!found)
+        demuxer = __playlist_open_file(playlist->items[index].filename);
+
+    return demuxer;
+}
+
+//计算当前文件每个流的时间戳偏移
+static void __playlist_rebase(playlist_t *playlist)
+{
+    const AVCodecParameters *par = NULL;
+    int64_t start_us = playlist->items[playlist->current_index].start_us;
+    int i = 0;
+
+    playlist->first_us = 0;
+    if (playlist->current->fmt_ctx->start_time != AV_NOPTS_VALUE)
+        playlist->first_us = playlist->current->fmt_ctx->start_time;
+
+    playlist->current_streams = FFMIN(demuxer_get_nb_streams(playlist->current), playlist->nb_streams);
+    for (i = 0; i < playlist->current_streams; i++) {
+        par = demuxer_get_codecpar(playlist->current, i, &playlist->in_time_base[i]);
+        if (par != NULL && par->codec_id != playlist->par[i]->codec_id)
+            fprintf(stderr, "playlist: stream %d of '%s' has a different codec\n",
+                    i, playlist->items[playlist->current_index].filename);
+
+        playlist->delta[i] = av_rescale_q(start_us - playlist->first_us, AV_TIME_BASE_Q, playlist->time_base[i]);
+    }
+}
+
+/**
+ * 关闭当前文件,切换到第index个,打不开的文件跳过
+ * 返回0成功 -5后面没有能打开的文件
+ */
+static int __playlist_switch(playlist_t *playlist, int index)
+{
+    demuxer_t *demuxer = NULL;
+
+    demuxer_destroy(&playlist->current);
+
+    for (; index < playlist->nb_items; index++) {
+        demuxer = __playlist_take(playlist, index);
+        if (demuxer != NULL) {
+            playlist->current = demuxer;
+            playlist->current_index = index;
+            __playlist_rebase(playlist);
+            return 0;
+        }
+        fprintf(stderr, "playlist: skip '%s'\n", playlist->items[index].filename);
+    }
+
+    playlist->current_index = playlist->nb_items;
+
+    return -5;
+}
+
+playlist_t *playlist_create(void)
+{
+    playlist_t *playlist = calloc(1, sizeof(playlist_t));
+    int i = 0;
+
+    if (playlist == NULL)
+        return NULL;
+
+    pthread_mutex_init(&playlist->mutex, NULL);
+    pthread_cond_init(&playlist->cond, NULL);
+    playlist->current_index = -1;
+    playlist->prefetch_index = -1;
+    playlist->opening_index = -1;
+    playlist->prefetched_index = -1;
+    for (i = 0; i < PLAYLIST_MAX_STREAMS; i++)
+        playlist->last_dts[i] = AV_NOPTS_VALUE;
+
+    return playlist;
+}
+
+void playlist_destroy(playlist_t **playlist)
+{
+    playlist_t *pl = NULL;
+    int i = 0;
+
+    if (playlist == NULL || *playlist == NULL)
+        return;
+
+    pl = *playlist;
+
+    if (pl->thread_started) {
+        pthread_mutex_lock(&pl->mutex);
+        pl->quit = 1;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->mutex);
+        pthread_join(pl->thread, NULL);
+    }
+
+    demuxer_destroy(&pl->prefetched);
+    demuxer_destroy(&pl->current);
+
+    for (i = 0; i < pl->nb_streams; i++)
+        avcodec_parameters_free(&pl->par[i]);
+    for (i = 0; i < pl->nb_items; i++)
+        free(pl->items[i].filename);
+    free(pl->items);
+
+    pthread_cond_destroy(&pl->cond);
+    pthread_mutex_destroy(&pl->mutex);
+
+    free(pl);
+    *playlist = NULL;
+}
+
+int playlist_add(playlist_t *playlist, const char *filename, int64_t duration_ms)
+{
+    playlist_item_t *items = NULL;
+    int capacity = 0;
+
+    if (playlist == NULL || filename == NULL || *filename == '\0' || playlist->is_open)
+        return -1;
+
+    if (playlist->nb_items == playlist->capacity) {
+        capacity = playlist->capacity > 0 ? playlist->capacity * 2 : PLAYLIST_INIT_CAPACITY;
+        items = realloc(playlist->items, capacity * sizeof(playlist_item_t));
+        if (items == NULL)
+            return -2;
+        playlist->items = items;
+        playlist->capacity = capacity;
+    }
+
+    playlist->items[playlist->nb_items].filename = strdup(filename);
+    if (playlist->items[playlist->nb_items].filename == NULL)
+        return -2;
+    playlist->items[playlist->nb_items].duration_us = duration_ms > 0 ? duration_ms * 1000 : 0;
+    playlist->items[playlist->nb_items].start_us = 0;
+    playlist->nb_items++;
+
+    return 0;
+}
+
+int playlist_open(playlist_t *playlist)
+{
+    const AVCodecParameters *par = NULL;
+    playlist_item_t *item = NULL;
+    int64_t start = 0;
+    int i = 0, ret = -1;
+
+    if (playlist == NULL || playlist->is_open)
+        return -1;
+
+    if (playlist->nb_items == 0)
+        return -2;
+
+    //时长未知的文件打开探测,打不开的时长为0,seek不会落在它上面
+    for (i = 0; i < playlist->nb_items; i++) {
+        item = &playlist->items[i];
+        if (item->duration_us <= 0) {
+            item->duration_us = demuxer_get_duration_us(item->filename);
+            if (item->duration_us < 0)
+                item->duration_us = 0;
+        }
+        item->start_us = start;
+        start += item->duration_us;
+    }
+    playlist->duration_us = start;
+
+    for (i = 0; i < playlist->nb_items && playlist->current == NULL; i++) {
+        playlist->current = __playlist_open_file(playlist->items[i].filename);
+        playlist->current_index = i;
+    }
+
+    if (playlist->current == NULL) {
+        ret = -3;
+        goto fail;
+    }
+
+    playlist->nb_streams = FFMIN(demuxer_get_nb_streams(playlist->current), PLAYLIST_MAX_STREAMS);
+    for (i = 0; i < playlist->nb_streams; i++) {
+        par = demuxer_get_codecpar(playlist->current, i, &playlist->time_base[i]);
+        playlist->par[i] = avcodec_parameters_alloc();
+        if (par == NULL || playlist->par[i] == NULL || avcodec_parameters_copy(playlist->par[i], par) < 0) {
+            ret = -3;
+            goto fail;
+        }
+    }
+
+    __playlist_rebase(playlist);
+
+    if (pthread_create(&playlist->thread, NULL, __playlist_prefetch_thread, playlist) != 0) {
+        ret = -4;
+        goto fail;
+    }
+    playlist->thread_started = 1;
+
+    pthread_mutex_lock(&playlist->mutex);
+    playlist->prefetch_index = (playlist->current_index + 1 < playlist->nb_items) ? playlist->current_index + 1 : -1;
+    pthread_cond_broadcast(&playlist->cond);
+    pthread_mutex_unlock(&playlist->mutex);
+
+    playlist->is_open = 1;
+
+    return 0;
+
+fail:
+    demuxer_destroy(&playlist->current);
+    playlist->current_index = -1;
+    for (i = 0; i < playlist->nb_streams; i++)
+        avcodec_parameters_free(&playlist->par[i]);
+    playlist->nb_streams = 0;
+
+    return ret;
+}
+
+int playlist_get_nb_streams(playlist_t *playlist)
+{
+    if (playlist == NULL)
+        return -1;
+
+    return playlist->is_open ? playlist->nb_streams : 0;
+}
+
+const AVCodecParameters *playlist_get_codecpar(playlist_t *playlist, int stream_index, AVRational *time_base)
+{
+    if (playlist == NULL || !playlist->is_open || stream_index < 0 || stream_index >= playlist->nb_streams)
+        return NULL;
+
+    if (time_base != NULL)
+        *time_base = playlist->time_base[stream_index];
+
+    return playlist->par[stream_index];
+}
+
+int64_t playlist_get_duration(playlist_t *playlist)
+{
+    if (playlist == NULL || !playlist->is_open)
+        return -1;
+
+    return playlist->duration_us / 1000;
+}
+
+int playlist_get_current(playlist_t *playlist)
+{
+    if (playlist == NULL || playlist->current == NULL)
+        return -1;
+
+    return playlist->current_index;
+}
+
+int playlist_read_packet(playlist_t *playlist, AVPacket *pkt)
+{
+    int64_t *last = NULL;
+    int ret = -1, i = 0;
+
+    if (playlist == NULL || pkt == NULL)
+        return -1;
+
+    if (!playlist->is_open)
+        return -4;
+
+    while (playlist->current != NULL) {
+        ret = demuxer_read_packet(playlist->current, pkt);
+        if (ret == 0) {
+            i = pkt->stream_index;
+            if (i >= playlist->current_streams) {
+                av_packet_unref(pkt);
+                continue;
+            }
+
+            if (pkt->pts != AV_NOPTS_VALUE)
+                pkt->pts = av_rescale_q(pkt->pts, playlist->in_time_base[i], playlist->time_base[i]) + playlist->delta[i];
+            if (pkt->dts != AV_NOPTS_VALUE)
+                pkt->dts = av_rescale_q(pkt->dts, playlist->in_time_base[i], playlist->time_base[i]) + playlist->delta[i];
+            pkt->duration = av_rescale_q(pkt->duration, playlist->in_time_base[i], playlist->time_base[i]);
+            pkt->pos = -1;
+
+            //文件的实际时长和容器记录的时长不一致时,保证dts严格递增
+            last = &playlist->last_dts[i];
+            if (pkt->dts != AV_NOPTS_VALUE) {
+                if (*last != AV_NOPTS_VALUE && pkt->dts <= *last) {
+                    pkt->dts = *last + 1;
+                    if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+                        pkt->pts = pkt->dts;
+                }
+                *last = pkt->dts;
+            }
+
+            return 0;
+        }
+
+        if (ret != -5)
+            fprintf(stderr, "playlist: read '%s' error %d, skip to next file\n",
+                    playlist->items[playlist->current_index].filename, ret);
+
+        if (__playlist_switch(playlist, playlist->current_index + 1) != 0)
+            break;
+    }
+
+    return -5;
+}
+
+int playlist_seek(playlist_t *playlist, int64_t ms)
+{
+    int lo = 0, hi = 0, mid = 0, i = 0;
+    int64_t us = 0, local = 0;
+
+    if (playlist == NULL)
+        return -1;
+
+    if (!playlist->is_open)
+        return -4;
+
+    us = ms * 1000;
+    if (us >= playlist->duration_us)
+        us = playlist->duration_us - 1;
+    if (us < 0)
+        us = 0;
+
+    //最后一个start_us <= us的文件
+    hi = playlist->nb_items - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (playlist->items[mid].start_us <= us)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    if (playlist->current == NULL || playlist->current_index != lo) {
+        if (__playlist_switch(playlist, lo) != 0)
+            return -3;
+    }
+
+    for (i = 0; i < PLAYLIST_MAX_STREAMS; i++)
+        playlist->last_dts[i] = AV_NOPTS_VALUE;
+
+    //目标文件打不开时跳到了后面的文件,从它的开头读
+    if (playlist->current_index != lo)
+        return 0;
+
+    //文件内的位置不能超过它的时长,否则demuxer_seek会失败或者落到文件末尾之后
+    local = FFMIN(us - playlist->items[lo].start_us, playlist->items[lo].duration_us) / 1000;
+    local += playlist->first_us / 1000;
+    if (demuxer_seek(playlist->current, local) != 0) {
+        fprintf(stderr, "playlist: seek '%s' to %lld ms failed\n", playlist->items[lo].filename, (long long)local);
+        return -3;
+    }
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef __PLAYLIST_H
+#define __PLAYLIST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "demux.h"
+
+/**
+ * @brief 把多个分段录像文件当作一个连续的流读取
+ *   每个文件的时间戳减去自己的起始时间,再加上前面所有文件的总时长,输出连续的时间戳
+ *   后台线程在当前文件打开后就预先打开下一个文件,切换文件时不需要等待avformat_open_input
+ *   所有文件的时长组成全局时间索引,seek时二分查找目标文件
+ *   所有文件的流结构(个数,顺序,编码)必须一致,流参数以第一个能打开的文件为准
+ *   读取和seek只能在同一个线程中调用
+ */
+typedef struct playlist playlist_t;
+
+#define PLAYLIST_MAX_STREAMS 16
+
+/**
+ * @brief 创建
+ *
+ * @return playlist_t*: NULL失败
+ */
+playlist_t *playlist_create(void);
+
+/**
+ * @brief 停止后台线程,关闭所有文件,摧毁
+ *
+ * @param playlist
+ */
+void playlist_destroy(playlist_t **playlist);
+
+/**
+ * @brief 在末尾添加一个文件,必须在playlist_open之前调用
+ *
+ * @param playlist: playlist_create返回值
+ * @param filename: 文件名
+ * @param duration_ms: 时长(毫秒),已知时(比如录像索引中有)传入可以省去打开探测,<=0时playlist_open探测
+ * @return int: 0成功 其他失败
+ */
+int playlist_add(playlist_t *playlist, const char *filename, int64_t duration_ms);
+
+/**
+ * @brief 探测时长建立时间索引,打开第一个文件,启动预打开线程
+ *
+ * @param playlist: playlist_create返回值
+ * @return int: 0成功 其他失败
+ *              -1:参数错误或者已经打开
+ *              -2:没有文件
+ *              -3:所有文件都打不开
+ *              -4:创建线程失败
+ */
+int playlist_open(playlist_t *playlist);
+
+/**
+ * @brief 获取流的个数
+ *
+ * @param playlist: playlist_create返回值
+ * @return int: 流个数, 没有打开返回0
+ */
+int playlist_get_nb_streams(playlist_t *playlist);
+
+/**
+ * @brief 获取流的编码参数,可以直接传给muxer_add_stream
+ *
+ * @param playlist: playlist_create返回值
+ * @param stream_index: 流序号
+ * @param time_base: 输出该流的时间基(playlist_read_packet输出时间戳的单位),可以为NULL
+ * @return const AVCodecParameters*: NULL失败, playlist_destroy前有效
+ */
+const AVCodecParameters *playlist_get_codecpar(playlist_t *playlist, int stream_index, AVRational *time_base);
+
+/**
+ * @brief 获取总时长
+ *
+ * @param playlist: playlist_create返回值
+ * @return int64_t: 毫秒 <0失败
+ */
+int64_t playlist_get_duration(playlist_t *playlist);
+
+/**
+ * @brief 获取当前正在读的文件
+ *
+ * @param playlist: playlist_create返回值
+ * @return int: 文件序号(playlist_add的顺序) <0没有打开或者已经读完
+ */
+int playlist_get_current(playlist_t *playlist);
+
+/**
+ * @brief 读取packet,时间戳已经换算到连续的时间轴,一个文件结束时自动切换到下一个
+ *
+ * @param playlist: playlist_create返回值
+ * @param pkt: 输出packet,使用完调用av_packet_unref
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -4:没有打开
+ *              -5:所有文件结束
+ */
+int playlist_read_packet(playlist_t *playlist, AVPacket *pkt);
+
+/**
+ * @brief seek到全局时间轴上的位置,之后从该位置之前的视频关键帧开始读
+ *
+ * @param playlist: playlist_create返回值
+ * @param ms: 全局时间(毫秒),超出范围时取最近的文件
+ * @return int: 0成功 其他失败
+ *              -1:参数错误
+ *              -3:目标文件打不开
+ *              -4:没有打开
+ */
+int playlist_seek(playlist_t *playlist, int64_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__PLAYLIST_H
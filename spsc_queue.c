@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+
+#include "spsc_queue.h"
+
+#define SPSC_SPIN           64
+
+#define SPSC_CONSUMER       1
+#define SPSC_PRODUCER       2
+
+int spsc_queue_init(spsc_queue_t *q, int capacity)
+{
+    unsigned int size = 2;
+
+    if (q == NULL || capacity <= 0)
+        return -1;
+
+    while (size < (unsigned int)capacity)
+        size <<= 1;
+
+    memset(q, 0, sizeof(*q));
+
+    q->items = (void **)calloc(size, sizeof(void *));
+    if (q->items == NULL)
+        return -2;
+
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->waiting, 0);
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+
+    return 0;
+}
+
+void spsc_queue_uninit(spsc_queue_t *q)
+{
+    if (q == NULL || q->items == NULL)
+        return;
+
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->mutex);
+    free(q->items);
+    q->items = NULL;
+}
+
+static void __spsc_queue_wake(spsc_queue_t *q, int role)
+{
+    if ((atomic_load(&q->waiting) & role) == 0)
+        return;
+
+    pthread_mutex_lock(&q->mutex);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static int __spsc_queue_full(spsc_queue_t *q, unsigned int tail)
+{
+    q->head_cache = atomic_load(&q->head);
+    return tail - q->head_cache > q->mask;
+}
+
+static int __spsc_queue_empty(spsc_queue_t *q, unsigned int head)
+{
+    q->tail_cache = atomic_load(&q->tail);
+    return q->tail_cache == head;
+}
+
+int spsc_queue_push(spsc_queue_t *q, void *item)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    int i = 0;
+
+    if (tail - q->head_cache > q->mask && __spsc_queue_full(q, tail)) {
+        q->full_waits++;
+
+        for (i = 0; i < SPSC_SPIN && __spsc_queue_full(q, tail) && !atomic_load(&q->closed); i++)
+            sched_yield();
+
+        //先标记等待再检查,对方pop之后一定能看到标记
+        if (__spsc_queue_full(q, tail)) {
+            pthread_mutex_lock(&q->mutex);
+            atomic_fetch_or(&q->waiting, SPSC_PRODUCER);
+            while (__spsc_queue_full(q, tail) && !atomic_load(&q->closed))
+                pthread_cond_wait(&q->cond, &q->mutex);
+            atomic_fetch_and(&q->waiting, ~SPSC_PRODUCER);
+            pthread_mutex_unlock(&q->mutex);
+        }
+    }
+
+    if (atomic_load_explicit(&q->closed, memory_order_relaxed))
+        return -1;
+
+    q->items[tail & q->mask] = item;
+    atomic_store(&q->tail, tail + 1);
+
+    __spsc_queue_wake(q, SPSC_CONSUMER);
+
+    return 0;
+}
+
+void *spsc_queue_try_pop(spsc_queue_t *q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    void *item = NULL;
+
+    if (q->tail_cache == head && __spsc_queue_empty(q, head))
+        return NULL;
+
+    item = q->items[head & q->mask];
+    atomic_store(&q->head, head + 1);
+
+    __spsc_queue_wake(q, SPSC_PRODUCER);
+
+    return item;
+}
+
+void *spsc_queue_pop(spsc_queue_t *q)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    int i = 0;
+
+    if (q->tail_cache == head && __spsc_queue_empty(q, head)) {
+        q->empty_waits++;
+
+        for (i = 0; i < SPSC_SPIN && __spsc_queue_empty(q, head) && !atomic_load(&q->closed); i++)
+            sched_yield();
+
+        if (__spsc_queue_empty(q, head)) {
+            pthread_mutex_lock(&q->mutex);
+            atomic_fetch_or(&q->waiting, SPSC_CONSUMER);
+            while (__spsc_queue_empty(q, head) && !atomic_load(&q->closed))
+                pthread_cond_wait(&q->cond, &q->mutex);
+            atomic_fetch_and(&q->waiting, ~SPSC_CONSUMER);
+            pthread_mutex_unlock(&q->mutex);
+        }
+    }
+
+    //关闭之后也要把剩下的数据取完
+    return spsc_queue_try_pop(q);
+}
+
+void spsc_queue_close(spsc_queue_t *q)
+{
+    if (q == NULL)
+        return;
+
+    pthread_mutex_lock(&q->mutex);
+    atomic_store(&q->closed, 1);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
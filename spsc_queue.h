@@ -0,0 +1,80 @@
+#ifndef __SPSC_QUEUE_H
+#define __SPSC_QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * @brief 单生产者单消费者的有界无锁队列
+ *   正常情况下push/pop只有原子操作,
+ *   队列满(生产者)或者空(消费者)时先自旋一小段时间,再在条件变量上睡眠,对方操作后唤醒
+ */
+typedef struct spsc_queue {
+    _Alignas(64) atomic_uint head;      //消费者写
+    unsigned int tail_cache;            //消费者看到的tail
+    int64_t empty_waits;                //消费者等待次数
+
+    _Alignas(64) atomic_uint tail;      //生产者写
+    unsigned int head_cache;            //生产者看到的head
+    int64_t full_waits;                 //生产者等待次数
+
+    _Alignas(64) void **items;
+    unsigned int mask;
+    atomic_int closed;
+    atomic_int waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} spsc_queue_t;
+
+/**
+ * @brief 初始化
+ *
+ * @param q: 队列
+ * @param capacity: 容量,向上取整到2的幂
+ * @return int: 0成功 其他失败
+ */
+int spsc_queue_init(spsc_queue_t *q, int capacity);
+
+/**
+ * @brief 释放队列,队列中剩下的元素由调用者先用spsc_queue_try_pop取出
+ */
+void spsc_queue_uninit(spsc_queue_t *q);
+
+/**
+ * @brief 放入一个元素,队列满时阻塞,只能在生产者线程调用
+ *
+ * @return int: 0成功 -1队列已经关闭
+ */
+int spsc_queue_push(spsc_queue_t *q, void *item);
+
+/**
+ * @brief 取出一个元素,队列空时阻塞,只能在消费者线程调用
+ *
+ * @return void*: NULL队列已经关闭并且没有数据
+ */
+void *spsc_queue_pop(spsc_queue_t *q);
+
+/**
+ * @brief 不阻塞地取出一个元素
+ *
+ * @return void*: NULL队列为空
+ */
+void *spsc_queue_try_pop(spsc_queue_t *q);
+
+/**
+ * @brief 关闭队列,唤醒等待的一方
+ *   生产者关闭: 消费者取完剩下的数据后spsc_queue_pop返回NULL
+ *   消费者关闭: 之后spsc_queue_push返回-1
+ */
+void spsc_queue_close(spsc_queue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SPSC_QUEUE_H
@@ -0,0 +1,621 @@
+/*
+ * 多路摄像头压力测试: 每路一个线程,按真实帧率调用muxer_write_video/muxer_write_audio,
+ * 找出一台机器能同时录制多少路
+ *
+ * stress [-n 路数] [-d 秒] [-c h264|hevc] [-s 宽x高] [-r 帧率] [-b 视频kbps] [-g gop]
+ *        [-x 倍速] [-l 最大延迟ms] [-m io线程数] [-f mp4|ts] [-o 输出目录] [-T trace.json]
+ *        [-M metrics.prom]
+ *
+ * 数据由synth预先生成,所有路共享.某一路落后超过最大延迟时丢帧,模拟采集缓冲区满
+ * 输出每路的写入延迟分位数,丢帧数,cpu和内存
+ * -T输出chrome trace(需要CONFIG+=trace编译),可以看到muxer锁竞争和io线程的写入
+ * -M每秒把所有muxer的指标写到文件(prometheus文本格式),以.sock结尾时在unix socket上提供
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/mem.h"
+#include "libavutil/time.h"
+#include "libavutil/mathematics.h"
+
+#include "metrics.h"
+#include "mux.h"
+#include "mux_manager.h"
+#include "synth.h"
+#include "trace.h"
+
+#define STRESS_MAX_CAMERAS      4096
+#define STRESS_PREGEN_GOPS      4           //预先生成的gop数,循环使用
+#define STRESS_AUDIO_RATE       48000       //muxer_add_video_and_audio固定的音频参数
+#define STRESS_AUDIO_CHANNELS   2
+#define STRESS_AUDIO_SAMPLES    1024
+#define STRESS_HIST_BUCKETS     512
+
+/**
+ * 对数分桶的延迟直方图(微秒),每个2的幂区间分8个桶,误差<12.5%
+ */
+typedef struct latency_hist {
+    int64_t count;
+    int64_t max;
+    int64_t buckets[STRESS_HIST_BUCKETS];
+} latency_hist_t;
+
+typedef struct stress_packet {
+    uint8_t *data;
+    int size;
+    int keyframe;
+} stress_packet_t;
+
+struct stress;
+
+typedef struct camera {
+    int id;
+    pthread_t thread;
+    int started;
+    muxer_t *muxer;
+    struct stress *stress;
+    int64_t offset_us;          //错开各路的起始时间,避免关键帧同时到达
+
+    latency_hist_t write;       //muxer_write_*耗时
+    latency_hist_t lag;         //实际写入时间比计划晚多少
+    atomic_llong frames;
+    atomic_llong dropped;
+    int64_t audio_frames;
+    int64_t bytes;
+    int64_t errors;
+    int64_t close_us;
+    int64_t cpu_us;
+} camera_t;
+
+typedef struct stress {
+    int nb_cameras;
+    int64_t duration_us;
+    double speed;
+    int64_t max_lag_us;
+    int format;
+    int codec;
+    const char *output;
+
+    synth_video_config_t video;
+    uint8_t *extradata;
+    int extradata_size;
+    stress_packet_t *packets;
+    int nb_packets;
+    stress_packet_t audio;
+
+    mux_manager_t *manager;
+    int64_t start_us;
+    camera_t *cameras;
+} stress_t;
+
+static atomic_int quit;
+
+static void __stress_signal(int sig)
+{
+    (void)sig;
+    atomic_store(&quit, 1);
+}
+
+static int __hist_index(int64_t v)
+{
+    int e = 0;
+
+    if (v < 8)
+        return v < 0 ? 0 : (int)v;
+
+    while ((v >> (e + 1)) != 0)
+        e++;
+
+    return (e - 2) * 8 + (int)((v >> (e - 3)) & 7);
+}
+
+//桶的上界
+static int64_t __hist_value(int index)
+{
+    int e = index / 8 + 2;
+
+    if (index < 8)
+        return index;
+
+    return ((int64_t)(8 + index % 8 + 1) << (e - 3)) - 1;
+}
+
+static void __hist_add(latency_hist_t *h, int64_t v)
+{
+    h->buckets[__hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void __hist_merge(latency_hist_t *dst, const latency_hist_t *src)
+{
+    int i = 0;
+
+    for (i = 0; i < STRESS_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static int64_t __hist_percentile(const latency_hist_t *h, double p)
+{
+    int64_t target = (int64_t)(p * h->count + 0.5), sum = 0;
+    int i = 0;
+
+    if (h->count == 0)
+        return 0;
+    if (target < 1)
+        target = 1;
+
+    for (i = 0; i < STRESS_HIST_BUCKETS; i++) {
+        sum += h->buckets[i];
+        if (sum >= target)
+            return FFMIN(__hist_value(i), h->max);
+    }
+
+    return h->max;
+}
+
+static int64_t __stress_rss(void)
+{
+#ifdef __linux__
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+static int64_t __stress_process_cpu_us(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int64_t __stress_thread_cpu_us(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * 预先生成STRESS_PREGEN_GOPS个gop的视频和一帧音频,所有路共享
+ */
+static int __stress_pregen(stress_t *s)
+{
+    synth_audio_config_t audio = { STRESS_AUDIO_RATE, STRESS_AUDIO_CHANNELS, 64000 };
+    AVCodecParameters *par = NULL;
+    synth_t *synth = NULL;
+    synth_frame_t frame;
+    int i = 0, ret = -1;
+
+    synth = synth_video_create(&s->video);
+    par = avcodec_parameters_alloc();
+    if (synth == NULL || par == NULL || synth_get_codecpar(synth, par) != 0)
+        goto fail;
+
+    s->extradata = av_memdup(par->extradata, par->extradata_size);
+    s->extradata_size = par->extradata_size;
+
+    s->nb_packets = s->video.gop * STRESS_PREGEN_GOPS;
+    s->packets = av_mallocz_array(s->nb_packets, sizeof(stress_packet_t));
+    if (s->extradata == NULL || s->packets == NULL)
+        goto fail;
+
+    for (i = 0; i < s->nb_packets; i++) {
+        if (synth_next(synth, &frame) != 0)
+            goto fail;
+        s->packets[i].data = av_memdup(frame.data, frame.size);
+        s->packets[i].size = frame.size;
+        s->packets[i].keyframe = frame.keyframe;
+        if (s->packets[i].data == NULL)
+            goto fail;
+    }
+
+    synth_destroy(&synth);
+
+    synth = synth_audio_create(&audio);
+    if (synth == NULL || synth_next(synth, &frame) != 0)
+        goto fail;
+    s->audio.data = av_memdup(frame.data, frame.size);
+    s->audio.size = frame.size;
+    s->audio.keyframe = 1;
+    if (s->audio.data == NULL)
+        goto fail;
+
+    ret = 0;
+
+fail:
+    avcodec_parameters_free(&par);
+    synth_destroy(&synth);
+
+    return ret;
+}
+
+static void *__stress_camera(void *arg)
+{
+    camera_t *cam = (camera_t *)arg;
+    stress_t *s = cam->stress;
+    const stress_packet_t *pkt = NULL;
+    int64_t start = s->start_us + cam->offset_us, end = s->start_us + s->duration_us;
+    double video_us = 1000000.0 * s->video.frame_rate.den / s->video.frame_rate.num / s->speed;
+    double audio_us = 1000000.0 * STRESS_AUDIO_SAMPLES / STRESS_AUDIO_RATE / s->speed;
+    int64_t vi = 0, ai = 0, video_due = 0, audio_due = 0, due = 0, now = 0, lag = 0, t = 0;
+    char name[32];
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "camera %d", cam->id);
+    trace_set_thread_name(name);
+
+    while (!atomic_load(&quit)) {
+        video_due = start + (int64_t)(vi * video_us);
+        audio_due = start + (int64_t)(ai * audio_us);
+        due = FFMIN(video_due, audio_due);
+        if (due >= end)
+            break;
+
+        now = av_gettime_relative();
+        if (due > now) {
+            av_usleep((unsigned)(due - now));
+            now = av_gettime_relative();
+        }
+
+        lag = now - due;
+        if (video_due <= audio_due) {
+            pkt = &s->packets[vi % s->nb_packets];
+            if (lag > s->max_lag_us) {
+                atomic_fetch_add(&cam->dropped, 1);
+            } else {
+                __hist_add(&cam->lag, lag);
+                ret = muxer_write_video(cam->muxer, (const char *)pkt->data, pkt->size, pkt->keyframe,
+                                        av_rescale(vi, 1000LL * s->video.frame_rate.den, s->video.frame_rate.num));
+                t = av_gettime_relative();
+                __hist_add(&cam->write, t - now);
+                if (ret != 0) {
+                    cam->errors++;
+                } else {
+                    atomic_fetch_add(&cam->frames, 1);
+                    cam->bytes += pkt->size;
+                }
+            }
+            vi++;
+        } else {
+            if (lag <= s->max_lag_us) {
+                ret = muxer_write_audio(cam->muxer, (const char *)s->audio.data, s->audio.size,
+                                        ai * STRESS_AUDIO_SAMPLES * 1000 / STRESS_AUDIO_RATE);
+                __hist_add(&cam->write, av_gettime_relative() - now);
+                if (ret != 0) {
+                    cam->errors++;
+                } else {
+                    cam->audio_frames++;
+                    cam->bytes += s->audio.size;
+                }
+            }
+            ai++;
+        }
+    }
+
+    t = av_gettime_relative();
+    if (muxer_close(cam->muxer) != 0)
+        cam->errors++;
+    cam->close_us = av_gettime_relative() - t;
+    cam->cpu_us = __stress_thread_cpu_us();
+
+    return NULL;
+}
+
+static int __stress_open_camera(stress_t *s, camera_t *cam)
+{
+    char filename[4096];
+
+    cam->muxer = muxer_create();
+    if (cam->muxer == NULL)
+        return -1;
+
+    snprintf(filename, sizeof(filename), "%s/cam_%04d.%s", s->output, cam->id,
+             s->format == MUXER_FORMAT_MPEGTS ? "ts" : "mp4");
+
+    if (muxer_set_format(cam->muxer, s->format) != 0 ||
+        (s->manager != NULL && muxer_set_manager(cam->muxer, s->manager) != 0) ||
+        muxer_open(cam->muxer, filename) != 0 ||
+        muxer_add_video_and_audio(cam->muxer, s->codec, s->video.width, s->video.height,
+                                  s->extradata, s->extradata_size) != 0) {
+        fprintf(stderr, "open '%s' failed\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void __stress_report(stress_t *s, int64_t elapsed_us, int64_t rss_base, int64_t rss_peak, int64_t process_cpu_us)
+{
+    latency_hist_t *write = NULL, *lag = NULL;
+    camera_t *cam = NULL;
+    int64_t frames = 0, dropped = 0, errors = 0, bytes = 0, camera_cpu_us = 0, close_max_us = 0;
+    int64_t expected = (int64_t)(s->duration_us / 1000000.0 * av_q2d(s->video.frame_rate) * s->speed);
+    int i = 0, n = s->nb_cameras;
+
+    write = calloc(1, sizeof(latency_hist_t));
+    lag = calloc(1, sizeof(latency_hist_t));
+    if (write == NULL || lag == NULL)
+        goto fail;
+
+    printf("%5s %8s %7s %6s %9s %9s %9s %9s %9s %6s %9s\n", "cam", "frames", "dropped", "errors",
+           "p50_us", "p99_us", "p999_us", "max_us", "lag99_us", "cpu%", "close_ms");
+
+    for (i = 0; i < n; i++) {
+        cam = &s->cameras[i];
+        printf("%5d %8lld %7lld %6lld %9lld %9lld %9lld %9lld %9lld %6.1f %9.1f\n", cam->id,
+               (long long)atomic_load(&cam->frames), (long long)atomic_load(&cam->dropped), (long long)cam->errors,
+               (long long)__hist_percentile(&cam->write, 0.5), (long long)__hist_percentile(&cam->write, 0.99),
+               (long long)__hist_percentile(&cam->write, 0.999), (long long)cam->write.max,
+               (long long)__hist_percentile(&cam->lag, 0.99), cam->cpu_us * 100.0 / elapsed_us, cam->close_us / 1000.0);
+
+        __hist_merge(write, &cam->write);
+        __hist_merge(lag, &cam->lag);
+        frames += atomic_load(&cam->frames);
+        dropped += atomic_load(&cam->dropped);
+        errors += cam->errors;
+        bytes += cam->bytes;
+        camera_cpu_us += cam->cpu_us;
+        close_max_us = FFMAX(close_max_us, cam->close_us);
+    }
+
+    printf("\ncameras:            %d x %dx%d@%.2f %s %lld kbps, speed x%.1f\n", n, s->video.width, s->video.height,
+           av_q2d(s->video.frame_rate), s->codec == MUXER_CODEC_H265 ? "hevc" : "h264",
+           (long long)(s->video.bit_rate / 1000), s->speed);
+    printf("video frames:       %lld written, %lld dropped (%.3f%%), %lld expected\n", (long long)frames,
+           (long long)dropped, frames + dropped > 0 ? dropped * 100.0 / (frames + dropped) : 0.0, (long long)expected * n);
+    printf("write errors:       %lld\n", (long long)errors);
+    printf("write latency us:   p50 %lld  p90 %lld  p99 %lld  p99.9 %lld  max %lld\n",
+           (long long)__hist_percentile(write, 0.5), (long long)__hist_percentile(write, 0.9),
+           (long long)__hist_percentile(write, 0.99), (long long)__hist_percentile(write, 0.999), (long long)write->max);
+    printf("schedule lag us:    p50 %lld  p99 %lld  max %lld\n", (long long)__hist_percentile(lag, 0.5),
+           (long long)__hist_percentile(lag, 0.99), (long long)lag->max);
+    printf("throughput:         %.2f MB/s\n", bytes / 1.048576 / elapsed_us);
+    printf("cpu:                %.1f%% total, %.2f%% per camera, %.1f%% io/other threads\n",
+           process_cpu_us * 100.0 / elapsed_us, camera_cpu_us * 100.0 / elapsed_us / n,
+           FFMAX(process_cpu_us - camera_cpu_us, 0) * 100.0 / elapsed_us);
+    printf("memory:             %.1f MB peak rss, %.1f KB per camera\n", rss_peak / 1048576.0,
+           FFMAX(rss_peak - rss_base, 0) / 1024.0 / n);
+    printf("close max:          %.1f ms\n", close_max_us / 1000.0);
+
+    //丢帧或者p99延迟超过一帧说明已经跟不上
+    printf("saturated:          %s\n",
+           dropped > 0 || __hist_percentile(lag, 0.99) * s->speed * s->video.frame_rate.num > 1000000LL * s->video.frame_rate.den ?
+           "yes" : "no");
+
+fail:
+    free(write);
+    free(lag);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n cameras] [-d seconds] [-c h264|hevc] [-s WxH] [-r fps] [-b video_kbps] [-g gop]\n"
+                    "       [-x speed] [-l max_lag_ms] [-m io_threads] [-f mp4|ts] [-o output_dir] [-T trace.json]\n"
+                    "       [-M metrics.prom|metrics.sock]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    stress_t s;
+    pthread_attr_t attr;
+    int64_t rss_base = 0, rss_peak = 0, rss = 0, cpu_start = 0, elapsed = 0, frames = 0, dropped = 0;
+    const char *trace_file = NULL, *metrics_file = NULL;
+    int io_threads = 0, opt = 0, i = 0, ret = -1;
+
+    memset(&s, 0, sizeof(s));
+    s.nb_cameras = 16;
+    s.duration_us = 60 * 1000000LL;
+    s.speed = 1.0;
+    s.max_lag_us = 500 * 1000;
+    s.format = MUXER_FORMAT_MP4;
+    s.codec = MUXER_CODEC_H264;
+    s.output = ".";
+    s.video.codec_id = AV_CODEC_ID_H264;
+    s.video.width = 1920;
+    s.video.height = 1080;
+    s.video.frame_rate = (AVRational){25, 1};
+    s.video.gop = 50;
+    s.video.bit_rate = 4000000;
+    s.video.seed = 1;
+
+    while ((opt = getopt(argc, argv, "n:d:c:s:r:b:g:x:l:m:f:o:T:M:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            s.nb_cameras = atoi(optarg);
+            break;
+        case 'd':
+            s.duration_us = atoll(optarg) * 1000000LL;
+            break;
+        case 'c':
+            if (strcmp(optarg, "hevc") == 0 || strcmp(optarg, "h265") == 0) {
+                s.video.codec_id = AV_CODEC_ID_HEVC;
+                s.codec = MUXER_CODEC_H265;
+            }
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &s.video.width, &s.video.height) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r':
+            s.video.frame_rate = av_d2q(atof(optarg), 1001000);
+            break;
+        case 'b':
+            s.video.bit_rate = atoll(optarg) * 1000;
+            break;
+        case 'g':
+            s.video.gop = atoi(optarg);
+            break;
+        case 'x':
+            s.speed = atof(optarg);
+            break;
+        case 'l':
+            s.max_lag_us = atoll(optarg) * 1000;
+            break;
+        case 'm':
+            io_threads = atoi(optarg);
+            break;
+        case 'f':
+            s.format = strcmp(optarg, "ts") == 0 ? MUXER_FORMAT_MPEGTS : MUXER_FORMAT_MP4;
+            break;
+        case 'o':
+            s.output = optarg;
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        case 'M':
+            metrics_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind != argc || s.nb_cameras <= 0 || s.nb_cameras > STRESS_MAX_CAMERAS ||
+        s.duration_us <= 0 || s.speed <= 0 || s.max_lag_us <= 0 || s.video.gop <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    signal(SIGINT, __stress_signal);
+    signal(SIGTERM, __stress_signal);
+
+    if (__stress_pregen(&s) != 0) {
+        fprintf(stderr, "invalid video parameters\n");
+        goto fail;
+    }
+
+    s.cameras = calloc(s.nb_cameras, sizeof(camera_t));
+    if (s.cameras == NULL)
+        goto fail;
+
+    if (io_threads > 0) {
+        s.manager = mux_manager_create(io_threads, 0, 0);
+        if (s.manager == NULL)
+            goto fail;
+    }
+
+    //预生成的数据不算在每路的内存里
+    rss_base = __stress_rss();
+
+    for (i = 0; i < s.nb_cameras; i++) {
+        s.cameras[i].id = i;
+        s.cameras[i].stress = &s;
+        s.cameras[i].offset_us = (int64_t)(1000000.0 * s.video.frame_rate.den / s.video.frame_rate.num / s.speed * i / s.nb_cameras);
+        atomic_init(&s.cameras[i].frames, 0);
+        atomic_init(&s.cameras[i].dropped, 0);
+        if (__stress_open_camera(&s, &s.cameras[i]) != 0)
+            goto fail;
+    }
+
+    //几千个线程时默认8M栈太浪费
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    if (trace_file != NULL)
+        trace_start(0);
+
+    if (metrics_file != NULL && av_match_ext(metrics_file, "sock")) {
+        if (metrics_serve(metrics_file) != 0)
+            fprintf(stderr, "serve metrics on %s failed\n", metrics_file);
+        metrics_file = NULL;
+    }
+
+    cpu_start = __stress_process_cpu_us();
+    s.start_us = av_gettime_relative() + 100 * 1000;
+    for (i = 0; i < s.nb_cameras; i++) {
+        if (pthread_create(&s.cameras[i].thread, &attr, __stress_camera, &s.cameras[i]) != 0) {
+            fprintf(stderr, "create thread %d failed\n", i);
+            atomic_store(&quit, 1);
+            break;
+        }
+        s.cameras[i].started = 1;
+    }
+    pthread_attr_destroy(&attr);
+
+    //每秒打印一次进度
+    while (!atomic_load(&quit) && av_gettime_relative() < s.start_us + s.duration_us) {
+        av_usleep(1000 * 1000);
+
+        rss = __stress_rss();
+        rss_peak = FFMAX(rss_peak, rss);
+
+        frames = dropped = 0;
+        for (i = 0; i < s.nb_cameras; i++) {
+            frames += atomic_load(&s.cameras[i].frames);
+            dropped += atomic_load(&s.cameras[i].dropped);
+        }
+        fprintf(stderr, "\r%5.1fs  frames %lld  dropped %lld  rss %.1f MB  ",
+                (av_gettime_relative() - s.start_us) / 1000000.0, (long long)frames, (long long)dropped, rss / 1048576.0);
+
+        if (metrics_file != NULL && metrics_dump(metrics_file) != 0)
+            fprintf(stderr, "write %s failed\n", metrics_file);
+    }
+    fprintf(stderr, "\n");
+
+    for (i = 0; i < s.nb_cameras; i++) {
+        if (s.cameras[i].started)
+            pthread_join(s.cameras[i].thread, NULL);
+    }
+    elapsed = av_gettime_relative() - s.start_us;
+    rss_peak = FFMAX(rss_peak, __stress_rss());
+
+    if (trace_file != NULL) {
+        trace_stop();
+        if (trace_dump(trace_file) < 0)
+            fprintf(stderr, "write %s failed\n", trace_file);
+    }
+
+    __stress_report(&s, elapsed, rss_base, rss_peak, __stress_process_cpu_us() - cpu_start);
+
+    ret = 0;
+
+fail:
+    metrics_serve_stop();
+    for (i = 0; s.cameras != NULL && i < s.nb_cameras; i++)
+        muxer_destroy(&s.cameras[i].muxer);
+    free(s.cameras);
+    mux_manager_destroy(&s.manager);
+    for (i = 0; s.packets != NULL && i < s.nb_packets; i++)
+        av_free(s.packets[i].data);
+    av_free(s.packets);
+    av_free(s.audio.data);
+    av_free(s.extradata);
+
+    return ret;
+}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = stress
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += stress.c
+
+include(media.pri)
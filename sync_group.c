@@ -0,0 +1,258 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <log.h>
+
+#include "sync_group.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define fdatasync(fd)   _commit(fd)
+#endif
+
+#define SYNC_GROUP_MAX_DEVICES  16
+
+typedef struct sync_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int count;
+    mux_io_t *head;
+} sync_group_t;
+
+static sync_group_t s_group = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .running = 0,
+    .count = 0,
+    .head = NULL,
+};
+
+static int __sync_group_interval(sync_group_t *group)
+{
+    int interval = 0;
+    mux_io_t *io = NULL;
+
+    for (io = group->head; io != NULL; io = io->next) {
+        if (interval == 0 || io->sync_interval_ms < interval)
+            interval = io->sync_interval_ms;
+    }
+
+    return interval > 0 ? interval : 1000;
+}
+
+typedef struct sync_target {
+    int fd;             //dup的fd
+    dev_t dev;
+    int whole_fs;       //1:syncfs整个文件系统 0:fdatasync
+    int error;          //失败时的errno
+} sync_target_t;
+
+static int __sync_group_contains(sync_group_t *group, mux_io_t *target)
+{
+    mux_io_t *io = NULL;
+
+    for (io = group->head; io != NULL; io = io->next) {
+        if (io == target)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * 在锁内复制需要刷盘的fd(dup,文件在刷盘过程中被关闭也不影响),解锁后再刷盘,
+ * 刷盘期间不阻塞sync_group_add/sync_group_remove(也就是muxer的打开和关闭)
+ * 失败时把errno记在对应的文件上并重新标记为脏,之后的写入,mux_io_sync和mux_io_close返回错误
+ * 返回时仍然持有锁
+ */
+static void __sync_group_commit(sync_group_t *group)
+{
+    mux_io_t *io = NULL, **ios = NULL;
+    sync_target_t *targets = NULL;
+    int *slots = NULL;
+    int nio = 0, ntarget = 0, ndev = 0, fd = -1, i = 0, j = 0, err = 0, expected = 0;
+
+    if (group->count == 0)
+        return;
+
+    ios = malloc(group->count * sizeof(mux_io_t *));
+    slots = malloc(group->count * sizeof(int));
+    targets = malloc(group->count * sizeof(sync_target_t));
+    if (ios == NULL || slots == NULL || targets == NULL)
+        goto out;
+
+    for (io = group->head; io != NULL; io = io->next) {
+        if (atomic_exchange(&io->dirty, 0) == 0)
+            continue;
+
+        j = ntarget;
+#if defined(__linux__)
+        //同一个文件系统上的脏文件只需要一次syncfs
+        for (i = 0; i < ntarget; i++) {
+            if (targets[i].whole_fs && targets[i].dev == io->dev) {
+                j = i;
+                break;
+            }
+        }
+#endif
+
+        if (j == ntarget) {
+            fd = dup(io->fd);
+            if (fd < 0) {
+                atomic_store(&io->dirty, 1);
+                continue;
+            }
+            targets[j].fd = fd;
+            targets[j].dev = io->dev;
+            targets[j].error = 0;
+            //设备太多或者没有syncfs时单独fdatasync
+#if defined(__linux__)
+            targets[j].whole_fs = ndev < SYNC_GROUP_MAX_DEVICES;
+#else
+            targets[j].whole_fs = 0;
+#endif
+            ndev += targets[j].whole_fs;
+            ntarget++;
+        }
+
+        ios[nio] = io;
+        slots[nio++] = j;
+    }
+
+    pthread_mutex_unlock(&group->mutex);
+
+    for (i = 0; i < ntarget; i++) {
+#if defined(__linux__)
+        if (targets[i].whole_fs)
+            err = syncfs(targets[i].fd);
+        else
+#endif
+            err = fdatasync(targets[i].fd);
+        if (err != 0) {
+            targets[i].error = errno;
+            LOG("sync failed: %s\n", strerror(errno));
+        }
+        close(targets[i].fd);
+    }
+
+    pthread_mutex_lock(&group->mutex);
+
+    //已经移除的文件不再访问
+    for (i = 0; i < nio; i++) {
+        err = targets[slots[i]].error;
+        if (err == 0 || !__sync_group_contains(group, ios[i]))
+            continue;
+        expected = 0;
+        atomic_compare_exchange_strong(&ios[i]->error, &expected, err);
+        atomic_store(&ios[i]->dirty, 1);
+    }
+
+out:
+    free(targets);
+    free(slots);
+    free(ios);
+}
+
+/**
+ * 线程第一次sync_group_add时创建,之后一直存在,没有文件时不限时等待
+ * 不在最后一个文件移除时退出,避免移除和添加交错时出现两个线程
+ */
+static void *__sync_group_thread(void *arg)
+{
+    sync_group_t *group = (sync_group_t *)arg;
+    struct timespec ts;
+    int interval = 0;
+
+    pthread_mutex_lock(&group->mutex);
+
+    for (;;) {
+        if (group->count == 0) {
+            pthread_cond_wait(&group->cond, &group->mutex);
+            continue;
+        }
+
+        interval = __sync_group_interval(group);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += interval / 1000;
+        ts.tv_nsec += (interval % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        if (pthread_cond_timedwait(&group->cond, &group->mutex, &ts) == ETIMEDOUT)
+            __sync_group_commit(group);
+    }
+
+    pthread_mutex_unlock(&group->mutex);
+
+    return NULL;
+}
+
+int sync_group_add(mux_io_t *io, int interval_ms)
+{
+    int ret = 0;
+
+    if (io == NULL || interval_ms <= 0)
+        return -1;
+
+    pthread_mutex_lock(&s_group.mutex);
+
+    io->sync_interval_ms = interval_ms;
+    io->next = s_group.head;
+    s_group.head = io;
+    s_group.count++;
+
+    if (s_group.running == 0) {
+        s_group.running = 1;
+        if (pthread_create(&s_group.thread, NULL, __sync_group_thread, &s_group) != 0) {
+            LOG("create sync group thread failed\n");
+            s_group.head = io->next;
+            s_group.count--;
+            s_group.running = 0;
+            ret = -2;
+        } else {
+            pthread_detach(s_group.thread);
+        }
+    } else {
+        //线程可能在空闲等待,或者间隔变短需要重新计算
+        pthread_cond_signal(&s_group.cond);
+    }
+
+    pthread_mutex_unlock(&s_group.mutex);
+
+    return ret;
+}
+
+void sync_group_remove(mux_io_t *io)
+{
+    mux_io_t **pp = NULL;
+
+    if (io == NULL)
+        return;
+
+    pthread_mutex_lock(&s_group.mutex);
+
+    for (pp = &s_group.head; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == io) {
+            *pp = io->next;
+            io->next = NULL;
+            s_group.count--;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s_group.mutex);
+}
@@ -0,0 +1,33 @@
+#ifndef __SYNC_GROUP_H
+#define __SYNC_GROUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mux_io.h"
+
+/**
+ * @brief 把文件加入进程内共享的group commit线程
+ *   线程按所有已注册文件中最小的间隔醒来,一次把所有脏文件刷盘,
+ *   linux下同一个设备上的文件只调用一次syncfs
+ *
+ * @param io: mux_io_open返回值
+ * @param interval_ms: 最长刷盘间隔(毫秒)
+ * @return int: 0成功 其他失败
+ */
+int sync_group_add(mux_io_t *io, int interval_ms);
+
+/**
+ * @brief 从group commit线程中移除,不等待正在进行的刷盘(刷盘使用dup的fd)
+ *   线程在进程内一直存在,没有文件时空闲等待
+ *
+ * @param io: mux_io_open返回值
+ */
+void sync_group_remove(mux_io_t *io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SYNC_GROUP_H
@@ -0,0 +1,680 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/mem.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/channel_layout.h"
+
+#include "synth.h"
+#include "nal.h"
+
+#define SYNTH_PS_MAX_SIZE       256
+#define SYNTH_HEADER_MAX_SIZE   64
+#define SYNTH_KEYFRAME_RATIO    8       //关键帧和普通帧的大小比例
+#define SYNTH_AAC_FRAME_SAMPLES 1024
+#define SYNTH_AAC_FIL_MAX       269     //一个FIL元素最多填充的字节数
+
+enum SYNTH_AAC_ELEMENT {
+    SYNTH_AAC_SCE       = 0,
+    SYNTH_AAC_CPE       = 1,
+    SYNTH_AAC_FIL       = 6,
+    SYNTH_AAC_END       = 7,
+};
+
+struct synth {
+    enum AVMediaType type;
+    enum AVCodecID codec_id;
+    AVRational time_base;
+    int64_t index;                      //已经生成的帧数
+
+    //视频
+    synth_video_config_t video;
+    int keyframe_size;
+    int frame_size;
+    int idr_pic_id;
+    uint32_t seed;
+    uint8_t ps[SYNTH_PS_MAX_SIZE];      //annexb VPS/SPS/PPS
+    int ps_size;
+
+    //音频
+    synth_audio_config_t audio;
+    uint8_t asc[2];
+
+    uint8_t *rbsp;
+    uint8_t *buf;
+    int buf_size;
+};
+
+typedef struct bit_writer {
+    uint8_t *data;
+    int size;
+    int index;      //bit
+} bit_writer_t;
+
+static void __bw_init(bit_writer_t *bw, uint8_t *data, int size)
+{
+    bw->data = data;
+    bw->size = size;
+    bw->index = 0;
+    memset(data, 0, size);
+}
+
+static void __bw_write(bit_writer_t *bw, int n, uint32_t v)
+{
+    while (n-- > 0) {
+        int byte = bw->index >> 3;
+        if (byte < bw->size && ((v >> n) & 1))
+            bw->data[byte] |= 0x80 >> (bw->index & 7);
+        bw->index++;
+    }
+}
+
+static void __bw_write_ue(bit_writer_t *bw, uint32_t v)
+{
+    int len = 0;
+
+    v++;
+    while ((v >> len) > 1)
+        len++;
+
+    __bw_write(bw, len, 0);
+    __bw_write(bw, len + 1, v);
+}
+
+static void __bw_write_se(bit_writer_t *bw, int v)
+{
+    __bw_write_ue(bw, v <= 0 ? -2 * v : 2 * v - 1);
+}
+
+//rbsp_trailing_bits
+static int __bw_trailing(bit_writer_t *bw)
+{
+    __bw_write(bw, 1, 1);
+    while (bw->index & 7)
+        __bw_write(bw, 1, 0);
+
+    return bw->index >> 3;
+}
+
+static uint32_t __synth_rand(synth_t *s)
+{
+    s->seed = s->seed * 1103515245u + 12345u;
+    return s->seed >> 8;
+}
+
+/**
+ * 加起始码和防竞争字节,返回写入的长度
+ */
+static int __synth_put_nal(uint8_t *dst, const uint8_t *rbsp, int size)
+{
+    uint8_t *p = dst;
+    int i = 0, zeros = 0;
+
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 1;
+
+    for (i = 0; i < size; i++) {
+        if (zeros >= 2 && rbsp[i] <= 3) {
+            *p++ = 3;
+            zeros = 0;
+        }
+        *p++ = rbsp[i];
+        zeros = rbsp[i] == 0 ? zeros + 1 : 0;
+    }
+
+    return p - dst;
+}
+
+static int __synth_h264_level(const synth_video_config_t *c)
+{
+    static const struct {
+        int level;
+        int64_t mbps;
+        int fs;
+    } levels[] = {
+        { 30, 40500, 1620 }, { 31, 108000, 3600 }, { 32, 216000, 5120 },
+        { 40, 245760, 8192 }, { 42, 522240, 8704 }, { 50, 589824, 22080 },
+        { 51, 983040, 36864 }, { 52, 2073600, 36864 }, { 60, 4177920, 139264 },
+        { 61, 8355840, 139264 }, { 62, 16711680, 139264 },
+    };
+    int64_t fs = (int64_t)((c->width + 15) / 16) * ((c->height + 15) / 16);
+    int64_t mbps = av_rescale(fs, c->frame_rate.num, c->frame_rate.den);
+    int i = 0;
+
+    for (i = 0; i < (int)FF_ARRAY_ELEMS(levels) - 1; i++) {
+        if (fs <= levels[i].fs && mbps <= levels[i].mbps)
+            break;
+    }
+
+    return levels[i].level;
+}
+
+static int __synth_hevc_level(const synth_video_config_t *c)
+{
+    static const struct {
+        int level;
+        int64_t ps;
+        int64_t sps;
+    } levels[] = {
+        { 60, 36864, 552960 }, { 90, 552960, 16588800 }, { 93, 983040, 33177600 },
+        { 120, 2228224, 66846720 }, { 123, 2228224, 133693440 },
+        { 150, 8912896, 267386880 }, { 153, 8912896, 534773760 }, { 156, 8912896, 1069547520 },
+        { 180, 35651584, 1069547520 }, { 183, 35651584, 2139095040 }, { 186, 35651584, 4278190080LL },
+    };
+    int64_t ps = (int64_t)c->width * c->height;
+    int64_t sps = av_rescale(ps, c->frame_rate.num, c->frame_rate.den);
+    int i = 0;
+
+    for (i = 0; i < (int)FF_ARRAY_ELEMS(levels) - 1; i++) {
+        if (ps <= levels[i].ps && sps <= levels[i].sps)
+            break;
+    }
+
+    return levels[i].level;
+}
+
+/**
+ * Main profile, CAVLC, poc type 2,只有I/P帧
+ */
+static void __synth_h264_param_sets(synth_t *s)
+{
+    const synth_video_config_t *c = &s->video;
+    uint8_t rbsp[SYNTH_HEADER_MAX_SIZE];
+    bit_writer_t bw;
+    int mb_width = (c->width + 15) / 16, mb_height = (c->height + 15) / 16;
+
+    __bw_init(&bw, rbsp, sizeof(rbsp));
+    __bw_write(&bw, 8, 0x60 | NAL_H264_SPS);
+    __bw_write(&bw, 8, 77);                 //profile_idc
+    __bw_write(&bw, 8, 0x40);               //constraint_set1_flag
+    __bw_write(&bw, 8, __synth_h264_level(c));
+    __bw_write_ue(&bw, 0);                  //seq_parameter_set_id
+    __bw_write_ue(&bw, 4);                  //log2_max_frame_num_minus4
+    __bw_write_ue(&bw, 2);                  //pic_order_cnt_type
+    __bw_write_ue(&bw, 1);                  //max_num_ref_frames
+    __bw_write(&bw, 1, 0);                  //gaps_in_frame_num_value_allowed_flag
+    __bw_write_ue(&bw, mb_width - 1);
+    __bw_write_ue(&bw, mb_height - 1);
+    __bw_write(&bw, 1, 1);                  //frame_mbs_only_flag
+    __bw_write(&bw, 1, 1);                  //direct_8x8_inference_flag
+    if (mb_width * 16 != c->width || mb_height * 16 != c->height) {
+        __bw_write(&bw, 1, 1);
+        __bw_write_ue(&bw, 0);
+        __bw_write_ue(&bw, (mb_width * 16 - c->width) / 2);
+        __bw_write_ue(&bw, 0);
+        __bw_write_ue(&bw, (mb_height * 16 - c->height) / 2);
+    } else {
+        __bw_write(&bw, 1, 0);
+    }
+    __bw_write(&bw, 1, 1);                  //vui_parameters_present_flag
+    __bw_write(&bw, 4, 0);                  //aspect_ratio/overscan/video_signal/chroma_loc
+    __bw_write(&bw, 1, 1);                  //timing_info_present_flag
+    __bw_write(&bw, 32, c->frame_rate.den);
+    __bw_write(&bw, 32, c->frame_rate.num * 2);
+    __bw_write(&bw, 1, 1);                  //fixed_frame_rate_flag
+    __bw_write(&bw, 4, 0);                  //hrd/pic_struct/bitstream_restriction
+    s->ps_size = __synth_put_nal(s->ps, rbsp, __bw_trailing(&bw));
+
+    __bw_init(&bw, rbsp, sizeof(rbsp));
+    __bw_write(&bw, 8, 0x60 | NAL_H264_PPS);
+    __bw_write_ue(&bw, 0);                  //pic_parameter_set_id
+    __bw_write_ue(&bw, 0);                  //seq_parameter_set_id
+    __bw_write(&bw, 1, 0);                  //entropy_coding_mode_flag
+    __bw_write(&bw, 1, 0);                  //bottom_field_pic_order_in_frame_present_flag
+    __bw_write_ue(&bw, 0);                  //num_slice_groups_minus1
+    __bw_write_ue(&bw, 0);                  //num_ref_idx_l0_default_active_minus1
+    __bw_write_ue(&bw, 0);                  //num_ref_idx_l1_default_active_minus1
+    __bw_write(&bw, 1, 0);                  //weighted_pred_flag
+    __bw_write(&bw, 2, 0);                  //weighted_bipred_idc
+    __bw_write_se(&bw, 0);                  //pic_init_qp_minus26
+    __bw_write_se(&bw, 0);                  //pic_init_qs_minus26
+    __bw_write_se(&bw, 0);                  //chroma_qp_index_offset
+    __bw_write(&bw, 1, 1);                  //deblocking_filter_control_present_flag
+    __bw_write(&bw, 1, 0);                  //constrained_intra_pred_flag
+    __bw_write(&bw, 1, 0);                  //redundant_pic_cnt_present_flag
+    s->ps_size += __synth_put_nal(s->ps + s->ps_size, rbsp, __bw_trailing(&bw));
+}
+
+static int __synth_h264_slice_header(synth_t *s, int keyframe, int gop_index, uint8_t *rbsp, int size)
+{
+    bit_writer_t bw;
+
+    __bw_init(&bw, rbsp, size);
+    __bw_write(&bw, 8, keyframe ? 0x60 | NAL_H264_IDR : 0x40 | NAL_H264_SLICE);
+    __bw_write_ue(&bw, 0);                  //first_mb_in_slice
+    __bw_write_ue(&bw, keyframe ? 7 : 5);   //slice_type I/P
+    __bw_write_ue(&bw, 0);                  //pic_parameter_set_id
+    __bw_write(&bw, 8, gop_index & 0xff);   //frame_num
+    if (keyframe) {
+        __bw_write_ue(&bw, s->idr_pic_id);
+    } else {
+        __bw_write(&bw, 1, 0);              //num_ref_idx_active_override_flag
+        __bw_write(&bw, 1, 0);              //ref_pic_list_modification_flag_l0
+    }
+    if (keyframe)
+        __bw_write(&bw, 2, 0);              //no_output_of_prior_pics/long_term_reference
+    else
+        __bw_write(&bw, 1, 0);              //adaptive_ref_pic_marking_mode_flag
+    __bw_write_se(&bw, 0);                  //slice_qp_delta
+    __bw_write_ue(&bw, 1);                  //disable_deblocking_filter_idc
+
+    return (bw.index + 7) >> 3;
+}
+
+static void __synth_hevc_ptl(bit_writer_t *bw, int level)
+{
+    __bw_write(bw, 2, 0);                   //general_profile_space
+    __bw_write(bw, 1, 0);                   //general_tier_flag
+    __bw_write(bw, 5, 1);                   //general_profile_idc Main
+    __bw_write(bw, 32, 0x60000000);         //general_profile_compatibility_flag[1,2]
+    __bw_write(bw, 4, 0x9);                 //progressive/interlaced/non_packed/frame_only
+    __bw_write(bw, 22, 0);                  //general_reserved_zero_43bits
+    __bw_write(bw, 22, 0);                  //+ general_inbld_flag
+    __bw_write(bw, 8, level);
+}
+
+static void __synth_hevc_header(bit_writer_t *bw, int type)
+{
+    __bw_write(bw, 8, type << 1);
+    __bw_write(bw, 8, 1);                   //nuh_temporal_id_plus1
+}
+
+/**
+ * Main profile, CTB 64, 一个短期参考帧集合,只有I/P帧
+ */
+static void __synth_hevc_param_sets(synth_t *s)
+{
+    const synth_video_config_t *c = &s->video;
+    uint8_t rbsp[SYNTH_HEADER_MAX_SIZE];
+    bit_writer_t bw;
+    int width = FFALIGN(c->width, 8), height = FFALIGN(c->height, 8);
+    int level = __synth_hevc_level(c);
+
+    __bw_init(&bw, rbsp, sizeof(rbsp));
+    __synth_hevc_header(&bw, NAL_HEVC_VPS);
+    __bw_write(&bw, 4, 0);                  //vps_video_parameter_set_id
+    __bw_write(&bw, 2, 3);                  //vps_base_layer_internal/available_flag
+    __bw_write(&bw, 6, 0);                  //vps_max_layers_minus1
+    __bw_write(&bw, 3, 0);                  //vps_max_sub_layers_minus1
+    __bw_write(&bw, 1, 1);                  //vps_temporal_id_nesting_flag
+    __bw_write(&bw, 16, 0xffff);
+    __synth_hevc_ptl(&bw, level);
+    __bw_write(&bw, 1, 1);                  //vps_sub_layer_ordering_info_present_flag
+    __bw_write_ue(&bw, 1);                  //vps_max_dec_pic_buffering_minus1
+    __bw_write_ue(&bw, 0);                  //vps_max_num_reorder_pics
+    __bw_write_ue(&bw, 0);                  //vps_max_latency_increase_plus1
+    __bw_write(&bw, 6, 0);                  //vps_max_layer_id
+    __bw_write_ue(&bw, 0);                  //vps_num_layer_sets_minus1
+    __bw_write(&bw, 1, 1);                  //vps_timing_info_present_flag
+    __bw_write(&bw, 32, c->frame_rate.den);
+    __bw_write(&bw, 32, c->frame_rate.num);
+    __bw_write(&bw, 1, 0);                  //vps_poc_proportional_to_timing_flag
+    __bw_write_ue(&bw, 0);                  //vps_num_hrd_parameters
+    __bw_write(&bw, 1, 0);                  //vps_extension_flag
+    s->ps_size = __synth_put_nal(s->ps, rbsp, __bw_trailing(&bw));
+
+    __bw_init(&bw, rbsp, sizeof(rbsp));
+    __synth_hevc_header(&bw, NAL_HEVC_SPS);
+    __bw_write(&bw, 4, 0);                  //sps_video_parameter_set_id
+    __bw_write(&bw, 3, 0);                  //sps_max_sub_layers_minus1
+    __bw_write(&bw, 1, 1);                  //sps_temporal_id_nesting_flag
+    __synth_hevc_ptl(&bw, level);
+    __bw_write_ue(&bw, 0);                  //sps_seq_parameter_set_id
+    __bw_write_ue(&bw, 1);                  //chroma_format_idc 4:2:0
+    __bw_write_ue(&bw, width);
+    __bw_write_ue(&bw, height);
+    if (width != c->width || height != c->height) {
+        __bw_write(&bw, 1, 1);              //conformance_window_flag
+        __bw_write_ue(&bw, 0);
+        __bw_write_ue(&bw, (width - c->width) / 2);
+        __bw_write_ue(&bw, 0);
+        __bw_write_ue(&bw, (height - c->height) / 2);
+    } else {
+        __bw_write(&bw, 1, 0);
+    }
+    __bw_write_ue(&bw, 0);                  //bit_depth_luma_minus8
+    __bw_write_ue(&bw, 0);                  //bit_depth_chroma_minus8
+    __bw_write_ue(&bw, 4);                  //log2_max_pic_order_cnt_lsb_minus4
+    __bw_write(&bw, 1, 1);                  //sps_sub_layer_ordering_info_present_flag
+    __bw_write_ue(&bw, 1);                  //sps_max_dec_pic_buffering_minus1
+    __bw_write_ue(&bw, 0);                  //sps_max_num_reorder_pics
+    __bw_write_ue(&bw, 0);                  //sps_max_latency_increase_plus1
+    __bw_write_ue(&bw, 0);                  //log2_min_luma_coding_block_size_minus3
+    __bw_write_ue(&bw, 3);                  //log2_diff_max_min_luma_coding_block_size
+    __bw_write_ue(&bw, 0);                  //log2_min_luma_transform_block_size_minus2
+    __bw_write_ue(&bw, 3);                  //log2_diff_max_min_luma_transform_block_size
+    __bw_write_ue(&bw, 0);                  //max_transform_hierarchy_depth_inter
+    __bw_write_ue(&bw, 0);                  //max_transform_hierarchy_depth_intra
+    __bw_write(&bw, 4, 0);                  //scaling_list/amp/sao/pcm
+    __bw_write_ue(&bw, 1);                  //num_short_term_ref_pic_sets
+    __bw_write_ue(&bw, 1);                  //num_negative_pics
+    __bw_write_ue(&bw, 0);                  //num_positive_pics
+    __bw_write_ue(&bw, 0);                  //delta_poc_s0_minus1
+    __bw_write(&bw, 1, 1);                  //used_by_curr_pic_s0_flag
+    __bw_write(&bw, 1, 0);                  //long_term_ref_pics_present_flag
+    __bw_write(&bw, 1, 0);                  //sps_temporal_mvp_enabled_flag
+    __bw_write(&bw, 1, 0);                  //strong_intra_smoothing_enabled_flag
+    __bw_write(&bw, 1, 0);                  //vui_parameters_present_flag
+    __bw_write(&bw, 1, 0);                  //sps_extension_present_flag
+    s->ps_size += __synth_put_nal(s->ps + s->ps_size, rbsp, __bw_trailing(&bw));
+
+    __bw_init(&bw, rbsp, sizeof(rbsp));
+    __synth_hevc_header(&bw, NAL_HEVC_PPS);
+    __bw_write_ue(&bw, 0);                  //pps_pic_parameter_set_id
+    __bw_write_ue(&bw, 0);                  //pps_seq_parameter_set_id
+    __bw_write(&bw, 2, 0);                  //dependent_slice_segments/output_flag_present
+    __bw_write(&bw, 3, 0);                  //num_extra_slice_header_bits
+    __bw_write(&bw, 2, 0);                  //sign_data_hiding/cabac_init_present
+    __bw_write_ue(&bw, 0);                  //num_ref_idx_l0_default_active_minus1
+    __bw_write_ue(&bw, 0);                  //num_ref_idx_l1_default_active_minus1
+    __bw_write_se(&bw, 0);                  //init_qp_minus26
+    __bw_write(&bw, 3, 0);                  //constrained_intra_pred/transform_skip/cu_qp_delta
+    __bw_write_se(&bw, 0);                  //pps_cb_qp_offset
+    __bw_write_se(&bw, 0);                  //pps_cr_qp_offset
+    __bw_write(&bw, 9, 0);                  //slice_chroma_qp_offsets ... scaling_list_data_present
+    __bw_write(&bw, 1, 0);                  //lists_modification_present_flag
+    __bw_write_ue(&bw, 0);                  //log2_parallel_merge_level_minus2
+    __bw_write(&bw, 2, 0);                  //slice_segment_header_extension/pps_extension
+    s->ps_size += __synth_put_nal(s->ps + s->ps_size, rbsp, __bw_trailing(&bw));
+}
+
+static int __synth_hevc_slice_header(int keyframe, int gop_index, uint8_t *rbsp, int size)
+{
+    bit_writer_t bw;
+
+    __bw_init(&bw, rbsp, size);
+    __synth_hevc_header(&bw, keyframe ? NAL_HEVC_IDR_W_RADL : 1);
+    __bw_write(&bw, 1, 1);                  //first_slice_segment_in_pic_flag
+    if (keyframe)
+        __bw_write(&bw, 1, 0);              //no_output_of_prior_pics_flag
+    __bw_write_ue(&bw, 0);                  //slice_pic_parameter_set_id
+    __bw_write_ue(&bw, keyframe ? 2 : 1);   //slice_type I/P
+    if (!keyframe) {
+        __bw_write(&bw, 8, gop_index & 0xff);   //slice_pic_order_cnt_lsb
+        __bw_write(&bw, 1, 1);              //short_term_ref_pic_set_sps_flag
+        __bw_write(&bw, 1, 0);              //num_ref_idx_active_override_flag
+        __bw_write_ue(&bw, 0);              //five_minus_max_num_merge_cand
+    }
+    __bw_write_se(&bw, 0);                  //slice_qp_delta
+    __bw_trailing(&bw);                     //byte_alignment
+
+    return bw.index >> 3;
+}
+
+static int __synth_video_next(synth_t *s, synth_frame_t *frame)
+{
+    const synth_video_config_t *c = &s->video;
+    int gop_index = (int)(s->index % c->gop);
+    int keyframe = gop_index == 0;
+    int target = keyframe ? s->keyframe_size : s->frame_size;
+    int header = 0, payload = 0, size = 0, i = 0;
+
+    //大小在目标值的90%~110%之间
+    target = target * (90 + (int)(__synth_rand(s) % 21)) / 100;
+
+    if (keyframe) {
+        memcpy(s->buf, s->ps, s->ps_size);
+        size = s->ps_size;
+    }
+
+    if (c->codec_id == AV_CODEC_ID_HEVC)
+        header = __synth_hevc_slice_header(keyframe, gop_index, s->rbsp, SYNTH_HEADER_MAX_SIZE);
+    else
+        header = __synth_h264_slice_header(s, keyframe, gop_index, s->rbsp, SYNTH_HEADER_MAX_SIZE);
+
+    payload = target - size - header - 4;
+    if (payload < 16)
+        payload = 16;
+
+    for (i = 0; i < payload; i += 3) {
+        uint32_t r = __synth_rand(s);
+        s->rbsp[header + i] = r;
+        s->rbsp[header + i + 1] = r >> 8;
+        s->rbsp[header + i + 2] = r >> 16;
+    }
+    s->rbsp[header + payload - 1] = 0x80;   //rbsp_stop_one_bit
+
+    size += __synth_put_nal(s->buf + size, s->rbsp, header + payload);
+
+    if (keyframe)
+        s->idr_pic_id ^= 1;
+
+    frame->data = s->buf;
+    frame->size = size;
+    frame->keyframe = keyframe;
+    frame->pts = s->index;
+    frame->duration = 1;
+
+    return 0;
+}
+
+/**
+ * raw_data_block: 静音的SCE/CPE(max_sfb=0,没有频谱数据),FIL填充,END
+ */
+static int __synth_audio_next(synth_t *s, synth_frame_t *frame)
+{
+    const synth_audio_config_t *c = &s->audio;
+    bit_writer_t bw;
+    int target = (int)(c->bit_rate * SYNTH_AAC_FRAME_SAMPLES / 8 / c->sample_rate);
+    int ch = 0, need = 0, cnt = 0, i = 0;
+
+    if (target > s->buf_size)
+        target = s->buf_size;
+
+    __bw_init(&bw, s->buf, s->buf_size);
+    __bw_write(&bw, 3, c->channels == 2 ? SYNTH_AAC_CPE : SYNTH_AAC_SCE);
+    __bw_write(&bw, 4, 0);                  //element_instance_tag
+    if (c->channels == 2) {
+        __bw_write(&bw, 1, 1);              //common_window
+        __bw_write(&bw, 11, 0);             //ics_info: long window, max_sfb 0
+        __bw_write(&bw, 2, 0);              //ms_mask_present
+    }
+    for (ch = 0; ch < c->channels; ch++) {
+        __bw_write(&bw, 8, 100);            //global_gain
+        if (c->channels == 1)
+            __bw_write(&bw, 11, 0);         //ics_info
+        __bw_write(&bw, 3, 0);              //pulse/tns/gain_control_data_present
+    }
+
+    for (;;) {
+        need = target - ((bw.index + 7) >> 3) - 1;
+        if (need <= 2)
+            break;
+
+        cnt = FFMIN(need - 2, SYNTH_AAC_FIL_MAX);
+        __bw_write(&bw, 3, SYNTH_AAC_FIL);
+        if (cnt >= 15) {
+            __bw_write(&bw, 4, 15);
+            __bw_write(&bw, 8, cnt - 14);   //esc_count
+        } else {
+            __bw_write(&bw, 4, cnt);
+        }
+        __bw_write(&bw, 4, 0);              //extension_type EXT_FILL
+        __bw_write(&bw, 4, 0);              //fill_nibble
+        for (i = 1; i < cnt; i++)
+            __bw_write(&bw, 8, 0xa5);       //fill_byte
+    }
+
+    __bw_write(&bw, 3, SYNTH_AAC_END);
+
+    frame->data = s->buf;
+    frame->size = (bw.index + 7) >> 3;
+    frame->keyframe = 1;
+    frame->pts = s->index * SYNTH_AAC_FRAME_SAMPLES;
+    frame->duration = SYNTH_AAC_FRAME_SAMPLES;
+
+    return 0;
+}
+
+synth_t *synth_video_create(const synth_video_config_t *config)
+{
+    synth_t *s = NULL;
+    int64_t average = 0, frame = 0;
+
+    if (config == NULL ||
+        (config->codec_id != AV_CODEC_ID_H264 && config->codec_id != AV_CODEC_ID_HEVC) ||
+        config->width <= 0 || config->height <= 0 || (config->width & 1) || (config->height & 1) ||
+        config->frame_rate.num <= 0 || config->frame_rate.den <= 0 ||
+        config->gop <= 0 || config->bit_rate <= 0)
+        return NULL;
+
+    s = av_mallocz(sizeof(synth_t));
+    if (s == NULL)
+        return NULL;
+
+    s->type = AVMEDIA_TYPE_VIDEO;
+    s->codec_id = config->codec_id;
+    s->video = *config;
+    s->time_base = av_inv_q(config->frame_rate);
+    s->seed = config->seed;
+
+    //关键帧是普通帧的SYNTH_KEYFRAME_RATIO倍,一个gop的总大小符合码率
+    average = av_rescale(config->bit_rate / 8, config->frame_rate.den, config->frame_rate.num);
+    frame = average * config->gop / (SYNTH_KEYFRAME_RATIO + config->gop - 1);
+    if (config->gop == 1)
+        frame = average;
+    s->frame_size = (int)FFMAX(frame, 32);
+    s->keyframe_size = (int)FFMAX(config->gop == 1 ? frame : frame * SYNTH_KEYFRAME_RATIO, 32);
+
+    if (config->codec_id == AV_CODEC_ID_HEVC)
+        __synth_hevc_param_sets(s);
+    else
+        __synth_h264_param_sets(s);
+
+    //+10%抖动, 最坏情况每两个字节一个防竞争字节
+    s->buf_size = SYNTH_PS_MAX_SIZE + (s->keyframe_size + s->keyframe_size / 10 + 64) * 3 / 2;
+    s->rbsp = av_malloc(s->keyframe_size + s->keyframe_size / 10 + 64);
+    s->buf = av_malloc(s->buf_size);
+    if (s->rbsp == NULL || s->buf == NULL) {
+        synth_destroy(&s);
+        return NULL;
+    }
+
+    return s;
+}
+
+synth_t *synth_audio_create(const synth_audio_config_t *config)
+{
+    static const int rates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350,
+    };
+    synth_t *s = NULL;
+    int index = 0;
+
+    if (config == NULL || (config->channels != 1 && config->channels != 2) || config->bit_rate < 0)
+        return NULL;
+
+    for (index = 0; index < (int)FF_ARRAY_ELEMS(rates); index++) {
+        if (rates[index] == config->sample_rate)
+            break;
+    }
+    if (index == FF_ARRAY_ELEMS(rates))
+        return NULL;
+
+    s = av_mallocz(sizeof(synth_t));
+    if (s == NULL)
+        return NULL;
+
+    s->type = AVMEDIA_TYPE_AUDIO;
+    s->codec_id = AV_CODEC_ID_AAC;
+    s->audio = *config;
+    s->time_base = (AVRational){1, config->sample_rate};
+
+    //AudioSpecificConfig: AAC LC
+    s->asc[0] = (2 << 3) | (index >> 1);
+    s->asc[1] = ((index & 1) << 7) | (config->channels << 3);
+
+    //一帧最多6144bit每声道
+    s->buf_size = 768 * config->channels;
+    s->buf = av_malloc(s->buf_size);
+    if (s->buf == NULL) {
+        synth_destroy(&s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void synth_destroy(synth_t **synth)
+{
+    if (synth == NULL || *synth == NULL)
+        return;
+
+    av_free((*synth)->rbsp);
+    av_free((*synth)->buf);
+    av_freep(synth);
+}
+
+int synth_get_codecpar(synth_t *synth, AVCodecParameters *par)
+{
+    const uint8_t *extradata = NULL;
+    int size = 0;
+
+    if (synth == NULL || par == NULL)
+        return -1;
+
+    av_freep(&par->extradata);
+    par->extradata_size = 0;
+
+    par->codec_type = synth->type;
+    par->codec_id = synth->codec_id;
+    par->codec_tag = 0;
+
+    if (synth->type == AVMEDIA_TYPE_VIDEO) {
+        par->width = synth->video.width;
+        par->height = synth->video.height;
+        par->format = AV_PIX_FMT_YUV420P;
+        par->bit_rate = synth->video.bit_rate;
+        par->profile = synth->codec_id == AV_CODEC_ID_HEVC ? FF_PROFILE_HEVC_MAIN : FF_PROFILE_H264_MAIN;
+        extradata = synth->ps;
+        size = synth->ps_size;
+    } else {
+        par->sample_rate = synth->audio.sample_rate;
+        par->channels = synth->audio.channels;
+        par->channel_layout = av_get_default_channel_layout(synth->audio.channels);
+        par->format = AV_SAMPLE_FMT_FLTP;
+        par->frame_size = SYNTH_AAC_FRAME_SAMPLES;
+        par->bit_rate = synth->audio.bit_rate;
+        par->profile = FF_PROFILE_AAC_LOW;
+        extradata = synth->asc;
+        size = sizeof(synth->asc);
+    }
+
+    par->extradata = av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (par->extradata == NULL)
+        return -2;
+
+    memcpy(par->extradata, extradata, size);
+    par->extradata_size = size;
+
+    return 0;
+}
+
+AVRational synth_get_time_base(synth_t *synth)
+{
+    if (synth == NULL)
+        return (AVRational){0, 1};
+
+    return synth->time_base;
+}
+
+int synth_next(synth_t *synth, synth_frame_t *frame)
+{
+    int ret = 0;
+
+    if (synth == NULL || frame == NULL)
+        return -1;
+
+    if (synth->type == AVMEDIA_TYPE_VIDEO)
+        ret = __synth_video_next(synth, frame);
+    else
+        ret = __synth_audio_next(synth, frame);
+
+    if (ret == 0)
+        synth->index++;
+
+    return ret;
+}
@@ -0,0 +1,93 @@
+#ifndef __SYNTH_H
+#define __SYNTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+/**
+ * @brief 合成音视频码流,不依赖编码器,用于测试和性能测试
+ *   视频: 语法正确的VPS/SPS/PPS和slice头,slice数据是随机数,可以封装/解封装但不能解码出画面
+ *   音频: AAC LC静音帧,用FIL元素填充到指定码率,可以正常解码
+ *   相同的配置和seed每次生成的数据完全相同
+ */
+typedef struct synth synth_t;
+
+typedef struct synth_video_config {
+    enum AVCodecID codec_id;    //AV_CODEC_ID_H264或AV_CODEC_ID_HEVC
+    int width;
+    int height;
+    AVRational frame_rate;
+    int gop;                    //关键帧间隔(帧数)
+    int64_t bit_rate;           //平均码率bps,关键帧大小按gop分配
+    uint32_t seed;
+} synth_video_config_t;
+
+typedef struct synth_audio_config {
+    int sample_rate;
+    int channels;               //1或2
+    int64_t bit_rate;           //bps,小于静音帧大小时不填充
+} synth_audio_config_t;
+
+typedef struct synth_frame {
+    const uint8_t *data;        //下一次synth_next之前有效,视频是annexb格式
+    int size;
+    int keyframe;
+    int64_t pts;                //时间基见synth_get_time_base,dts和pts相同
+    int64_t duration;
+} synth_frame_t;
+
+/**
+ * @brief 创建视频合成器
+ *
+ * @param config: 视频参数
+ * @return synth_t*: NULL失败
+ */
+synth_t *synth_video_create(const synth_video_config_t *config);
+
+/**
+ * @brief 创建音频合成器
+ *
+ * @param config: 音频参数
+ * @return synth_t*: NULL失败
+ */
+synth_t *synth_audio_create(const synth_audio_config_t *config);
+
+/**
+ * @brief 摧毁合成器
+ *
+ * @param synth
+ */
+void synth_destroy(synth_t **synth);
+
+/**
+ * @brief 填充编码参数,视频extradata是annexb格式的VPS/SPS/PPS,音频是AudioSpecificConfig
+ *
+ * @param synth: synth_*_create返回值
+ * @param par: 调用者分配,原来的extradata会被释放
+ * @return int: 0成功 其他失败
+ */
+int synth_get_codecpar(synth_t *synth, AVCodecParameters *par);
+
+/**
+ * @brief 获取时间基: 视频是1/帧率,音频是1/采样率
+ */
+AVRational synth_get_time_base(synth_t *synth);
+
+/**
+ * @brief 生成下一帧,视频关键帧前面带VPS/SPS/PPS
+ *
+ * @param synth: synth_*_create返回值
+ * @param frame: 输出
+ * @return int: 0成功 其他失败
+ */
+int synth_next(synth_t *synth, synth_frame_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__SYNTH_H
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavutil/mem.h"
+
+#include <log.h>
+
+#include "tee.h"
+
+#define TEE_DEFAULT_PACKETS 256
+
+enum {
+    TEE_VIDEO = 0,
+    TEE_AUDIO = 1,
+};
+
+typedef struct tee_output {
+    muxer_t *muxer;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    AVPacket **ring;
+    int cap;
+    int head;
+    int count;
+    int need_key;
+    int quit;
+    int64_t dropped;
+} tee_output_t;
+
+struct tee {
+    pthread_mutex_t mutex;
+    tee_output_t *outputs[TEE_MAX_OUTPUTS];
+    int nb_outputs;
+};
+
+#define TEE_INIT()                          \
+    (struct tee)                            \
+    {                                       \
+        .mutex = PTHREAD_MUTEX_INITIALIZER, \
+        .outputs = {NULL},                  \
+        .nb_outputs = 0,                    \
+    }
+
+static void *__tee_output_thread(void *arg)
+{
+    tee_output_t *out = (tee_output_t *)arg;
+    AVPacket *pkt = NULL;
+
+    pthread_mutex_lock(&out->mutex);
+
+    for (;;) {
+        while (out->count == 0 && !out->quit)
+            pthread_cond_wait(&out->cond, &out->mutex);
+
+        //退出前把队列写完
+        if (out->count == 0)
+            break;
+
+        pkt = out->ring[out->head];
+        out->ring[out->head] = NULL;
+        out->head = (out->head + 1) % out->cap;
+        out->count--;
+
+        pthread_mutex_unlock(&out->mutex);
+
+        if (pkt->stream_index == TEE_VIDEO)
+            muxer_write_video_packet(out->muxer, pkt);
+        else
+            muxer_write_audio_packet(out->muxer, pkt);
+
+        av_packet_free(&pkt);
+
+        pthread_mutex_lock(&out->mutex);
+    }
+
+    pthread_mutex_unlock(&out->mutex);
+
+    return NULL;
+}
+
+static void __tee_output_free(tee_output_t *out)
+{
+    int i = 0;
+
+    for (i = 0; i < out->count; i++)
+        av_packet_free(&out->ring[(out->head + i) % out->cap]);
+
+    pthread_cond_destroy(&out->cond);
+    pthread_mutex_destroy(&out->mutex);
+    free(out->ring);
+    free(out);
+}
+
+static void __tee_output_push(tee_output_t *out, const AVPacket *pkt)
+{
+    AVPacket *ref = NULL;
+    int is_key = pkt->stream_index == TEE_VIDEO && (pkt->flags & AV_PKT_FLAG_KEY);
+
+    pthread_mutex_lock(&out->mutex);
+
+    //丢过视频之后要等到关键帧才能继续写视频
+    if (out->need_key && pkt->stream_index == TEE_VIDEO && !is_key) {
+        out->dropped++;
+        goto unlock;
+    }
+
+    if (out->count == out->cap) {
+        out->dropped++;
+        if (pkt->stream_index == TEE_VIDEO)
+            out->need_key = 1;
+        goto unlock;
+    }
+
+    //只增加引用,不拷贝数据
+    ref = av_packet_clone(pkt);
+    if (ref == NULL) {
+        out->dropped++;
+        goto unlock;
+    }
+
+    if (is_key)
+        out->need_key = 0;
+
+    out->ring[(out->head + out->count) % out->cap] = ref;
+    out->count++;
+
+    pthread_cond_signal(&out->cond);
+
+unlock:
+    pthread_mutex_unlock(&out->mutex);
+}
+
+static int __tee_dispatch(tee_t *tee, AVPacket *pkt)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&tee->mutex);
+
+    for (i = 0; i < tee->nb_outputs; i++)
+        __tee_output_push(tee->outputs[i], pkt);
+
+    pthread_mutex_unlock(&tee->mutex);
+
+    av_packet_unref(pkt);
+
+    return 0;
+}
+
+tee_t *tee_create(void)
+{
+    tee_t *tee = (tee_t *)calloc(1, sizeof(tee_t));
+    if (tee != NULL) {
+        *tee = TEE_INIT();
+    }
+
+    return tee;
+}
+
+void tee_destroy(tee_t **tee)
+{
+    tee_output_t *out = NULL;
+    int i = 0;
+
+    if (tee == NULL || *tee == NULL)
+        return;
+
+    pthread_mutex_lock(&(*tee)->mutex);
+
+    for (i = 0; i < (*tee)->nb_outputs; i++) {
+        out = (*tee)->outputs[i];
+
+        pthread_mutex_lock(&out->mutex);
+        out->quit = 1;
+        pthread_cond_signal(&out->cond);
+        pthread_mutex_unlock(&out->mutex);
+
+        pthread_join(out->thread, NULL);
+        __tee_output_free(out);
+        (*tee)->outputs[i] = NULL;
+    }
+
+    (*tee)->nb_outputs = 0;
+
+    pthread_mutex_unlock(&(*tee)->mutex);
+
+    free(*tee);
+    *tee = NULL;
+}
+
+int tee_add_output(tee_t *tee, muxer_t *muxer, int max_packets)
+{
+    tee_output_t *out = NULL;
+    int ret = -1;
+
+    if (tee == NULL || muxer == NULL)
+        return -1;
+
+    if (max_packets <= 0)
+        max_packets = TEE_DEFAULT_PACKETS;
+
+    pthread_mutex_lock(&tee->mutex);
+
+    if (tee->nb_outputs >= TEE_MAX_OUTPUTS) {
+        LOG("too many tee outputs\n");
+        ret = -2;
+        goto fail;
+    }
+
+    out = (tee_output_t *)calloc(1, sizeof(tee_output_t));
+    if (out == NULL) {
+        ret = -3;
+        goto fail;
+    }
+
+    out->ring = (AVPacket **)calloc(max_packets, sizeof(AVPacket *));
+    if (out->ring == NULL) {
+        free(out);
+        ret = -3;
+        goto fail;
+    }
+
+    out->muxer = muxer;
+    out->cap = max_packets;
+    pthread_mutex_init(&out->mutex, NULL);
+    pthread_cond_init(&out->cond, NULL);
+
+    if (pthread_create(&out->thread, NULL, __tee_output_thread, out) != 0) {
+        LOG("create tee output thread failed\n");
+        __tee_output_free(out);
+        ret = -4;
+        goto fail;
+    }
+
+    ret = tee->nb_outputs;
+    tee->outputs[tee->nb_outputs++] = out;
+
+fail:
+    pthread_mutex_unlock(&tee->mutex);
+
+    return ret;
+}
+
+int tee_write_video(tee_t *tee, const char *data, const int len, const unsigned char keyframe, int64_t pts, int64_t dts)
+{
+    AVPacket pkt;
+
+    if (tee == NULL || data == NULL || len <= 0)
+        return -1;
+
+    //唯一一次拷贝
+    if (av_new_packet(&pkt, len) < 0)
+        return -2;
+
+    memcpy(pkt.data, data, len);
+    pkt.stream_index = TEE_VIDEO;
+    pkt.flags = keyframe ? AV_PKT_FLAG_KEY : 0;
+    pkt.pts = pts < 0 ? AV_NOPTS_VALUE : pts;
+    pkt.dts = dts < 0 ? AV_NOPTS_VALUE : dts;
+
+    return __tee_dispatch(tee, &pkt);
+}
+
+int tee_write_audio(tee_t *tee, const char *data, const int data_size, const int64_t pts)
+{
+    AVPacket pkt;
+
+    if (tee == NULL || data == NULL || data_size <= 0)
+        return -1;
+
+    if (av_new_packet(&pkt, data_size) < 0)
+        return -2;
+
+    memcpy(pkt.data, data, data_size);
+    pkt.stream_index = TEE_AUDIO;
+    pkt.pts = pts < 0 ? AV_NOPTS_VALUE : pts;
+    pkt.dts = pkt.pts;
+
+    return __tee_dispatch(tee, &pkt);
+}
+
+int64_t tee_get_dropped(tee_t *tee, int index)
+{
+    int64_t dropped = -1;
+
+    if (tee == NULL)
+        return -1;
+
+    pthread_mutex_lock(&tee->mutex);
+
+    if (index >= 0 && index < tee->nb_outputs) {
+        pthread_mutex_lock(&tee->outputs[index]->mutex);
+        dropped = tee->outputs[index]->dropped;
+        pthread_mutex_unlock(&tee->outputs[index]->mutex);
+    }
+
+    pthread_mutex_unlock(&tee->mutex);
+
+    return dropped;
+}
@@ -0,0 +1,74 @@
+#ifndef __TEE_H
+#define __TEE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "mux.h"
+
+/**
+ * @brief 一路音视频同时写多个muxer(比如本地mp4,实时回看的fmp4,给老系统的ts)
+ *   数据只拷贝一次到带引用计数的packet,每个输出只增加引用(音频在各个muxer中加ADTS头时还会拷贝),
+ *   每个输出有自己的写线程和队列,慢的输出不会阻塞其他输出,
+ *   队列满时丢弃这个输出的数据直到下一个视频关键帧
+ */
+struct tee;
+typedef struct tee tee_t;
+
+#define TEE_MAX_OUTPUTS 8
+
+/**
+ * @brief 创建tee
+ *
+ * @return tee_t*
+ */
+tee_t *tee_create(void);
+
+/**
+ * @brief 停止所有写线程(队列中的数据会写完),摧毁tee, 不会关闭muxer
+ *
+ * @param tee
+ */
+void tee_destroy(tee_t **tee);
+
+/**
+ * @brief 添加一个输出,muxer需要已经muxer_add_video_and_audio或muxer_start
+ *
+ * @param tee: tee_create返回值
+ * @param muxer: 输出,tee_destroy之前不能关闭
+ * @param max_packets: 队列最多缓存的packet数,<=0使用默认值
+ * @return int: >=0输出序号 其他失败
+ */
+int tee_add_output(tee_t *tee, muxer_t *muxer, int max_packets);
+
+/**
+ * @brief 写入视频数据到所有输出,参数同muxer_write_video_ts
+ *
+ * @return int: 0成功 其他失败
+ */
+int tee_write_video(tee_t *tee, const char *data, const int len, const unsigned char keyframe, int64_t pts, int64_t dts);
+
+/**
+ * @brief 写入音频数据到所有输出,参数同muxer_write_audio
+ *
+ * @return int: 0成功 其他失败
+ */
+int tee_write_audio(tee_t *tee, const char *data, const int data_size, const int64_t pts);
+
+/**
+ * @brief 获取某个输出因为队列满丢弃的packet数
+ *
+ * @param tee: tee_create返回值
+ * @param index: tee_add_output返回值
+ * @return int64_t: 丢弃个数 <0失败
+ */
+int64_t tee_get_dropped(tee_t *tee, int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__TEE_H
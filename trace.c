@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdatomic.h>
+
+#include "libavutil/time.h"
+
+#include "trace.h"
+
+#define TRACE_DEFAULT_EVENTS    65536
+#define TRACE_NAME_SIZE         32
+
+typedef struct trace_event {
+    const char *name;
+    const char *category;
+    int64_t ts;
+    int64_t dur;
+} trace_event_t;
+
+/**
+ * 每个线程一个,只有所属线程写,count用release发布给trace_dump
+ * 缓冲区从不释放: trace_start之后仍可能有线程在写(enabled的检查不加锁),
+ * trace_start只把count清零,线程退出后缓冲区留给新线程使用
+ */
+typedef struct trace_buffer {
+    struct trace_buffer *next;
+    int tid;
+    char thread_name[TRACE_NAME_SIZE];
+    int capacity;
+    atomic_int in_use;          //有线程在使用
+    atomic_int count;
+    atomic_int dropped;
+    trace_event_t events[];
+} trace_buffer_t;
+
+static _Atomic(trace_buffer_t *) buffers;
+static atomic_int enabled;
+static atomic_int next_tid;
+static atomic_int capacity = TRACE_DEFAULT_EVENTS;
+static int64_t origin;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static __thread trace_buffer_t *tls_buffer;
+static __thread char tls_name[TRACE_NAME_SIZE];
+
+static void __trace_thread_exit(void *arg)
+{
+    trace_buffer_t *b = (trace_buffer_t *)arg;
+
+    atomic_store(&b->in_use, 0);
+}
+
+static void __trace_key_init(void)
+{
+    pthread_key_create(&key, __trace_thread_exit);
+}
+
+/**
+ * 找一个已经退出的线程留下的缓冲区,这次trace中写过数据的不能用
+ */
+static trace_buffer_t *__trace_claim(int size)
+{
+    trace_buffer_t *b = NULL;
+    int expected = 0;
+
+    for (b = atomic_load(&buffers); b != NULL; b = b->next) {
+        if (b->capacity < size || atomic_load(&b->count) != 0)
+            continue;
+        expected = 0;
+        if (atomic_compare_exchange_strong(&b->in_use, &expected, 1))
+            return b;
+    }
+
+    return NULL;
+}
+
+static trace_buffer_t *__trace_buffer(void)
+{
+    trace_buffer_t *b = NULL;
+    int size = atomic_load_explicit(&capacity, memory_order_relaxed);
+
+    if (tls_buffer != NULL && tls_buffer->capacity >= size)
+        return tls_buffer;
+
+    //容量变大了,旧的留给容量小的时候用
+    if (tls_buffer != NULL)
+        atomic_store(&tls_buffer->in_use, 0);
+    tls_buffer = NULL;
+
+    b = __trace_claim(size);
+    if (b == NULL) {
+        b = malloc(sizeof(trace_buffer_t) + (size_t)size * sizeof(trace_event_t));
+        if (b == NULL)
+            return NULL;
+
+        b->capacity = size;
+        atomic_init(&b->in_use, 1);
+        atomic_init(&b->count, 0);
+        atomic_init(&b->dropped, 0);
+
+        b->next = atomic_load(&buffers);
+        while (!atomic_compare_exchange_weak(&buffers, &b->next, b))
+            ;
+    }
+
+    b->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    if (tls_name[0] != '\0')
+        memcpy(b->thread_name, tls_name, sizeof(b->thread_name));
+    else
+        snprintf(b->thread_name, sizeof(b->thread_name), "thread %d", b->tid);
+
+    pthread_once(&key_once, __trace_key_init);
+    pthread_setspecific(key, b);
+    tls_buffer = b;
+
+    return b;
+}
+
+int trace_start(int events_per_thread)
+{
+    trace_buffer_t *b = NULL;
+
+    if (atomic_load(&enabled))
+        return -1;
+
+    //只清空不释放,trace_stop之前通过检查的写入者可能还在写,最多混入几个上一次的事件
+    for (b = atomic_load(&buffers); b != NULL; b = b->next) {
+        atomic_store(&b->count, 0);
+        atomic_store(&b->dropped, 0);
+    }
+
+    atomic_store(&capacity, events_per_thread > 0 ? events_per_thread : TRACE_DEFAULT_EVENTS);
+    origin = av_gettime_relative();
+    atomic_store(&enabled, 1);
+
+    return 0;
+}
+
+void trace_stop(void)
+{
+    atomic_store(&enabled, 0);
+}
+
+void trace_set_thread_name(const char *name)
+{
+    if (name == NULL)
+        return;
+
+    snprintf(tls_name, sizeof(tls_name), "%s", name);
+
+    if (tls_buffer != NULL)
+        memcpy(tls_buffer->thread_name, tls_name, sizeof(tls_name));
+}
+
+int64_t trace_begin(void)
+{
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed))
+        return 0;
+
+    return av_gettime_relative();
+}
+
+void trace_end(const char *name, const char *category, int64_t begin)
+{
+    trace_buffer_t *b = NULL;
+    trace_event_t *e = NULL;
+    int n = 0;
+
+    if (begin == 0 || !atomic_load_explicit(&enabled, memory_order_relaxed))
+        return;
+
+    b = __trace_buffer();
+    if (b == NULL)
+        return;
+
+    n = atomic_load_explicit(&b->count, memory_order_relaxed);
+    if (n >= b->capacity) {
+        atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    e = &b->events[n];
+    e->name = name;
+    e->category = category;
+    e->ts = begin;
+    e->dur = av_gettime_relative() - begin;
+
+    atomic_store_explicit(&b->count, n + 1, memory_order_release);
+}
+
+void trace_span_end(trace_span_t *span)
+{
+    if (span != NULL)
+        trace_end(span->name, span->category, span->begin);
+}
+
+int trace_mutex_lock(pthread_mutex_t *mutex, const char *name)
+{
+    int64_t begin = 0;
+    int ret = 0;
+
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed))
+        return pthread_mutex_lock(mutex);
+
+    //没有竞争时不记录
+    if (pthread_mutex_trylock(mutex) == 0)
+        return 0;
+
+    begin = av_gettime_relative();
+    ret = pthread_mutex_lock(mutex);
+    trace_end(name, "lock", begin);
+
+    return ret;
+}
+
+int trace_dump(const char *filename)
+{
+    trace_buffer_t *b = NULL;
+    const trace_event_t *e = NULL;
+    FILE *fp = NULL;
+    int i = 0, n = 0, total = 0, dropped = 0, first = 1;
+
+    if (filename == NULL)
+        return -1;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+        return -2;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (b = atomic_load(&buffers); b != NULL; b = b->next) {
+        n = atomic_load_explicit(&b->count, memory_order_acquire);
+        //没有使用的缓冲区
+        if (n == 0 && !atomic_load(&b->in_use))
+            continue;
+
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", b->tid, b->thread_name);
+        first = 0;
+
+        for (i = 0; i < n; i++) {
+            e = &b->events[i];
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                    e->name, e->category, b->tid, (long long)(e->ts - origin), (long long)e->dur);
+        }
+
+        total += n;
+        dropped += atomic_load(&b->dropped);
+    }
+
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0)
+        return -3;
+
+    if (dropped > 0)
+        fprintf(stderr, "trace: %d events dropped, increase events_per_thread\n", dropped);
+
+    return total;
+}
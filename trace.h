@@ -0,0 +1,101 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief 接口调用和流水线各阶段的耗时记录,输出chrome trace json,
+ *   用chrome://tracing或者ui.perfetto.dev打开
+ *   用qmake CONFIG+=trace编译(定义TRACE_EVENTS)时埋点才生效,运行时还要调用trace_start
+ *   每个线程写自己的缓冲区,不加锁,缓冲区满后丢弃新的事件
+ *   demuxer->mutex和muxer->mutex等待时间超过0时记录为"lock"类事件,可以看出锁竞争
+ */
+typedef struct trace_span {
+    const char *name;
+    const char *category;
+    int64_t begin;
+} trace_span_t;
+
+/**
+ * @brief 开始记录,清空上一次记录的数据(缓冲区重复使用,不释放)
+ *
+ * @param events_per_thread: 每个线程最多记录的事件数,<=0使用默认值65536
+ * @return int: 0成功 其他失败
+ *              -1:已经开始
+ */
+int trace_start(int events_per_thread);
+
+/**
+ * @brief 停止记录,之后可以trace_dump
+ */
+void trace_stop(void);
+
+/**
+ * @brief 把记录的事件写成chrome trace json
+ *
+ * @param filename: 输出文件
+ * @return int: >=0写入的事件数 <0失败
+ */
+int trace_dump(const char *filename);
+
+/**
+ * @brief 设置当前线程在trace中显示的名字
+ *
+ * @param name: 最长31个字符
+ */
+void trace_set_thread_name(const char *name);
+
+/**
+ * @brief 返回开始时间,没有开始记录时返回0
+ */
+int64_t trace_begin(void);
+
+/**
+ * @brief 记录一个从begin到现在的事件
+ *
+ * @param name: 事件名,必须是常量字符串,dump时才读取
+ * @param category: 分类,同上
+ * @param begin: trace_begin返回值
+ */
+void trace_end(const char *name, const char *category, int64_t begin);
+
+/**
+ * @brief TRACE_SCOPE使用,作用域结束时记录
+ */
+void trace_span_end(trace_span_t *span);
+
+/**
+ * @brief 加锁,需要等待时记录等待时间
+ *
+ * @param mutex
+ * @param name: 锁的名字,常量字符串
+ * @return int: pthread_mutex_lock返回值
+ */
+int trace_mutex_lock(pthread_mutex_t *mutex, const char *name);
+
+#ifdef TRACE_EVENTS
+//记录当前函数从这里到返回的时间,每个函数只能用一次
+#define TRACE_SCOPE(name, category) \
+    trace_span_t __trace_span __attribute__((cleanup(trace_span_end), unused)) = { name, category, trace_begin() }
+#define TRACE_BEGIN(var)                    int64_t var = trace_begin()
+#define TRACE_END(var, name, category)      trace_end(name, category, var)
+#define TRACE_MUTEX_LOCK(mutex, name)       trace_mutex_lock(mutex, name)
+#define TRACE_THREAD_NAME(name)             trace_set_thread_name(name)
+#else
+#define TRACE_SCOPE(name, category)
+#define TRACE_BEGIN(var)
+#define TRACE_END(var, name, category)
+#define TRACE_MUTEX_LOCK(mutex, name)       pthread_mutex_lock(mutex)
+#define TRACE_THREAD_NAME(name)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__TRACE_H